@@ -0,0 +1,526 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <queue>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "cas_queue.hxx"
+
+/*
+ * 	【队列基准测试】
+ *
+ * 对八个队列类以及两个基线队列，遍历生产者/消费者线程数、数据大小、队列长度，输出吞吐量和单条消息延迟的分位数
+ * 每条消息中嵌入生产时刻的时间戳(x86下为rdtsc)，消费者取出后计算延迟，线程按序号绑定到CPU核心
+ * 输出为CSV或JSON，便于在不同版本之间对比
+ *
+ * 用法: ./bench [-m 每组消息数] [-t 最大线程数] [-p 数据大小列表] [-c 队列长度列表] [-q 队列名列表] [-f csv|json] [-o 输出文件]
+ * 例如: ./bench -m 1000000 -t 8 -p 8,64,1024 -c 1024,65536 -q CasQueueMPMC,Mutex -f json -o result.json
+ *
+ */
+
+// 时间戳，x86下为TSC计数，其它平台为纳秒
+static inline unsigned long Tick()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000UL + now.tv_nsec;
+#endif
+}
+
+static inline double NowSecond()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// 用100ms的单调时钟校准每个tick对应的纳秒数
+static double CalibrateTick()
+{
+	double start_second = NowSecond();
+	unsigned long start_tick = Tick();
+	while (NowSecond() - start_second < 0.1)
+		;
+
+	return (NowSecond() - start_second) * 1e9 / (Tick() - start_tick);
+}
+
+// N字节的消息，前8字节为生产时刻
+template <unsigned int N>
+struct Message
+{
+	unsigned long tick;
+	char pad[N - sizeof(unsigned long)];
+};
+
+template <>
+struct Message<8>
+{
+	unsigned long tick;
+};
+
+// 基线一：互斥锁 + 条件变量 + std::queue 的有界阻塞队列
+template <class T>
+class MutexQueue
+{
+	public:
+		MutexQueue(int queue_size)
+		{
+			size = queue_size;
+			pthread_mutex_init(&mutex, NULL);
+			pthread_cond_init(&not_full, NULL);
+			pthread_cond_init(&not_empty, NULL);
+		}
+
+		~MutexQueue()
+		{
+			pthread_cond_destroy(&not_empty);
+			pthread_cond_destroy(&not_full);
+			pthread_mutex_destroy(&mutex);
+		}
+
+		bool Product(const T &t_product)
+		{
+			pthread_mutex_lock(&mutex);
+			while (queue.size() >= size)
+				pthread_cond_wait(&not_full, &mutex);
+
+			queue.push(t_product);
+			pthread_cond_signal(&not_empty);
+			pthread_mutex_unlock(&mutex);
+
+			return true;
+		}
+
+		bool Consume(T &t_consume)
+		{
+			pthread_mutex_lock(&mutex);
+			while (queue.empty())
+				pthread_cond_wait(&not_empty, &mutex);
+
+			t_consume = queue.front();
+			queue.pop();
+			pthread_cond_signal(&not_full);
+			pthread_mutex_unlock(&mutex);
+
+			return true;
+		}
+
+	private:
+		std::queue<T> queue;
+		size_t size;
+		pthread_mutex_t mutex;
+		pthread_cond_t not_full;
+		pthread_cond_t not_empty;
+};
+
+// 基线二：Dmitry Vyukov的有界MPMC队列，每个cell带序号，满或空时返回false
+template <class T>
+class VyukovQueue
+{
+	public:
+		VyukovQueue(int queue_size)
+		{
+			size = pow(2, (ceil(log2(queue_size))));
+			p_queue = new CELL [size];
+			for (unsigned long ii = 0; ii < size; ++ii)
+				p_queue[ii].seq = ii;
+
+			product_index = consume_index = 0;
+		}
+
+		~VyukovQueue()
+		{
+			delete [] p_queue;
+		}
+
+		bool Product(const T &t_product)
+		{
+			unsigned long current_index = __atomic_load_n(&product_index, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				CELL *cell = &p_queue[current_index & (size - 1)];
+				long diff = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)current_index;
+				if (0 == diff)
+				{
+					if (true == __atomic_compare_exchange_n(&product_index, &current_index, current_index + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					{
+						cell->data = t_product;
+						__atomic_store_n(&cell->seq, current_index + 1, __ATOMIC_RELEASE);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					current_index = __atomic_load_n(&product_index, __ATOMIC_RELAXED);
+				}
+			}
+		}
+
+		bool Consume(T &t_consume)
+		{
+			unsigned long current_index = __atomic_load_n(&consume_index, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				CELL *cell = &p_queue[current_index & (size - 1)];
+				long diff = (long)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (long)(current_index + 1);
+				if (0 == diff)
+				{
+					if (true == __atomic_compare_exchange_n(&consume_index, &current_index, current_index + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					{
+						t_consume = cell->data;
+						__atomic_store_n(&cell->seq, current_index + size, __ATOMIC_RELEASE);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					current_index = __atomic_load_n(&consume_index, __ATOMIC_RELAXED);
+				}
+			}
+		}
+
+	private:
+		typedef struct
+		{
+			unsigned long seq;
+			T data;
+		} CELL;
+
+		CELL *p_queue __attribute__((aligned(64)));
+		unsigned long size;
+		unsigned long product_index __attribute__((aligned(64)));
+		unsigned long consume_index __attribute__((aligned(64)));
+};
+
+// 命令行参数
+struct Option
+{
+	long messages;
+	int max_thread;
+	std::vector<int> payloads;
+	std::vector<int> capacities;
+	std::vector<std::string> names;
+	bool is_json;
+	FILE *out;
+	int row_count;
+	int cpu_count;
+	double tick_ns;
+};
+
+static Option option;
+
+template <class Q, class M>
+struct BenchThread
+{
+	Q *queue;
+	pthread_barrier_t *barrier;
+	int cpu;
+	long count;
+	std::vector<unsigned long> *latency;  // 消费者记录的延迟，单位tick
+};
+
+static void PinThread(int cpu)
+{
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	CPU_SET(cpu, &cpu_set);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+}
+
+// 非阻塞队列满或空时先自旋，再让出CPU
+static inline void Backoff(unsigned int &spin)
+{
+	if (++spin < 64)
+	{
+		__CasCpuRelax();
+	}
+	else
+	{
+		sched_yield();
+		spin = 0;
+	}
+}
+
+template <class Q, class M>
+void *ProductThread(void *arg)
+{
+	BenchThread<Q, M> *thread = (BenchThread<Q, M> *)arg;
+	PinThread(thread->cpu);
+
+	M message;
+	memset(&message, 0, sizeof(message));
+	pthread_barrier_wait(thread->barrier);
+
+	for (long ii = 0; ii < thread->count; ++ii)
+	{
+		message.tick = Tick();
+		unsigned int spin = 0;
+		while (false == thread->queue->Product(message))
+			Backoff(spin);
+	}
+
+	return NULL;
+}
+
+template <class Q, class M>
+void *ConsumeThread(void *arg)
+{
+	BenchThread<Q, M> *thread = (BenchThread<Q, M> *)arg;
+	PinThread(thread->cpu);
+
+	M message;
+	std::vector<unsigned long> &latency = *thread->latency;
+	pthread_barrier_wait(thread->barrier);
+
+	for (long ii = 0; ii < thread->count; ++ii)
+	{
+		unsigned int spin = 0;
+		while (false == thread->queue->Consume(message))
+			Backoff(spin);
+
+		latency.push_back(Tick() - message.tick);
+	}
+
+	return NULL;
+}
+
+static void Report(const char *name, int producer, int consumer, int payload, int capacity, double second, std::vector<unsigned long> &latency)
+{
+	size_t count = latency.size();
+	double percent[3] = {0.5, 0.99, 0.999};
+	double value[3];
+	for (int ii = 0; ii < 3; ++ii)
+	{
+		size_t nth = (size_t)(percent[ii] * (count - 1));
+		std::nth_element(latency.begin(), latency.begin() + nth, latency.end());
+		value[ii] = latency[nth] * option.tick_ns;
+	}
+
+	double mops = count / second / 1e6;
+	if (true == option.is_json)
+	{
+		fprintf(option.out, "%s\n  {\"queue\": \"%s\", \"producers\": %d, \"consumers\": %d, \"payload\": %d, \"capacity\": %d, \"messages\": %zu, "
+				"\"seconds\": %.6f, \"mops\": %.3f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f}",
+				0 == option.row_count ? "" : ",", name, producer, consumer, payload, capacity, count, second, mops, value[0], value[1], value[2]);
+	}
+	else
+	{
+		fprintf(option.out, "%s,%d,%d,%d,%d,%zu,%.6f,%.3f,%.0f,%.0f,%.0f\n",
+				name, producer, consumer, payload, capacity, count, second, mops, value[0], value[1], value[2]);
+	}
+
+	fflush(option.out);
+	++option.row_count;
+}
+
+template <class Q, class M>
+void Run(const char *name, int producer, int consumer, int capacity)
+{
+	Q queue(capacity);
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, producer + consumer + 1);
+
+	std::vector<BenchThread<Q, M> > threads(producer + consumer);
+	std::vector<std::vector<unsigned long> > latencies(consumer);
+	std::vector<pthread_t> thread_ids(producer + consumer);
+
+	long messages = option.messages;
+	for (int ii = 0; ii < producer + consumer; ++ii)
+	{
+		bool is_product = ii < producer;
+		int index = is_product ? ii : ii - producer;
+		int count = is_product ? producer : consumer;
+
+		threads[ii].queue = &queue;
+		threads[ii].barrier = &barrier;
+		threads[ii].cpu = ii % option.cpu_count;
+		threads[ii].count = messages / count + (index < messages % count ? 1 : 0);
+		threads[ii].latency = is_product ? NULL : &latencies[index];
+		if (false == is_product)
+			latencies[index].reserve(threads[ii].count);
+
+		pthread_create(&thread_ids[ii], NULL, is_product ? ProductThread<Q, M> : ConsumeThread<Q, M>, &threads[ii]);
+	}
+
+	pthread_barrier_wait(&barrier);
+	double start_second = NowSecond();
+
+	for (int ii = 0; ii < producer + consumer; ++ii)
+		pthread_join(thread_ids[ii], NULL);
+
+	double second = NowSecond() - start_second;
+	pthread_barrier_destroy(&barrier);
+
+	std::vector<unsigned long> latency;
+	latency.reserve(messages);
+	for (int ii = 0; ii < consumer; ++ii)
+		latency.insert(latency.end(), latencies[ii].begin(), latencies[ii].end());
+
+	Report(name, producer, consumer, sizeof(M), capacity, second, latency);
+}
+
+static bool Selected(const char *name)
+{
+	if (true == option.names.empty())
+		return true;
+
+	for (size_t ii = 0; ii < option.names.size(); ++ii)
+	{
+		if (NULL != strstr(name, option.names[ii].c_str()))
+			return true;
+	}
+
+	return false;
+}
+
+// 单生产者或单消费者的队列类只测试对应一侧为1个线程的组合
+template <class Q, class M>
+void Sweep(const char *name, bool is_multi_product, bool is_multi_consume)
+{
+	if (false == Selected(name))
+		return;
+
+	for (size_t ii = 0; ii < option.capacities.size(); ++ii)
+	{
+		for (int producer = 1; producer <= (is_multi_product ? option.max_thread : 1); producer *= 2)
+		{
+			for (int consumer = 1; consumer <= (is_multi_consume ? option.max_thread : 1); consumer *= 2)
+				Run<Q, M>(name, producer, consumer, option.capacities[ii]);
+		}
+	}
+}
+
+template <unsigned int N>
+void SweepPayload()
+{
+	typedef Message<N> M;
+
+	Sweep<CasQueueMPMC<M>, M>("CasQueueMPMC", true, true);
+	Sweep<CasQueueMPOC<M>, M>("CasQueueMPOC", true, false);
+	Sweep<CasQueueOPMC<M>, M>("CasQueueOPMC", false, true);
+	Sweep<CasQueueOPOC<M>, M>("CasQueueOPOC", false, false);
+	Sweep<CasQueueNoBlockMPMC<M>, M>("CasQueueNoBlockMPMC", true, true);
+	Sweep<CasQueueNoBlockMPOC<M>, M>("CasQueueNoBlockMPOC", true, false);
+	Sweep<CasQueueNoBlockOPMC<M>, M>("CasQueueNoBlockOPMC", false, true);
+	Sweep<CasQueueNoBlockOPOC<M>, M>("CasQueueNoBlockOPOC", false, false);
+	Sweep<MutexQueue<M>, M>("MutexQueue", true, true);
+	Sweep<VyukovQueue<M>, M>("VyukovQueue", true, true);
+}
+
+static void ParseList(const char *text, std::vector<int> &values)
+{
+	values.clear();
+	std::string list(text);
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (std::string::npos == end)
+			end = list.size();
+
+		if (end > start)
+			values.push_back(atoi(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+}
+
+static void ParseNames(const char *text, std::vector<std::string> &names)
+{
+	names.clear();
+	std::string list(text);
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (std::string::npos == end)
+			end = list.size();
+
+		if (end > start)
+			names.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	option.cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+	option.messages = 1000000;
+	option.max_thread = option.cpu_count;
+	ParseList("8,64,256,1024", option.payloads);
+	ParseList("1024,65536", option.capacities);
+	option.is_json = false;
+	option.out = stdout;
+	option.row_count = 0;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "m:t:p:c:q:f:o:h")))
+	{
+		switch (opt)
+		{
+			case 'm': option.messages = atol(optarg); break;
+			case 't': option.max_thread = atoi(optarg); break;
+			case 'p': ParseList(optarg, option.payloads); break;
+			case 'c': ParseList(optarg, option.capacities); break;
+			case 'q': ParseNames(optarg, option.names); break;
+			case 'f': option.is_json = 0 == strcmp(optarg, "json"); break;
+			case 'o':
+				option.out = fopen(optarg, "w");
+				if (NULL == option.out)
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-m messages] [-t max_threads] [-p payloads] [-c capacities] [-q queues] [-f csv|json] [-o file]\n", argv[0]);
+				return 'h' == opt ? 0 : 1;
+		}
+	}
+
+	option.tick_ns = CalibrateTick();
+	fprintf(stderr, "online cpus: %d, %.3f ns per tick\n", option.cpu_count, option.tick_ns);
+
+	if (true == option.is_json)
+		fprintf(option.out, "[");
+	else
+		fprintf(option.out, "queue,producers,consumers,payload,capacity,messages,seconds,mops,p50_ns,p99_ns,p999_ns\n");
+
+	for (size_t ii = 0; ii < option.payloads.size(); ++ii)
+	{
+		switch (option.payloads[ii])
+		{
+			case 8: SweepPayload<8>(); break;
+			case 64: SweepPayload<64>(); break;
+			case 256: SweepPayload<256>(); break;
+			case 1024: SweepPayload<1024>(); break;
+			case 4096: SweepPayload<4096>(); break;
+			default: fprintf(stderr, "unsupported payload %d, use 8/64/256/1024/4096\n", option.payloads[ii]); break;
+		}
+	}
+
+	if (true == option.is_json)
+		fprintf(option.out, "\n]\n");
+
+	if (stdout != option.out)
+		fclose(option.out);
+
+	return 0;
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <functional>
+#include "cas_executor.hxx"
+
+/*
+ * 	【执行器基准测试】
+ *
+ * 对比CasExecutor与“所有工作线程共用一个CasQueueMPMC<std::function<void()>>”的线程池，工作线程数从1按2倍增加到最大线程数
+ * forkjoin : 递归计算fib(n)，n不小于cutoff时分出一个子任务，另一半在本线程计算，等待子任务时帮助执行
+ * fanout   : 一个根任务在池中提交m个叶子任务，每个叶子做w次空循环，根任务等待全部完成
+ * 输出CSV，speedup为相对同一线程池1个工作线程的加速比
+ *
+ * 用法: ./bench_executor [-t 最大线程数] [-n fib参数] [-c cutoff] [-m 叶子任务数] [-w 每个叶子的循环次数] [-r 重复次数取最快]
+ *
+ */
+
+static inline double NowSecond()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// 基线：所有工作线程阻塞在同一个CasQueueMPMC上，任务为std::function
+class GlobalPool
+{
+	public:
+		GlobalPool(int worker_num) : queue(65536)
+		{
+			workers = worker_num;
+			p_threads = new pthread_t [workers];
+
+			// 等待时先进先出地帮助执行任意任务，fork/join的递归深度没有上限，需要比默认更大的栈
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+			pthread_attr_setstacksize(&attr, 256UL << 20);
+			for (int ii = 0; ii < workers; ++ii)
+				pthread_create(&p_threads[ii], &attr, __WorkerMain, this);
+			pthread_attr_destroy(&attr);
+		}
+
+		~GlobalPool()
+		{
+			queue.Close();
+			for (int ii = 0; ii < workers; ++ii)
+				pthread_join(p_threads[ii], NULL);
+			delete [] p_threads;
+		}
+
+		// 队列满时帮助执行任务，工作线程中的根任务不会阻塞在只有自己能腾空的队列上
+		template <class F>
+		void Submit(F &&f)
+		{
+			std::function<void()> task(std::forward<F>(f));
+			while (false == queue.TryProduct(std::move(task)))
+			{
+				if (false == RunOne())
+					sched_yield();
+			}
+		}
+
+		bool RunOne()
+		{
+			std::function<void()> task;
+			if (false == queue.TryConsume(task))
+				return false;
+
+			task();
+			return true;
+		}
+
+	private:
+		CasQueueMPMC<std::function<void()> > queue;
+		pthread_t *p_threads;
+		int workers;
+
+		static void *__WorkerMain(void *arg)
+		{
+			GlobalPool *p_pool = static_cast<GlobalPool *>(arg);
+			std::function<void()> task;
+			while (true == p_pool->queue.Consume(task))
+				task();
+
+			return NULL;
+		}
+};
+
+// 基线的子任务组，等待时帮助执行全局队列中的任务
+class GlobalGroup
+{
+	public:
+		GlobalGroup(GlobalPool &pool) : pool(pool), pending(0)
+		{
+		}
+
+		template <class F>
+		void Spawn(F &&f)
+		{
+			pending.fetch_add(1, std::memory_order_relaxed);
+			pool.Submit([this, f]() { f(); pending.fetch_sub(1, std::memory_order_release); });
+		}
+
+		void Wait()
+		{
+			while (0 != pending.load(std::memory_order_acquire))
+			{
+				if (false == pool.RunOne())
+					sched_yield();
+			}
+		}
+
+	private:
+		GlobalPool &pool;
+		std::atomic<long> pending;
+};
+
+struct Option
+{
+	int max_thread;
+	int fib_n;
+	int cutoff;
+	long leaf_count;
+	long leaf_work;
+	int repeat;
+} option;
+
+std::atomic<long> task_count {0};
+
+long FibSerial(int n)
+{
+	return n < 2 ? n : FibSerial(n - 1) + FibSerial(n - 2);
+}
+
+template <class Pool, class Group>
+long Fib(Pool &pool, int n)
+{
+	if (n < option.cutoff)
+		return FibSerial(n);
+
+	task_count.fetch_add(1, std::memory_order_relaxed);
+	long left, right;
+	Group group(pool);
+	group.Spawn([&pool, &left, n]() { left = Fib<Pool, Group>(pool, n - 1); });
+	right = Fib<Pool, Group>(pool, n - 2);
+	group.Wait();
+
+	return left + right;
+}
+
+static inline void Spin(long work)
+{
+	for (long ii = 0; ii < work; ++ii)
+		__asm__ __volatile__("" ::: "memory");
+}
+
+template <class Pool, class Group>
+void FanOut(Pool &pool)
+{
+	Group group(pool);
+	for (long ii = 0; ii < option.leaf_count; ++ii)
+		group.Spawn([]() { Spin(option.leaf_work); });
+	group.Wait();
+
+	task_count.fetch_add(option.leaf_count, std::memory_order_relaxed);
+}
+
+// 在池中运行一次根任务，外部线程等待它完成，返回耗时
+template <class Pool, class Group, class F>
+double RunRoot(Pool &pool, F &&root)
+{
+	std::atomic<bool> is_done {false};
+	double start = NowSecond();
+	pool.Submit([&pool, &root, &is_done]() { root(pool); is_done.store(true, std::memory_order_release); });
+	while (false == is_done.load(std::memory_order_acquire))
+		usleep(100);
+
+	return NowSecond() - start;
+}
+
+template <class Pool, class Group>
+void Sweep(const char *pool_name)
+{
+	const char *modes[] = {"forkjoin", "fanout"};
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		double base_second = 0;
+		for (int threads = 1; ; threads = threads * 2 < option.max_thread ? threads * 2 : option.max_thread)
+		{
+			Pool pool(threads);
+			double best_second = 0;
+			long tasks = 0;
+			bool is_ok = true;
+			for (int rr = 0; rr < option.repeat; ++rr)
+			{
+				task_count.store(0, std::memory_order_relaxed);
+				long fib_result = 0;
+				double second;
+				if (0 == mode)
+					second = RunRoot<Pool, Group>(pool, [&fib_result](Pool &p) { fib_result = Fib<Pool, Group>(p, option.fib_n); });
+				else
+					second = RunRoot<Pool, Group>(pool, [](Pool &p) { FanOut<Pool, Group>(p); });
+
+				is_ok = is_ok && (1 == mode || fib_result == FibSerial(option.fib_n));
+				tasks = task_count.load(std::memory_order_relaxed);
+				if (0 == rr || second < best_second)
+					best_second = second;
+			}
+
+			if (1 == threads)
+				base_second = best_second;
+
+			printf("%s,%s,%d,%ld,%.6f,%.3f,%.2f%s\n", modes[mode], pool_name, threads, tasks, best_second,
+				tasks / best_second / 1e6, base_second / best_second, true == is_ok ? "" : ",FAILED");
+			fflush(stdout);
+
+			if (threads >= option.max_thread)
+				break;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	option.max_thread = sysconf(_SC_NPROCESSORS_ONLN);
+	option.fib_n = 32;
+	option.cutoff = 12;
+	option.leaf_count = 200000;
+	option.leaf_work = 1000;
+	option.repeat = 3;
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "t:n:c:m:w:r:h")))
+	{
+		switch (opt)
+		{
+			case 't': option.max_thread = atoi(optarg); break;
+			case 'n': option.fib_n = atoi(optarg); break;
+			case 'c': option.cutoff = atoi(optarg); break;
+			case 'm': option.leaf_count = atol(optarg); break;
+			case 'w': option.leaf_work = atol(optarg); break;
+			case 'r': option.repeat = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-t max_threads] [-n fib_n] [-c cutoff] [-m leaves] [-w leaf_work] [-r repeat]\n", argv[0]);
+				return 'h' == opt ? 0 : 1;
+		}
+	}
+
+	if (option.cutoff < 2)
+		option.cutoff = 2;
+
+	fprintf(stderr, "online cpus: %ld, fib(%d) cutoff %d, fan-out %ld x %ld\n", sysconf(_SC_NPROCESSORS_ONLN), option.fib_n, option.cutoff, option.leaf_count, option.leaf_work);
+	printf("mode,pool,threads,tasks,seconds,mtasks,speedup\n");
+
+	Sweep<CasExecutor, CasTaskGroup>("CasExecutor");
+	Sweep<GlobalPool, GlobalGroup>("GlobalMPMC");
+
+	return 0;
+}
@@ -0,0 +1,304 @@
+#ifndef __CAS_BROADCAST_QUEUE__
+#define __CAS_BROADCAST_QUEUE__
+
+#include "cas_queue.hxx"
+
+/*
+ * 	【单生产者广播队列，每个消费者都读到每一条数据】
+ *
+ * 生产者把每条数据只写一次，每个消费者有自己的读游标，各自按顺序读完全部数据，数据不被移出
+ * 消费者之间可以有依赖：AddConsumer时指定的前置消费者读过的数据，本消费者才能读(例如风控之后才是策略)
+ * 生产者只在最慢的游标越过某个entry之后才覆盖它；多个消费者共享同一份数据，省去逐个队列拷贝和入队的原子操作
+ * 消费者一次取走当前所有可读的数据并只推进一次游标
+ * T需要支持默认构造和赋值，entry在构造队列时默认构造，生产时赋值或由ClaimProduct就地填写
+ * 先注册全部消费者再开始生产，每个消费者编号只能由一个线程使用
+ *
+ */
+template <class T>
+class CasBroadcastQueueOPMC
+{
+	public:
+		// consumer_max为最多可注册的消费者个数
+		CasBroadcastQueueOPMC(int queue_size = 16384, int consumer_max = 8)
+		{
+			size = pow(2, (ceil(log2(queue_size))));
+			p_data = new T [size];
+
+			cursor_max = consumer_max;
+			cursor_num = 0;
+			p_cursor = new CURSOR [cursor_max];
+
+			product_index = 0;
+			gate_index = 0;
+			published.store(0, std::memory_order_relaxed);
+			closed.store(0, std::memory_order_relaxed);
+			product_signal.store(0, std::memory_order_relaxed);
+			consume_signal.store(0, std::memory_order_relaxed);
+		}
+
+		virtual ~CasBroadcastQueueOPMC()
+		{
+			delete [] p_cursor;
+			delete [] p_data;
+		}
+
+		/*
+		 * 注册一个消费者，返回消费者编号，超过consumer_max时返回-1
+		 * depends为前置消费者的编号，本消费者只能读到所有前置消费者都已读过的数据
+		 */
+		int AddConsumer(const int *depends = NULL, int depend_num = 0)
+		{
+			if (cursor_num >= cursor_max || depend_num > CAS_BROADCAST_DEPEND_MAX)
+				return -1;
+
+			CURSOR &cursor = p_cursor[cursor_num];
+			cursor.depend_num = 0;
+			for (int ii = 0; ii < depend_num; ++ii)
+			{
+				if (depends[ii] < 0 || depends[ii] >= cursor_num)
+					return -1;
+
+				cursor.depends[cursor.depend_num++] = depends[ii];
+				p_cursor[depends[ii]].is_leaf = false;  // 被依赖的游标不慢于依赖它的游标，生产者不必检查
+			}
+
+			// 从生产者和前置消费者当前的位置开始读
+			cursor.is_leaf = true;
+			cursor.cached_limit = __Limit(cursor);
+			cursor.index.store(cursor.cached_limit, std::memory_order_relaxed);
+
+			return cursor_num++;
+		}
+
+		// 队列关闭后返回false
+		bool Product(const T &t_product)
+		{
+			CasSlot<T> slot = ClaimProduct();
+			if (false == slot.IsValid())
+				return false;
+
+			*slot = t_product;
+			CommitProduct(slot);
+			return true;
+		}
+
+		bool Product(T &&t_product)
+		{
+			CasSlot<T> slot = ClaimProduct();
+			if (false == slot.IsValid())
+				return false;
+
+			*slot = std::move(t_product);
+			CommitProduct(slot);
+			return true;
+		}
+
+		// 最慢的消费者还没有读过下一个entry或队列已关闭时返回false
+		bool TryProduct(const T &t_product)
+		{
+			if (0 != closed.load(std::memory_order_relaxed) || false == __HasRoom())
+				return false;
+
+			p_data[product_index & (size - 1)] = t_product;
+			__Publish();
+			return true;
+		}
+
+		/*
+		 * 等待最慢的消费者读过下一个entry后返回该entry，由生产者直接填写，CommitProduct后对消费者可见
+		 * entry中还是上一圈的旧数据；队列关闭后返回无效的slot
+		 */
+		CasSlot<T> ClaimProduct()
+		{
+			CasSlot<T> slot = {NULL, 0};
+			while (false == __HasRoom())
+			{
+				if (0 != closed.load(std::memory_order_relaxed))
+					return slot;
+
+				__CasSignalWait(product_signal, [this]() { return true == __HasRoom() || 0 != closed.load(std::memory_order_relaxed); });
+			}
+
+			if (0 != closed.load(std::memory_order_relaxed))
+				return slot;
+
+			slot.p_data = &p_data[product_index & (size - 1)];
+			slot.index = product_index;
+			return slot;
+		}
+
+		void CommitProduct(CasSlot<T> &slot)
+		{
+			__Publish();
+			slot.p_data = NULL;
+		}
+
+		/*
+		 * 等待至少有一条可读的数据，对当前所有可读的数据(最多max个)依次调用callback(const T &)，读完后只推进一次游标
+		 * 返回读到的个数，队列关闭且本消费者已读完全部数据时返回0
+		 */
+		template <class F>
+		unsigned long ConsumeBatch(int id, F &&callback, unsigned long max = ULONG_MAX)
+		{
+			CURSOR &cursor = p_cursor[id];
+			unsigned long index = cursor.index.load(std::memory_order_relaxed);
+			unsigned long available;
+			while (0 == (available = __Available(cursor, index)))
+			{
+				if (true == __IsDrained(index))
+					return 0;
+
+				__CasSignalWait(consume_signal, [&]() { return 0 != __Available(cursor, index) || true == __IsDrained(index); });
+			}
+
+			if (available > max)
+				available = max;
+
+			for (unsigned long ii = 0; ii < available; ++ii)
+			{
+				callback(static_cast<const T &>(p_data[(index + ii) & (size - 1)]));
+			}
+
+			__Advance(cursor, index + available);
+			return available;
+		}
+
+		// 不等待，没有可读的数据时返回0
+		template <class F>
+		unsigned long TryConsumeBatch(int id, F &&callback, unsigned long max = ULONG_MAX)
+		{
+			CURSOR &cursor = p_cursor[id];
+			unsigned long index = cursor.index.load(std::memory_order_relaxed);
+			unsigned long available = __Available(cursor, index);
+			if (0 == available)
+				return 0;
+
+			if (available > max)
+				available = max;
+
+			for (unsigned long ii = 0; ii < available; ++ii)
+			{
+				callback(static_cast<const T &>(p_data[(index + ii) & (size - 1)]));
+			}
+
+			__Advance(cursor, index + available);
+			return available;
+		}
+
+		// 拷贝出一条数据，队列关闭且本消费者已读完全部数据时返回false
+		bool Consume(int id, T &t_consume)
+		{
+			return 0 != ConsumeBatch(id, [&t_consume](const T &t_data) { t_consume = t_data; }, 1);
+		}
+
+		// 唤醒所有等待的生产者和消费者，之后生产返回false，消费者读完已发布的数据后返回0/false
+		void Close()
+		{
+			closed.store(1, std::memory_order_seq_cst);
+			__CasSignalAwake(product_signal);
+			__CasSignalAwakeFenced(consume_signal);
+		}
+
+		bool IsClosed()
+		{
+			return 0 != closed.load(std::memory_order_acquire);
+		}
+
+		// 某消费者尚未读的近似数据个数
+		unsigned long ApproxSize(int id)
+		{
+			return published.load(std::memory_order_relaxed) - p_cursor[id].index.load(std::memory_order_relaxed);
+		}
+
+	private:
+		enum {CAS_BROADCAST_DEPEND_MAX = 4};
+
+		typedef struct alignas(64)
+		{
+			std::atomic<unsigned long> index;  // 本消费者下一个要读的序号，之前的entry都已读过
+			unsigned long cached_limit;  // 上次计算出的可读上限，只由本消费者读写，不必每次都读生产者和前置消费者的游标
+			int depends[CAS_BROADCAST_DEPEND_MAX];
+			int depend_num;
+			bool is_leaf;  // 没有其它消费者依赖本消费者，生产者只需检查这些游标
+		} CURSOR;
+
+		T *p_data;
+		unsigned int size;
+		CURSOR *p_cursor;
+		int cursor_max;
+		int cursor_num;
+
+		unsigned long product_index __attribute__((aligned(64)));  // 只由生产者读写
+		unsigned long gate_index;  // 上次计算出的最慢游标，只由生产者读写
+		std::atomic<unsigned long> published __attribute__((aligned(64)));  // 已发布的数据个数
+		std::atomic<int> closed __attribute__((aligned(64)));
+		std::atomic<int> product_signal __attribute__((aligned(64)));  // 生产者等待最慢游标的futex等待字，最低位表示有线程等待
+		std::atomic<int> consume_signal __attribute__((aligned(64)));  // 消费者等待新数据或前置消费者的futex等待字，最低位表示有线程等待
+
+		// 缓存的最慢游标还有空间时不读消费者的游标
+		inline bool __HasRoom()
+		{
+			if (product_index - gate_index < size)
+				return true;
+
+			unsigned long gate = product_index;
+			for (int ii = 0; ii < cursor_num; ++ii)
+			{
+				if (true == p_cursor[ii].is_leaf)
+				{
+					unsigned long index = p_cursor[ii].index.load(std::memory_order_acquire);
+					if (index < gate)
+						gate = index;
+				}
+			}
+
+			gate_index = gate;
+			return product_index - gate_index < size;
+		}
+
+		inline void __Publish()
+		{
+			published.store(++product_index, std::memory_order_release);
+			__CasSignalAwake(consume_signal);
+		}
+
+		// 可读上限为已发布的个数与各前置消费者游标中的最小值，缓存的上限之内不读其它游标
+		inline unsigned long __Available(CURSOR &cursor, unsigned long index)
+		{
+			if (cursor.cached_limit > index)
+				return cursor.cached_limit - index;
+
+			cursor.cached_limit = __Limit(cursor);
+			return cursor.cached_limit - index;
+		}
+
+		inline unsigned long __Limit(CURSOR &cursor)
+		{
+			unsigned long limit = published.load(std::memory_order_acquire);
+			for (int ii = 0; ii < cursor.depend_num; ++ii)
+			{
+				unsigned long depend_index = p_cursor[cursor.depends[ii]].index.load(std::memory_order_acquire);
+				if (depend_index < limit)
+					limit = depend_index;
+			}
+
+			return limit;
+		}
+
+		// 关闭后，已发布的数据都读完时不再等待
+		inline bool __IsDrained(unsigned long index)
+		{
+			return 0 != closed.load(std::memory_order_seq_cst) && index == published.load(std::memory_order_acquire);
+		}
+
+		// 读完后release推进游标，生产者和后续消费者acquire读到游标后才覆盖/读取这些entry
+		inline void __Advance(CURSOR &cursor, unsigned long index)
+		{
+			cursor.index.store(index, std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			__CasSignalAwakeFenced(product_signal);
+			__CasSignalAwakeFenced(consume_signal);
+		}
+};
+
+#endif
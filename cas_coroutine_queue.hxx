@@ -0,0 +1,404 @@
+#ifndef __CAS_COROUTINE_QUEUE__
+#define __CAS_COROUTINE_QUEUE__
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include "cas_queue.hxx"
+
+/*
+ * 	【C++20协程版本的队列，需要-std=c++20】
+ *
+ * co_await queue.AsyncConsume(t) / co_await queue.AsyncProduct(t) 在队列空/满时挂起协程而不是线程，
+ * 对端完成一次生产/消费后直接替等待的协程完成操作，再把协程交回它所在的执行器恢复，
+ * 成千上万个逻辑消费者可以共用少量线程，每次交接不需要内核上下文切换
+ *
+ * 底层为非阻塞队列，唤醒方会替等待者生产或消费，因此Queue必须是多生产者多消费者的
+ * 没有等待者时生产/消费只比底层队列多一次fence和一次读；有等待者时等待链表由互斥锁保护
+ *
+ */
+
+class CasCoExecutor;
+
+/*
+ * 	【一次性协程任务】
+ *
+ * 创建后先挂起，由CasCoExecutor::Spawn投递到执行器上运行，运行结束后自动销毁，不返回结果
+ */
+struct CasCoTask
+{
+	struct promise_type
+	{
+		CasCoTask get_return_object()
+		{
+			return CasCoTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+
+		std::suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void()
+		{
+		}
+
+		void unhandled_exception()
+		{
+			std::terminate();
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+/*
+ * 	【单线程执行器】
+ *
+ * 由一个线程调用Run()依次恢复投递来的协程，其它线程通过CasQueueMPOC投递，空闲时阻塞在该队列上，
+ * 本线程内的投递（协程在本执行器上唤醒另一个协程）放入本地队列，不经过原子操作
+ * Stop()关闭投递队列，Run()执行完已投递的协程后返回，关闭后其它线程的投递被丢弃
+ */
+class CasCoExecutor
+{
+	public:
+		CasCoExecutor(int queue_size = 16384) : remote_queue(queue_size)
+		{
+		}
+
+		virtual ~CasCoExecutor()
+		{
+		}
+
+		void Spawn(CasCoTask task)
+		{
+			Post(task.handle);
+		}
+
+		void Post(std::coroutine_handle<> handle)
+		{
+			if (this == p_current)
+				local_queue.push_back(handle);
+			else
+				remote_queue.Product(handle.address());
+		}
+
+		void Run()
+		{
+			CasCoExecutor *p_last = p_current;
+			p_current = this;
+
+			void *p_handle;
+			for (;;)
+			{
+				while (false == local_queue.empty())
+				{
+					std::coroutine_handle<> handle = local_queue.front();
+					local_queue.pop_front();
+					handle.resume();
+				}
+
+				if (false == remote_queue.TryConsume(p_handle) && false == remote_queue.Consume(p_handle))
+					break;  // 已关闭且已取完
+
+				std::coroutine_handle<>::from_address(p_handle).resume();
+			}
+
+			p_current = p_last;
+		}
+
+		void Stop()
+		{
+			remote_queue.Close();
+		}
+
+		// 当前线程正在运行的执行器，不在执行器中时为NULL
+		static CasCoExecutor *Current()
+		{
+			return p_current;
+		}
+
+	private:
+		CasQueueMPOC<void *> remote_queue;
+		std::deque<std::coroutine_handle<> > local_queue;
+
+		static inline thread_local CasCoExecutor *p_current = NULL;
+};
+
+template <class T, class Queue = CasQueueNoBlockMPMC<T> >
+class CasCoQueue
+{
+	private:
+		// 挂起的协程，位于协程帧中的awaiter里，恢复前已从链表摘下
+		typedef struct WAITER
+		{
+			WAITER *next;
+			T *p_data;  // 消费者为输出位置，生产者为待生产的数据
+			std::coroutine_handle<> handle;
+			CasCoExecutor *p_executor;  // 挂起时所在的执行器，为NULL时由唤醒方直接恢复
+			bool is_ok;
+		} WAITER;
+
+		typedef struct
+		{
+			WAITER *head;
+			WAITER *tail;
+		} WAIT_LIST;
+
+	public:
+		class ConsumeAwaiter
+		{
+			public:
+				ConsumeAwaiter(CasCoQueue *p_queue, T &t_consume) : p_queue(p_queue)
+				{
+					waiter.p_data = &t_consume;
+					waiter.is_ok = false;
+				}
+
+				bool await_ready()
+				{
+					waiter.is_ok = p_queue->TryConsume(*waiter.p_data);
+					return true == waiter.is_ok || true == p_queue->IsClosed();
+				}
+
+				bool await_suspend(std::coroutine_handle<> handle)
+				{
+					return p_queue->__Suspend(p_queue->consume_list, p_queue->consume_waiting, waiter, handle);
+				}
+
+				// 队列已关闭且已取完时返回false
+				bool await_resume()
+				{
+					return waiter.is_ok;
+				}
+
+			private:
+				CasCoQueue *p_queue;
+				WAITER waiter;
+		};
+
+		class ProductAwaiter
+		{
+			public:
+				template <class U>
+				ProductAwaiter(CasCoQueue *p_queue, U &&t_product) : p_queue(p_queue), t_product(std::forward<U>(t_product))
+				{
+					waiter.p_data = &this->t_product;
+					waiter.is_ok = false;
+				}
+
+				bool await_ready()
+				{
+					waiter.is_ok = p_queue->TryProduct(std::move(t_product));
+					return true == waiter.is_ok || true == p_queue->IsClosed();
+				}
+
+				bool await_suspend(std::coroutine_handle<> handle)
+				{
+					waiter.p_data = &t_product;
+					return p_queue->__Suspend(p_queue->product_list, p_queue->product_waiting, waiter, handle);
+				}
+
+				// 队列已关闭时返回false
+				bool await_resume()
+				{
+					return waiter.is_ok;
+				}
+
+			private:
+				CasCoQueue *p_queue;
+				T t_product;
+				WAITER waiter;
+		};
+
+		CasCoQueue(int queue_size = 16384) : queue(queue_size)
+		{
+			consume_list.head = consume_list.tail = NULL;
+			product_list.head = product_list.tail = NULL;
+			consume_waiting.store(0, std::memory_order_relaxed);
+			product_waiting.store(0, std::memory_order_relaxed);
+			is_closed.store(false, std::memory_order_relaxed);
+			pthread_mutex_init(&mutex, NULL);
+		}
+
+		virtual ~CasCoQueue()
+		{
+			pthread_mutex_destroy(&mutex);
+		}
+
+		// 队列空时挂起，co_await的结果为false表示队列已关闭且已取完
+		ConsumeAwaiter AsyncConsume(T &t_consume)
+		{
+			return ConsumeAwaiter(this, t_consume);
+		}
+
+		// 队列满时挂起，co_await的结果为false表示队列已关闭
+		template <class U>
+		ProductAwaiter AsyncProduct(U &&t_product)
+		{
+			return ProductAwaiter(this, std::forward<U>(t_product));
+		}
+
+		// 供普通线程使用的非阻塞接口，同样会唤醒等待的协程；队列满或已关闭时返回false
+		template <class U>
+		bool TryProduct(U &&t_product)
+		{
+			if (true == IsClosed() || false == queue.Product(std::forward<U>(t_product)))
+				return false;
+
+			__Transfer(true);
+			return true;
+		}
+
+		// 队列空时返回false
+		bool TryConsume(T &t_consume)
+		{
+			if (false == queue.Consume(t_consume))
+				return false;
+
+			__Transfer(false);
+			return true;
+		}
+
+		// 关闭后不能再生产，挂起的生产者和消费者都以false恢复，队列中剩余的数据仍可以取出
+		void Close()
+		{
+			pthread_mutex_lock(&mutex);
+			is_closed.store(true, std::memory_order_release);
+			WAITER *p_consume = consume_list.head;
+			WAITER *p_product = product_list.head;
+			consume_list.head = consume_list.tail = NULL;
+			product_list.head = product_list.tail = NULL;
+			consume_waiting.store(0, std::memory_order_relaxed);
+			product_waiting.store(0, std::memory_order_relaxed);
+			pthread_mutex_unlock(&mutex);
+
+			__Resume(p_consume);
+			__Resume(p_product);
+		}
+
+		bool IsClosed()
+		{
+			return is_closed.load(std::memory_order_acquire);
+		}
+
+		unsigned long ApproxSize()
+		{
+			return queue.ApproxSize();
+		}
+
+	private:
+		/*
+		 * 登记等待：持锁增加等待计数后再试一次，与对端完成操作后fence再读等待计数构成全序，
+		 * 要么这里的重试看到对端的数据，要么对端看到计数并在锁内替本协程完成操作，不会丢失唤醒
+		 * 返回false表示不挂起，结果已在waiter.is_ok中
+		 */
+		bool __Suspend(WAIT_LIST &list, std::atomic<unsigned long> &waiting, WAITER &waiter, std::coroutine_handle<> handle)
+		{
+			waiter.next = NULL;
+			waiter.handle = handle;
+			waiter.p_executor = CasCoExecutor::Current();
+
+			bool is_consume = &list == &consume_list;
+			pthread_mutex_lock(&mutex);
+			waiting.fetch_add(1, std::memory_order_seq_cst);
+			bool is_close = is_closed.load(std::memory_order_relaxed);  // 只在锁内修改
+			if (false == is_close)
+				waiter.is_ok = true == is_consume ? queue.Consume(*waiter.p_data) : queue.Product(std::move(*waiter.p_data));
+
+			if (true == is_close || true == waiter.is_ok)
+			{
+				waiting.fetch_sub(1, std::memory_order_relaxed);
+				pthread_mutex_unlock(&mutex);
+				if (true == waiter.is_ok)
+					__Transfer(false == is_consume);
+
+				return false;
+			}
+
+			if (NULL == list.tail)
+				list.head = &waiter;
+			else
+				list.tail->next = &waiter;
+			list.tail = &waiter;
+			pthread_mutex_unlock(&mutex);
+
+			return true;
+		}
+
+		/*
+		 * 替等待者完成操作：持锁按登记顺序替等待的消费者取数据（或替等待的生产者写数据），直到队列空（满）或没有等待者
+		 * 返回完成的个数，替消费者取走数据后腾出了空位，需要再替生产者写，反之亦然
+		 */
+		unsigned long __AwakeWaiters(WAIT_LIST &list, std::atomic<unsigned long> &waiting, bool is_consume)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (0 == waiting.load(std::memory_order_relaxed))
+				return 0;
+
+			WAITER *p_ready = NULL;
+			WAITER *p_tail = NULL;
+			unsigned long count = 0;
+
+			pthread_mutex_lock(&mutex);
+			while (NULL != list.head && true == (true == is_consume ? queue.Consume(*list.head->p_data) : queue.Product(std::move(*list.head->p_data))))
+			{
+				WAITER *p_waiter = list.head;
+				list.head = p_waiter->next;
+				if (NULL == list.head)
+					list.tail = NULL;
+
+				p_waiter->is_ok = true;
+				p_waiter->next = NULL;
+				if (NULL == p_tail)
+					p_ready = p_waiter;
+				else
+					p_tail->next = p_waiter;
+				p_tail = p_waiter;
+				++count;
+			}
+			waiting.fetch_sub(count, std::memory_order_relaxed);
+			pthread_mutex_unlock(&mutex);
+
+			__Resume(p_ready);
+			return count;
+		}
+
+		// 完成一次生产（is_product为true）或消费后，交替唤醒等待的消费者和生产者，直到没有可以完成的等待者
+		void __Transfer(bool is_product)
+		{
+			while (0 != (true == is_product ? __AwakeWaiters(consume_list, consume_waiting, true) : __AwakeWaiters(product_list, product_waiting, false)))
+				is_product = false == is_product;
+		}
+
+		// 把协程交回挂起时所在的执行器，恢复后waiter所在的协程帧可能被销毁，先取next
+		void __Resume(WAITER *p_waiter)
+		{
+			while (NULL != p_waiter)
+			{
+				WAITER *p_next = p_waiter->next;
+				if (NULL != p_waiter->p_executor)
+					p_waiter->p_executor->Post(p_waiter->handle);
+				else
+					p_waiter->handle.resume();
+				p_waiter = p_next;
+			}
+		}
+
+		Queue queue;
+
+		pthread_mutex_t mutex __attribute__((aligned(64)));
+		WAIT_LIST consume_list;
+		WAIT_LIST product_list;
+		std::atomic<bool> is_closed;  // 在锁内修改，登记等待时在锁内检查
+
+		std::atomic<unsigned long> consume_waiting __attribute__((aligned(64)));  // 登记等待的消费者个数，生产者据此判断是否需要加锁
+		std::atomic<unsigned long> product_waiting __attribute__((aligned(64)));
+};
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef __CAS_EVENT_QUEUE__
+#define __CAS_EVENT_QUEUE__
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include "cas_queue.hxx"
+
+/*
+ * 	【可由epoll等事件循环监听的队列】
+ *
+ * 在非阻塞队列上加一个通知器，消费者所在的事件循环把通知器的fd加入epoll，与socket一起等待
+ * 只有消费者取空队列后登记了等待，生产者才通过通知器发信号，一批连续的生产只产生一次系统调用
+ * 事件循环在fd可读时调用Drain(callback, max)一次取完当前所有数据，取空后自动重新登记等待
+ * 只允许一个线程调用Drain，生产者个数由Queue决定
+ *
+ */
+
+/*
+ * 	【通知器，作为CasEventQueue的第三个模板参数】
+ *
+ * Fd()		: 供epoll监听的fd
+ * Notify()	: 生产者发信号，使Fd()可读
+ * Clear()	: 消费者清除信号，使Fd()不再可读
+ *
+ * 默认使用eventfd，也可以换成pipe或者直接回调事件循环的唤醒接口
+ */
+struct CasEventfdNotifier
+{
+	int event_fd;
+
+	CasEventfdNotifier()
+	{
+		event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	}
+
+	~CasEventfdNotifier()
+	{
+		if (event_fd >= 0)
+			close(event_fd);
+	}
+
+	int Fd()
+	{
+		return event_fd;
+	}
+
+	void Notify()
+	{
+		uint64_t value = 1;
+		while (-1 == write(event_fd, &value, sizeof(value)) && EINTR == errno);
+	}
+
+	void Clear()
+	{
+		uint64_t value;
+		while (-1 == read(event_fd, &value, sizeof(value)) && EINTR == errno);
+	}
+};
+
+template <class T, class Queue = CasQueueNoBlockMPMC<T>, class Notifier = CasEventfdNotifier>
+class CasEventQueue
+{
+	public:
+		CasEventQueue(int queue_size = 16384) : queue(queue_size)
+		{
+			state.store(ARMED, std::memory_order_relaxed);  // 初始为空，消费者视为已登记等待
+		}
+
+		virtual ~CasEventQueue()
+		{
+		}
+
+		// 队列满时返回false
+		bool Product(const T &t_product)
+		{
+			if (false == queue.Product(t_product))
+				return false;
+
+			__Notify();
+			return true;
+		}
+
+		bool Product(T &&t_product)
+		{
+			if (false == queue.Product(std::move(t_product)))
+				return false;
+
+			__Notify();
+			return true;
+		}
+
+		template <class... Args>
+		bool TryEmplace(Args &&... args)
+		{
+			if (false == queue.TryEmplace(std::forward<Args>(args)...))
+				return false;
+
+			__Notify();
+			return true;
+		}
+
+		// 批量生产只通知一次，返回实际生产的个数
+		unsigned long ProductBulk(const T *t_products, unsigned long n)
+		{
+			unsigned long count = queue.ProductBulk(t_products, n);
+			if (0 != count)
+				__Notify();
+
+			return count;
+		}
+
+		/*
+		 * 由事件循环在Fd()可读时调用，依次对队列中的数据调用callback(T &)，最多处理max个，返回处理的个数
+		 * 队列取空后重新登记等待，之后的第一次生产会使Fd()可读；达到max时队列可能还有数据，
+		 * 主动使Fd()保持可读，事件循环处理完其它fd后会再次调用Drain，不会饿死socket
+		 */
+		template <class F>
+		unsigned long Drain(F &&callback, unsigned long max = ULONG_MAX)
+		{
+			// 撤销登记并清除信号，生产者在清除之后才写入的信号只会多唤醒一次，下次Drain时清除
+			state.exchange(AWAKE, std::memory_order_acquire);
+			notifier.Clear();
+
+			T t_consume;
+			unsigned long count = 0;
+			for (;;)
+			{
+				while (count < max && true == queue.Consume(t_consume))
+				{
+					callback(t_consume);
+					++count;
+				}
+
+				if (count >= max)
+				{
+					state.store(SIGNALED, std::memory_order_relaxed);
+					notifier.Notify();
+					return count;
+				}
+
+				// 登记等待后再取一次，避免在取空与登记之间生产的数据没有通知；已经收到信号时不必登记
+				if (false == __CasCompareSwap(state, AWAKE, ARMED, std::memory_order_seq_cst))
+					return count;
+
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (false == queue.Consume(t_consume))
+					return count;
+
+				callback(t_consume);
+				++count;
+
+				// 撤销登记继续取，撤销前生产者已经发过信号时保持SIGNALED，fd可读，下次Drain清除
+				if (false == __CasCompareSwap(state, ARMED, AWAKE, std::memory_order_relaxed))
+				{
+					while (count < max && true == queue.Consume(t_consume))
+					{
+						callback(t_consume);
+						++count;
+					}
+
+					return count;
+				}
+			}
+		}
+
+		// 不经过事件循环直接取一个数据，队列空时返回false
+		bool Consume(T &t_consume)
+		{
+			return queue.Consume(t_consume);
+		}
+
+		// 供epoll监听的fd
+		int Fd()
+		{
+			return notifier.Fd();
+		}
+
+		Notifier &GetNotifier()
+		{
+			return notifier;
+		}
+
+		unsigned long ApproxSize()
+		{
+			return queue.ApproxSize();
+		}
+
+	private:
+		/*
+		 * 	【消费者的等待状态】
+		 *
+		 * AWAKE	0: 消费者正在取数据，生产者不需要通知
+		 * ARMED	1: 消费者已取空队列并登记等待，下一个生产者需要通知
+		 * SIGNALED	2: 已有生产者抢到通知权并发过信号，其余生产者不再通知，由消费者在Drain中清除
+		 *
+		 */
+		enum consume_state {AWAKE = 0, ARMED, SIGNALED};
+
+		Queue queue;
+		Notifier notifier;
+		std::atomic<consume_state> state __attribute__((aligned(64)));
+
+		/*
+		 * 发布数据后全屏障再读state，与消费者登记ARMED后全屏障再取数据构成Dekker式全序，
+		 * 至少一方能看到对方：要么消费者取到数据，要么生产者看到ARMED并发信号
+		 */
+		inline void __Notify()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (ARMED == state.load(std::memory_order_relaxed) && true == __CasCompareSwap(state, ARMED, SIGNALED, std::memory_order_relaxed))
+				notifier.Notify();
+		}
+};
+
+#endif
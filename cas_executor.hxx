@@ -0,0 +1,633 @@
+#ifndef __CAS_EXECUTOR__
+#define __CAS_EXECUTOR__
+
+#include <pthread.h>
+#include <sched.h>
+#include "cas_queue.hxx"
+
+/*
+ * 	【工作窃取任务执行器】
+ *
+ * 每个工作线程一个Chase-Lev双端队列：本线程提交的任务压入底部，本线程从底部后进先出地取，其它线程从顶部窃取
+ * 外部线程提交的任务进入CasQueueMPMC注入队列，各工作线程取完本地任务后取注入队列，再从随机选择的受害者开始窃取
+ * 任务以CasTask的形式就地存放在双端队列的entry和注入队列的entry中，不经过std::function的堆分配
+ * 空闲的工作线程先搜索若干轮再睡眠在futex等待字上；已有线程在搜索时提交方不唤醒，搜索者找到任务时再唤醒下一个
+ *
+ */
+
+#define CAS_TASK_INLINE 48	// 就地存放的可调用对象的最大字节数，超过时在堆上分配
+
+/*
+ * 	【就地存放的一次性任务】
+ *
+ * 可调用对象不超过CAS_TASK_INLINE字节、对齐不超过指针且移动构造不抛出异常时直接存放在对象内，否则在堆上分配后存放指针
+ * 只能移动不能拷贝，Run()执行后析构可调用对象，任务变为空
+ */
+class CasTask
+{
+	public:
+		CasTask() : manage(NULL)
+		{
+		}
+
+		template <class F, class = typename std::enable_if<false == std::is_same<typename std::decay<F>::type, CasTask>::value>::type>
+		CasTask(F &&f) : manage(NULL)
+		{
+			__Assign(std::forward<F>(f));
+		}
+
+		CasTask(CasTask &&other) : manage(other.manage)
+		{
+			if (NULL != manage)
+				manage(MOVE, other.storage, storage);
+			other.manage = NULL;
+		}
+
+		CasTask &operator=(CasTask &&other)
+		{
+			if (this != &other)
+			{
+				Reset();
+				manage = other.manage;
+				if (NULL != manage)
+					manage(MOVE, other.storage, storage);
+				other.manage = NULL;
+			}
+
+			return *this;
+		}
+
+		CasTask(const CasTask &) = delete;
+		CasTask &operator=(const CasTask &) = delete;
+
+		~CasTask()
+		{
+			Reset();
+		}
+
+		template <class F>
+		void Assign(F &&f)
+		{
+			Reset();
+			__Assign(std::forward<F>(f));
+		}
+
+		// 执行并析构可调用对象
+		void Run()
+		{
+			void (*current_manage)(int, void *, void *) = manage;
+			manage = NULL;
+			current_manage(RUN, storage, NULL);
+		}
+
+		void Reset()
+		{
+			if (NULL != manage)
+				manage(DESTROY, storage, NULL);
+			manage = NULL;
+		}
+
+		bool IsValid() const
+		{
+			return NULL != manage;
+		}
+
+	private:
+		enum task_op {RUN = 0, MOVE, DESTROY};
+
+		void (*manage)(int op, void *p_src, void *p_dst);
+		alignas(void *) unsigned char storage[CAS_TASK_INLINE];
+
+		template <class F>
+		inline void __Assign(F &&f)
+		{
+			typedef typename std::decay<F>::type C;
+			if constexpr (sizeof(C) <= CAS_TASK_INLINE && alignof(C) <= alignof(void *) && std::is_nothrow_move_constructible<C>::value)
+			{
+				new (storage) C(std::forward<F>(f));
+				manage = &__ManageInline<C>;
+			}
+			else
+			{
+				*reinterpret_cast<C **>(storage) = new C(std::forward<F>(f));
+				manage = &__ManageHeap<C>;
+			}
+		}
+
+		template <class C>
+		static void __ManageInline(int op, void *p_src, void *p_dst)
+		{
+			C *p_callable = static_cast<C *>(p_src);
+			switch (op)
+			{
+				case RUN:
+					(*p_callable)();
+					p_callable->~C();
+					break;
+				case MOVE:
+					new (p_dst) C(std::move(*p_callable));
+					p_callable->~C();
+					break;
+				default:
+					p_callable->~C();
+					break;
+			}
+		}
+
+		template <class C>
+		static void __ManageHeap(int op, void *p_src, void *p_dst)
+		{
+			C *p_callable = *static_cast<C **>(p_src);
+			switch (op)
+			{
+				case RUN:
+					(*p_callable)();
+					delete p_callable;
+					break;
+				case MOVE:
+					*static_cast<C **>(p_dst) = p_callable;
+					break;
+				default:
+					delete p_callable;
+					break;
+			}
+		}
+};
+
+/*
+ * 	【Chase-Lev工作窃取双端队列】
+ *
+ * 只有所属的工作线程调用Push/Take，任意线程调用Steal；容量固定，满时Push返回false且不移走任务
+ * 每个entry带序号seq：为当前票号时entry空闲，可以压入；被窃取的entry在窃取者移出任务后置为下一圈的票号，
+ * 本线程后进先出取走的entry恢复为原票号，底部会再次使用该票号；窃取者还没有移出任务时entry不可压入
+ */
+class CasTaskDeque
+{
+	public:
+		CasTaskDeque(int deque_size = 1024)
+		{
+			size = pow(2, (ceil(log2(deque_size))));
+			p_cells = new CELL [size];
+			for (unsigned long ii = 0; ii < size; ++ii)
+				p_cells[ii].seq.store(ii, std::memory_order_relaxed);
+
+			top.store(0, std::memory_order_relaxed);
+			bottom.store(0, std::memory_order_relaxed);
+		}
+
+		virtual ~CasTaskDeque()
+		{
+			delete [] p_cells;
+		}
+
+		// 在底部就地构造任务，队列满时返回false且不构造
+		template <class F>
+		bool Push(F &&f)
+		{
+			long b = bottom.load(std::memory_order_relaxed);
+			long t = top.load(std::memory_order_acquire);
+			if (b - t >= (long)size)
+				return false;
+
+			CELL &cell = p_cells[b & (size - 1)];
+			if (b != cell.seq.load(std::memory_order_acquire))
+				return false;  // 上一圈的窃取者还在移出任务
+
+			cell.task.Assign(std::forward<F>(f));
+			cell.seq.store(b + 1, std::memory_order_relaxed);
+			__CAS_FUZZ_POINT();
+			bottom.store(b + 1, std::memory_order_release);
+			return true;
+		}
+
+		/*
+		 * 从底部后进先出地取，队列空时返回false
+		 * 先减bottom再读top，与窃取者先读top再读bottom构成全序；只剩一个任务时与窃取者用cas竞争top
+		 */
+		bool Take(CasTask &task)
+		{
+			long b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_seq_cst);
+			long t = top.load(std::memory_order_seq_cst);
+			if (t > b)
+			{
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return false;
+			}
+
+			CELL &cell = p_cells[b & (size - 1)];
+			if (t == b)
+			{
+				__CAS_FUZZ_POINT();
+				bool is_take = __CasCompareSwap(top, t, t + 1, std::memory_order_seq_cst);
+				bottom.store(b + 1, std::memory_order_relaxed);
+				if (false == is_take)
+					return false;  // 被窃取者抢先
+
+				task = std::move(cell.task);
+				cell.seq.store(b + size, std::memory_order_release);
+				return true;
+			}
+
+			task = std::move(cell.task);
+			cell.seq.store(b, std::memory_order_relaxed);
+			return true;
+		}
+
+		// 从顶部先进先出地窃取，队列空或被其它线程抢先时返回false
+		bool Steal(CasTask &task)
+		{
+			long t = top.load(std::memory_order_seq_cst);
+			long b = bottom.load(std::memory_order_seq_cst);
+			if (t >= b)
+				return false;
+
+			__CAS_FUZZ_POINT();
+			if (false == __CasCompareSwap(top, t, t + 1, std::memory_order_seq_cst))
+				return false;
+
+			CELL &cell = p_cells[t & (size - 1)];
+			task = std::move(cell.task);
+			cell.seq.store(t + size, std::memory_order_release);
+			return true;
+		}
+
+		bool IsEmpty()
+		{
+			return bottom.load(std::memory_order_seq_cst) <= top.load(std::memory_order_seq_cst);
+		}
+
+	private:
+		typedef struct alignas(64)
+		{
+			std::atomic<long> seq;
+			CasTask task;
+		} CELL;
+
+		CELL *p_cells;
+		unsigned long size;
+		std::atomic<long> top __attribute__((aligned(64)));  // 窃取端，只增不减
+		std::atomic<long> bottom __attribute__((aligned(64)));  // 所属线程的一端
+};
+
+/*
+ * 	【执行器】
+ *
+ * CasExecutor(工作线程个数, 每个双端队列的长度, 注入队列的长度)，工作线程个数为0时取在线CPU个数
+ * Submit在工作线程中调用时压入本线程的双端队列(满时直接在本线程执行)，在其它线程中调用时进入注入队列，注入队列满时阻塞
+ * Stop()之后外部提交返回false，工作线程执行完所有任务(包括任务中再提交的任务)后退出；析构时Stop并等待工作线程退出
+ * 任务不应抛出异常，不要在工作线程中析构所属的执行器
+ */
+class CasExecutor
+{
+	public:
+		CasExecutor(int worker_num = 0, int deque_size = 1024, int inject_size = 16384) : inject_queue(inject_size)
+		{
+			if (worker_num <= 0)
+				worker_num = sysconf(_SC_NPROCESSORS_ONLN);
+
+			search_max = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? SEARCH_ROUNDS : 1;
+			idle_num.store(0, std::memory_order_relaxed);
+			search_num.store(0, std::memory_order_relaxed);
+			signal.store(0, std::memory_order_relaxed);
+			stopping.store(false, std::memory_order_relaxed);
+
+			workers = worker_num;
+			p_workers = new WORKER *[workers];
+			for (int ii = 0; ii < workers; ++ii)
+			{
+				p_workers[ii] = new WORKER(deque_size);
+				p_workers[ii]->p_executor = this;
+				p_workers[ii]->index = ii;
+				p_workers[ii]->seed = ii * 0x9e3779b97f4a7c15UL + 1;
+				p_workers[ii]->tick = 0;
+			}
+
+			// 双端队列都建好后再启动，工作线程窃取时不会访问到未构造的队列
+			for (int ii = 0; ii < workers; ++ii)
+				pthread_create(&p_workers[ii]->thread, NULL, __WorkerMain, p_workers[ii]);
+		}
+
+		virtual ~CasExecutor()
+		{
+			Stop();
+			for (int ii = 0; ii < workers; ++ii)
+				pthread_join(p_workers[ii]->thread, NULL);
+
+			// 全部退出后再释放，其它工作线程退出前还会检查各个双端队列
+			for (int ii = 0; ii < workers; ++ii)
+				delete p_workers[ii];
+
+			delete [] p_workers;
+		}
+
+		// 在执行器中运行f()，外部线程在执行器Stop之后提交时返回false
+		template <class F>
+		bool Submit(F &&f)
+		{
+			WORKER *p_worker = __Current();
+			if (NULL != p_worker)
+			{
+				// Push只在成功时才移走f；本地队列满时直接在本线程执行，工作线程不会阻塞在注入队列上
+				if (false == p_worker->deque.Push(std::forward<F>(f)))
+				{
+					f();
+					return true;
+				}
+			}
+			else if (false == inject_queue.Emplace(std::forward<F>(f)))
+				return false;
+
+			__Notify();
+			return true;
+		}
+
+		// 当前线程执行一个任务(本地、注入队列或窃取)，没有可执行的任务时返回false；供等待子任务时帮助执行
+		bool RunOne()
+		{
+			return __RunOne(__Current());
+		}
+
+		void Stop()
+		{
+			stopping.store(true, std::memory_order_seq_cst);
+			inject_queue.Close();
+			signal.fetch_add(1, std::memory_order_seq_cst);
+			__CasFutexWake(&signal, INT_MAX);
+		}
+
+		int WorkerNum()
+		{
+			return workers;
+		}
+
+		// 当前线程在本执行器中的工作线程编号，不是本执行器的工作线程时返回-1
+		int CurrentWorker()
+		{
+			WORKER *p_worker = __Current();
+			return NULL != p_worker ? p_worker->index : -1;
+		}
+
+	private:
+		enum
+		{
+			SEARCH_ROUNDS = 32,	// 睡眠前搜索任务的轮数
+			INJECT_INTERVAL = 61	// 本地任务不断时每隔若干个任务先取一次注入队列，外部提交不会饿死
+		};
+
+		typedef struct alignas(64) WORKER
+		{
+			CasTaskDeque deque;
+			CasExecutor *p_executor;
+			pthread_t thread;
+			int index;
+			unsigned long seed;  // 选择窃取对象的随机数状态
+			unsigned long tick;
+
+			WORKER(int deque_size) : deque(deque_size)
+			{
+			}
+		} WORKER;
+
+		WORKER **p_workers;
+		int workers;
+		int search_max;
+		CasQueueMPMC<CasTask> inject_queue;
+		std::atomic<int> idle_num __attribute__((aligned(64)));  // 已登记睡眠的工作线程个数
+		std::atomic<int> search_num __attribute__((aligned(64)));  // 正在搜索任务的工作线程个数
+		std::atomic<int> signal __attribute__((aligned(64)));  // 空闲工作线程睡眠的futex等待字，每次唤醒加一
+		std::atomic<bool> stopping;
+
+		static inline thread_local WORKER *p_current = NULL;
+
+		inline WORKER *__Current()
+		{
+			WORKER *p_worker = p_current;
+			return NULL != p_worker && this == p_worker->p_executor ? p_worker : NULL;
+		}
+
+		/*
+		 * 发布任务后全屏障再读search_num/idle_num，与工作线程登记睡眠后全屏障再检查任务构成全序
+		 * 已有线程在搜索时不唤醒，由它找到任务后唤醒下一个，连续提交时不会每次都做futex系统调用
+		 */
+		inline void __Notify()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (0 == search_num.load(std::memory_order_relaxed) && 0 != idle_num.load(std::memory_order_relaxed))
+			{
+				signal.fetch_add(1, std::memory_order_relaxed);
+				__CasFutexWake(&signal, 1);
+			}
+		}
+
+		inline bool __RunOne(WORKER *p_worker)
+		{
+			CasTask task;
+			if (false == __Find(p_worker, task))
+				return false;
+
+			task.Run();
+			return true;
+		}
+
+		// 依次取本地双端队列、注入队列，再窃取
+		inline bool __Find(WORKER *p_worker, CasTask &task)
+		{
+			if (NULL != p_worker)
+			{
+				if (0 == ++p_worker->tick % INJECT_INTERVAL && true == __TakeInject(task))
+					return true;
+
+				if (true == p_worker->deque.Take(task))
+					return true;
+			}
+
+			return true == __TakeInject(task) || true == __Steal(p_worker, task);
+		}
+
+		/*
+		 * 注入队列关闭后Consume不再阻塞，并跳过Stop时阻塞在队列上的提交已领取又放弃的票号，
+		 * 取完之后注入队列的ApproxSize归零，工作线程不会因为这些票号一直认为还有任务
+		 */
+		inline bool __TakeInject(CasTask &task)
+		{
+			return true == inject_queue.IsClosed() ? inject_queue.Consume(task) : inject_queue.TryConsume(task);
+		}
+
+		// 从随机的受害者开始依次窃取一次
+		inline bool __Steal(WORKER *p_worker, CasTask &task)
+		{
+			static thread_local unsigned long seed = (unsigned long)pthread_self() | 1;
+			unsigned long &current_seed = NULL != p_worker ? p_worker->seed : seed;
+			current_seed ^= current_seed << 13;
+			current_seed ^= current_seed >> 7;
+			current_seed ^= current_seed << 17;
+
+			int start = current_seed % workers;
+			for (int ii = 0; ii < workers; ++ii)
+			{
+				int victim = start + ii < workers ? start + ii : start + ii - workers;
+				if (p_workers[victim] != p_worker && true == p_workers[victim]->deque.Steal(task))
+					return true;
+			}
+
+			return false;
+		}
+
+		// 任一双端队列或注入队列非空，注入队列中已领取票号还未发布的任务也算在内，Stop后被放弃的票号由__TakeInject跳过
+		inline bool __HasWork()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (0 != inject_queue.ApproxSize())
+				return true;
+
+			for (int ii = 0; ii < workers; ++ii)
+			{
+				if (false == p_workers[ii]->deque.IsEmpty())
+					return true;
+			}
+
+			return false;
+		}
+
+		static void *__WorkerMain(void *arg)
+		{
+			WORKER *p_worker = static_cast<WORKER *>(arg);
+			p_current = p_worker;
+			p_worker->p_executor->__Work(p_worker);
+			p_current = NULL;
+
+			return NULL;
+		}
+
+		void __Work(WORKER *p_worker)
+		{
+			for (;;)
+			{
+				while (true == __RunOne(p_worker))
+					;
+
+				// 搜索若干轮，期间提交方不做唤醒；找到任务时如果是最后一个搜索者，先唤醒下一个空闲线程接着搜索再执行
+				search_num.fetch_add(1, std::memory_order_seq_cst);
+				CasTask task;
+				bool is_found = false;
+				for (int ii = 0; ii < search_max && false == is_found; ++ii)
+				{
+					is_found = __Find(p_worker, task);
+					if (false == is_found)
+						sched_yield();
+				}
+
+				if (1 == search_num.fetch_sub(1, std::memory_order_seq_cst) && true == is_found)
+					__Notify();
+
+				if (true == is_found)
+				{
+					task.Run();
+					continue;
+				}
+
+				// 登记睡眠后再检查一次，避免在检查与睡眠之间错过提交
+				int current_signal = signal.load(std::memory_order_acquire);
+				idle_num.fetch_add(1, std::memory_order_seq_cst);
+				if (true == __HasWork())
+				{
+					idle_num.fetch_sub(1, std::memory_order_relaxed);
+					continue;
+				}
+
+				if (true == stopping.load(std::memory_order_seq_cst))
+				{
+					idle_num.fetch_sub(1, std::memory_order_relaxed);
+					break;
+				}
+
+				__CasFutexWait(&signal, current_signal);
+				idle_num.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+};
+
+/*
+ * 	【一组子任务，用于fork/join】
+ *
+ * Spawn提交子任务，Wait等待本组所有子任务完成；在工作线程中Wait时帮助执行任务(优先执行本线程刚压入的子任务)，
+ * 不占用工作线程，递归的fork/join不会死锁；在其它线程中Wait时睡眠在所有组共用的futex等待字上
+ * 子任务的可调用对象不超过CAS_TASK_INLINE减去一个指针时仍就地存放；析构前会等待所有子任务完成
+ */
+class CasTaskGroup
+{
+	public:
+		CasTaskGroup(CasExecutor &executor) : executor(executor)
+		{
+			pending.store(0, std::memory_order_relaxed);
+		}
+
+		virtual ~CasTaskGroup()
+		{
+			Wait();
+		}
+
+		template <class F>
+		bool Spawn(F &&f)
+		{
+			pending.fetch_add(2, std::memory_order_relaxed);
+			bool is_submit = executor.Submit([this, callable = std::forward<F>(f)]() mutable
+			{
+				callable();
+				__Done();
+			});
+
+			if (false == is_submit)
+				__Done();
+
+			return is_submit;
+		}
+
+		void Wait()
+		{
+			if (-1 != executor.CurrentWorker())
+			{
+				while (pending.load(std::memory_order_acquire) >= 2)
+				{
+					if (false == executor.RunOne())
+						sched_yield();
+				}
+
+				return;
+			}
+
+			for (;;)
+			{
+				// 先取唤醒次数再检查计数，最后一个子任务在两次读之间完成时等待字已变化，不会睡眠
+				int current_signal = wait_signal.load(std::memory_order_acquire);
+				int current_pending = pending.load(std::memory_order_acquire);
+				if (current_pending < 2)
+					return;
+
+				// 最低位表示有线程在等待，最后一个子任务完成时才唤醒
+				if (0 == (current_pending & 1) && false == __CasCompareSwap(pending, current_pending, current_pending | 1, std::memory_order_relaxed))
+					continue;
+
+				__CasFutexWait(&wait_signal, current_signal);
+			}
+		}
+
+	private:
+		CasExecutor &executor;
+		std::atomic<int> pending;  // 未完成的子任务个数乘2，最低位为等待标志
+
+		// 外部线程等待时睡眠的futex等待字，所有组共用：计数归零后等待者可能立即返回并析构组，唤醒时不能再访问组的成员
+		static inline std::atomic<int> wait_signal {0};
+
+		inline void __Done()
+		{
+			if (3 == pending.fetch_sub(2, std::memory_order_acq_rel))
+			{
+				wait_signal.fetch_add(1, std::memory_order_release);
+				__CasFutexWake(&wait_signal, INT_MAX);
+			}
+		}
+};
+
+#endif
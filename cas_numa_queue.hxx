@@ -0,0 +1,311 @@
+#ifndef __CAS_NUMA_QUEUE__
+#define __CAS_NUMA_QUEUE__
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include "cas_queue.hxx"
+
+/*
+ * 	【按NUMA节点分片的多生产多消费队列】
+ *
+ * 每个NUMA节点(或每组CPU)一个CasQueueNoBlockMPMC子队列，子队列由绑定到该节点CPU上的线程创建，
+ * 初始化entry时的首次写入使子队列的内存分配在该节点上
+ * 生产者写入本节点的子队列，本节点子队列满时才写入其它节点；消费者先取本节点的子队列，为空时从其它节点窃取
+ * 线程的所属节点由它第一次访问队列时所在的CPU决定，之后不再改变，同一个生产者的数据总是进入同一个子队列
+ * 只保证每个子队列内先进先出，不保证全局先进先出
+ *
+ */
+template <class T>
+class CasNumaQueueMPMC
+{
+	public:
+		// shard_count为0时每个NUMA节点一个子队列，否则按CPU编号将CPU平均分为shard_count组，每组一个子队列
+		CasNumaQueueMPMC(int queue_size = 16384, int shard_count = 0)
+		{
+			product_signal.store(0, std::memory_order_relaxed);
+			consume_signal.store(0, std::memory_order_relaxed);
+
+			cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+			if (cpu_count > CPU_SETSIZE)
+				cpu_count = CPU_SETSIZE;
+			cpu_shard = new unsigned int [cpu_count];
+
+			shards = NULL;
+			if (shard_count <= 0)
+				__ReadNodes();
+
+			if (NULL == shards)  // 指定了分组个数，或者读不到NUMA节点信息
+				__GroupCpus(shard_count > 0 ? shard_count : 1);
+
+			for (unsigned int ii = 0; ii < shard_num; ++ii)
+			{
+				__AllocShard(ii, queue_size);
+			}
+		}
+
+		virtual ~CasNumaQueueMPMC()
+		{
+			for (unsigned int ii = 0; ii < shard_num; ++ii)
+			{
+				delete shards[ii].queue;
+			}
+
+			delete [] shards;
+			delete [] cpu_shard;
+		}
+
+		void Product(const T &t_product)
+		{
+			__Product(t_product);
+		}
+
+		void Product(T &&t_product)
+		{
+			__Product(std::move(t_product));
+		}
+
+		template <class... Args>
+		void Emplace(Args &&... args)
+		{
+			__Product(std::forward<Args>(args)...);
+		}
+
+		// 所有子队列都满时返回false
+		bool TryProduct(const T &t_product)
+		{
+			if (false == __TryProduct(t_product))
+				return false;
+
+			__CasSignalAwake(consume_signal);
+			return true;
+		}
+
+		void Consume(T &t_consume)
+		{
+			while (false == __TryConsume(t_consume))
+			{
+				if (true == __CasSignalWait(consume_signal, [&]() { return __TryConsume(t_consume); }))
+					break;
+			}
+
+			__CasSignalAwake(product_signal);
+		}
+
+		// 所有子队列都空时返回false
+		bool TryConsume(T &t_consume)
+		{
+			if (false == __TryConsume(t_consume))
+				return false;
+
+			__CasSignalAwake(product_signal);
+			return true;
+		}
+
+		// 各子队列近似数据个数之和
+		unsigned long ApproxSize()
+		{
+			unsigned long size = 0;
+			for (unsigned int ii = 0; ii < shard_num; ++ii)
+			{
+				size += shards[ii].queue->ApproxSize();
+			}
+
+			return size;
+		}
+
+		unsigned int ShardCount()
+		{
+			return shard_num;
+		}
+
+		// 当前线程所属的子队列
+		unsigned int LocalShard()
+		{
+			return __LocalShard();
+		}
+
+	private:
+		typedef struct alignas(64)
+		{
+			CasQueueNoBlockMPMC<T> *queue;
+			cpu_set_t cpus;  // 该子队列所属节点的CPU集合
+		} SHARD;
+
+		SHARD *shards;
+		unsigned int shard_num;
+		unsigned int *cpu_shard;  // CPU编号到子队列的映射
+		int cpu_count;
+		std::atomic<int> product_signal __attribute__((aligned(64)));  // 所有子队列都满时生产者睡眠的futex等待字，最低位表示有生产者等待
+		std::atomic<int> consume_signal __attribute__((aligned(64)));  // 所有子队列都空时消费者睡眠的futex等待字，最低位表示有消费者等待
+
+		// 从/sys/devices/system/node读取每个节点的CPU列表，读不到时shards保持为NULL
+		void __ReadNodes()
+		{
+			DIR *p_dir = opendir("/sys/devices/system/node");
+			if (NULL == p_dir)
+				return;
+
+			int node_id[CPU_SETSIZE];
+			unsigned int node_num = 0;
+			struct dirent *p_dirent;
+			while (NULL != (p_dirent = readdir(p_dir)) && node_num < CPU_SETSIZE)
+			{
+				if (0 == strncmp(p_dirent->d_name, "node", 4) && p_dirent->d_name[4] >= '0' && p_dirent->d_name[4] <= '9')
+					node_id[node_num++] = atoi(p_dirent->d_name + 4);
+			}
+			closedir(p_dir);
+
+			if (0 == node_num)
+				return;
+
+			shards = new SHARD [node_num];
+			shard_num = 0;
+			for (unsigned int ii = 0; ii < node_num; ++ii)
+			{
+				char path[64];
+				snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node_id[ii]);
+
+				CPU_ZERO(&shards[shard_num].cpus);
+				if (true == __ReadCpuList(path, shards[shard_num].cpus) && CPU_COUNT(&shards[shard_num].cpus) > 0)
+					++shard_num;  // 跳过没有CPU的纯内存节点
+			}
+
+			if (0 == shard_num)
+			{
+				delete [] shards;
+				shards = NULL;
+				return;
+			}
+
+			for (int cpu = 0; cpu < cpu_count; ++cpu)
+			{
+				cpu_shard[cpu] = 0;
+				for (unsigned int ii = 0; ii < shard_num; ++ii)
+				{
+					if (CPU_ISSET(cpu, &shards[ii].cpus))
+						cpu_shard[cpu] = ii;
+				}
+			}
+		}
+
+		// 解析形如"0-3,8-11"的CPU列表
+		static bool __ReadCpuList(const char *path, cpu_set_t &cpus)
+		{
+			FILE *p_file = fopen(path, "r");
+			if (NULL == p_file)
+				return false;
+
+			char line[4096];
+			bool is_read = NULL != fgets(line, sizeof(line), p_file);
+			fclose(p_file);
+			if (false == is_read)
+				return false;
+
+			char *p_cur = line;
+			while ('\0' != *p_cur && '\n' != *p_cur)
+			{
+				char *p_end;
+				long first = strtol(p_cur, &p_end, 10);
+				long last = first;
+				if (p_end == p_cur)
+					return false;
+
+				if ('-' == *p_end)
+				{
+					p_cur = p_end + 1;
+					last = strtol(p_cur, &p_end, 10);
+				}
+
+				for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+					CPU_SET(cpu, &cpus);
+
+				p_cur = ',' == *p_end ? p_end + 1 : p_end;
+			}
+
+			return true;
+		}
+
+		// 按CPU编号将CPU平均分为group_count组
+		void __GroupCpus(int group_count)
+		{
+			if (group_count > cpu_count)
+				group_count = cpu_count;
+
+			shard_num = group_count;
+			shards = new SHARD [shard_num];
+			for (unsigned int ii = 0; ii < shard_num; ++ii)
+			{
+				CPU_ZERO(&shards[ii].cpus);
+			}
+
+			for (int cpu = 0; cpu < cpu_count; ++cpu)
+			{
+				cpu_shard[cpu] = (unsigned long)cpu * shard_num / cpu_count;
+				CPU_SET(cpu, &shards[cpu_shard[cpu]].cpus);
+			}
+		}
+
+		// 临时将当前线程绑定到子队列所属的CPU上再创建子队列，由首次写入决定内存所在的节点
+		void __AllocShard(unsigned int __index, int queue_size)
+		{
+			cpu_set_t old_cpus;
+			bool is_bind = 0 == sched_getaffinity(0, sizeof(old_cpus), &old_cpus) && 0 == sched_setaffinity(0, sizeof(shards[__index].cpus), &shards[__index].cpus);
+
+			shards[__index].queue = new CasQueueNoBlockMPMC<T>(queue_size);
+
+			if (true == is_bind)
+				sched_setaffinity(0, sizeof(old_cpus), &old_cpus);
+		}
+
+		// 线程第一次访问队列时所在的CPU决定其所属的子队列
+		inline unsigned int __LocalShard()
+		{
+			static thread_local int home_cpu = sched_getcpu();
+
+			return home_cpu >= 0 && home_cpu < cpu_count ? cpu_shard[home_cpu] : 0;
+		}
+
+		// 先写本节点的子队列，满时依次尝试其它子队列，失败时参数没有被移动，可以重试
+		template <class... Args>
+		inline bool __TryProduct(Args &&... args)
+		{
+			unsigned int local = __LocalShard();
+			for (unsigned int ii = 0; ii < shard_num; ++ii)
+			{
+				unsigned int shard = local + ii < shard_num ? local + ii : local + ii - shard_num;
+				if (true == shards[shard].queue->TryEmplace(std::forward<Args>(args)...))
+					return true;
+			}
+
+			return false;
+		}
+
+		// 先取本节点的子队列，空时依次从其它子队列窃取
+		inline bool __TryConsume(T &t_consume)
+		{
+			unsigned int local = __LocalShard();
+			for (unsigned int ii = 0; ii < shard_num; ++ii)
+			{
+				unsigned int shard = local + ii < shard_num ? local + ii : local + ii - shard_num;
+				if (true == shards[shard].queue->Consume(t_consume))
+					return true;
+			}
+
+			return false;
+		}
+
+		template <class... Args>
+		void __Product(Args &&... args)
+		{
+			while (false == __TryProduct(std::forward<Args>(args)...))
+			{
+				if (true == __CasSignalWait(product_signal, [&]() { return __TryProduct(std::forward<Args>(args)...); }))
+					break;
+			}
+
+			__CasSignalAwake(consume_signal);
+		}
+};
+
+#endif
@@ -0,0 +1,495 @@
+#ifndef __CAS_POOL__
+#define __CAS_POOL__
+
+#include "cas_queue.hxx"
+
+/*
+ * 	【变长消息池，配合CasQueue*<CasMessage *>传递变长数据】
+ *
+ * 生产者从池中Allocate(长度)得到一块消息缓冲区，写好数据后只把CasMessage指针放入队列，
+ * 消费者处理完后Free归还，热路径上没有malloc/free
+ * 缓冲区按2的幂分为若干大小等级(最小32字节，最大为构造参数max_size)，超过max_size的消息直接用operator new分配
+ * 每个线程每个等级一个本地空闲链表，只由本线程读写；其它线程Free时压入所属线程的远程链表(无锁)，
+ * 所属线程本地链表为空时一次取走整条远程链表，消息总是回到分配它的线程，生产者与消费者之间形成闭环
+ * 本地链表过长时成批转入全局空闲栈(无锁，带版本号防ABA)，本地链表为空且没有远程归还时先从全局空闲栈取一批
+ * 只有新分配slab和线程第一次使用池时在互斥锁保护的慢路径上；slab在池析构前不释放
+ * 线程退出时把本地链表转入全局空闲栈，线程缓存留给之后的线程复用；池必须在使用它的线程(主线程除外)退出后才能析构
+ *
+ */
+
+// 消息头，数据紧跟在消息头之后
+struct alignas(16) CasMessage
+{
+	CasMessage *next;  // 空闲链表中的下一个
+	std::atomic<CasMessage *> batch_next;  // 全局空闲栈中下一批的第一个，只在每批的第一个消息中有效
+	void *owner;  // 分配该消息的线程缓存，为NULL时Free直接归还全局空闲栈
+	unsigned int size_class;  // 大小等级，超过最大等级时为CAS_POOL_LARGE
+	unsigned int length;  // Allocate时请求的长度
+
+	inline char *Data()
+	{
+		return reinterpret_cast<char *>(this + 1);
+	}
+
+	inline unsigned int Length()
+	{
+		return length;
+	}
+};
+
+enum {CAS_POOL_LARGE = 0xffffffff, CAS_POOL_CLASS_MAX = 32, CAS_POOL_PER_THREAD = 8};
+
+// 线程退出时归还各个池的线程缓存，每个线程最多同时使用CAS_POOL_PER_THREAD个池，超出时直接使用全局空闲栈
+struct __CasPoolRegistry
+{
+	struct
+	{
+		void *pool;
+		unsigned long serial;  // 池的序号，池析构后新池可能分配在同一地址，序号不同时该项作废
+		void *cache;
+		void (*release)(void *pool, void *cache);
+	} items[CAS_POOL_PER_THREAD];
+	unsigned int item_num = 0;
+
+	~__CasPoolRegistry()
+	{
+		for (unsigned int ii = 0; ii < item_num; ++ii)
+		{
+			if (NULL != items[ii].pool)
+				items[ii].release(items[ii].pool, items[ii].cache);
+		}
+	}
+};
+
+inline __CasPoolRegistry &__CasPoolThread()
+{
+	static thread_local __CasPoolRegistry registry;
+	return registry;
+}
+
+inline unsigned long __CasPoolSerial()
+{
+	static std::atomic<unsigned long> next_serial(1);
+	return next_serial.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <class Alloc = CasAllocNew>
+class CasMessagePool
+{
+	public:
+		/*
+		 * max_size	: 最大等级的缓冲区长度，向上取2的幂，更长的消息直接用operator new分配
+		 * cache_limit	: 每个线程每个等级本地链表的长度上限，超过时一半转入全局空闲栈；大的等级按slab_size缩小上限，不超过两个slab
+		 * slab_size	: 每次向分配策略申请的字节数，最大等级的一个缓冲区超过它时按一个缓冲区申请
+		 */
+		CasMessagePool(unsigned int max_size = 65536, unsigned int cache_limit = 256, unsigned long slab_size = 262144)
+		{
+			class_num = __Class(max_size < 32 ? 32 : max_size) + 1;
+			if (class_num > CAS_POOL_CLASS_MAX)
+				class_num = CAS_POOL_CLASS_MAX;
+
+			this->slab_size = slab_size;
+			for (unsigned int ii = 0; ii < CAS_POOL_CLASS_MAX; ++ii)
+			{
+				unsigned long slab_count = slab_size / (sizeof(CasMessage) + ((unsigned long)ClassSize(0) << ii));
+				unsigned long batch = cache_limit / 2 < slab_count ? cache_limit / 2 : slab_count;
+				batch_size[ii] = batch > 0 ? batch : 1;
+			}
+			serial = __CasPoolSerial();
+
+			for (unsigned int ii = 0; ii < CAS_POOL_CLASS_MAX; ++ii)
+				global_free[ii].head.store(0, std::memory_order_relaxed);
+
+			p_slab = NULL;
+			p_cache = NULL;
+			reserved.store(0, std::memory_order_relaxed);
+			pthread_mutex_init(&mutex, NULL);
+		}
+
+		virtual ~CasMessagePool()
+		{
+			// 析构池的线程(通常为主线程)登记的缓存作废
+			__CasPoolRegistry &registry = __CasPoolThread();
+			for (unsigned int ii = 0; ii < registry.item_num; ++ii)
+			{
+				if (this == registry.items[ii].pool && serial == registry.items[ii].serial)
+					registry.items[ii].pool = NULL;
+			}
+
+			while (NULL != p_slab)
+			{
+				SLAB *p_next = p_slab->next;
+				allocator.Deallocate(p_slab, p_slab->bytes, 64);
+				p_slab = p_next;
+			}
+
+			while (NULL != p_cache)
+			{
+				CACHE *p_next = p_cache->next;
+				delete p_cache;
+				p_cache = p_next;
+			}
+
+			pthread_mutex_destroy(&mutex);
+		}
+
+		// 分配一块至少length字节的消息缓冲区
+		CasMessage *Allocate(unsigned int length)
+		{
+			unsigned int size_class = __Class(length);
+			if (size_class >= class_num)
+			{
+				CasMessage *p_message = static_cast<CasMessage *>(::operator new(sizeof(CasMessage) + length));
+				__InitMessage(p_message, NULL, CAS_POOL_LARGE, length);
+				return p_message;
+			}
+
+			CACHE *cache = __LocalCache();
+			if (NULL == cache)
+				return __AllocateGlobal(size_class, length);
+
+			FREE_LIST &free_list = cache->lists[size_class];
+			if (NULL == free_list.local_head)
+				__Refill(cache, size_class);
+
+			CasMessage *p_message = free_list.local_head;
+			free_list.local_head = p_message->next;
+			--free_list.local_count;
+
+			p_message->owner = cache;
+			p_message->length = length;
+			return p_message;
+		}
+
+		// 归还消息缓冲区，本线程分配的放回本地链表，其它线程分配的压入其远程链表
+		void Free(CasMessage *p_message)
+		{
+			if (CAS_POOL_LARGE == p_message->size_class)
+			{
+				::operator delete(p_message);
+				return;
+			}
+
+			CACHE *owner = static_cast<CACHE *>(p_message->owner);
+			if (NULL == owner)
+			{
+				__PushGlobal(p_message->size_class, p_message, 1);
+				return;
+			}
+
+			FREE_LIST &free_list = owner->lists[p_message->size_class];
+			if (owner == __LocalCache())
+			{
+				p_message->next = free_list.local_head;
+				free_list.local_head = p_message;
+				if (++free_list.local_count > batch_size[p_message->size_class] * 2)
+					__Spill(free_list, p_message->size_class);
+
+				return;
+			}
+
+			CasMessage *p_head = free_list.remote_head.load(std::memory_order_relaxed);
+			do
+			{
+				p_message->next = p_head;
+			} while (false == free_list.remote_head.compare_exchange_weak(p_head, p_message, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		// 已向分配策略申请的字节数
+		unsigned long ReservedBytes()
+		{
+			return reserved.load(std::memory_order_relaxed);
+		}
+
+		// 某大小等级的缓冲区长度
+		unsigned int ClassSize(unsigned int size_class)
+		{
+			return 32U << size_class;
+		}
+
+	private:
+		typedef struct
+		{
+			CasMessage *local_head;  // 本地空闲链表，只由所属线程读写
+			unsigned long local_count;
+			std::atomic<CasMessage *> remote_head __attribute__((aligned(64)));  // 其它线程归还的消息，所属线程一次取走整条
+		} FREE_LIST;
+
+		typedef struct CACHE
+		{
+			FREE_LIST lists[CAS_POOL_CLASS_MAX];
+			std::atomic<int> is_used;  // 是否有线程正在使用，线程退出后留给之后的线程复用
+			CACHE *next;
+		} CACHE;
+
+		typedef struct SLAB
+		{
+			SLAB *next;
+			unsigned long bytes;
+		} SLAB;
+
+		// 全局空闲栈，栈中每一项是一批消息，栈顶指针的高16位为版本号
+		typedef struct alignas(64)
+		{
+			std::atomic<unsigned long> head;
+		} GLOBAL_STACK;
+
+		unsigned int class_num;
+		unsigned int batch_size[CAS_POOL_CLASS_MAX];  // 每个等级一次转入全局空闲栈的个数，本地链表上限为它的两倍
+		unsigned long slab_size;
+		unsigned long serial;
+		Alloc allocator;
+		GLOBAL_STACK global_free[CAS_POOL_CLASS_MAX];
+		SLAB *p_slab;  // 以下在互斥锁保护下修改
+		CACHE *p_cache;
+		std::atomic<unsigned long> reserved;
+		pthread_mutex_t mutex __attribute__((aligned(64)));
+
+		static inline unsigned int __Class(unsigned int length)
+		{
+			return length <= 32 ? 0 : 59 - __builtin_clzl((unsigned long)length - 1);
+		}
+
+		static inline void __InitMessage(CasMessage *p_message, void *owner, unsigned int size_class, unsigned int length)
+		{
+			p_message->next = NULL;
+			p_message->batch_next.store(NULL, std::memory_order_relaxed);
+			p_message->owner = owner;
+			p_message->size_class = size_class;
+			p_message->length = length;
+		}
+
+		// 用户态地址只有低48位有效，高16位存放版本号
+		static inline unsigned long __Pack(CasMessage *p_message, unsigned long version)
+		{
+			return reinterpret_cast<unsigned long>(p_message) | (version << 48);
+		}
+
+		static inline CasMessage *__Unpack(unsigned long head)
+		{
+			return reinterpret_cast<CasMessage *>(head & ((1UL << 48) - 1));
+		}
+
+		// 当前线程在本池的缓存，第一次使用时领取一个空闲的缓存或者新建一个
+		inline CACHE *__LocalCache()
+		{
+			__CasPoolRegistry &registry = __CasPoolThread();
+			for (unsigned int ii = 0; ii < registry.item_num; ++ii)
+			{
+				if (this == registry.items[ii].pool && serial == registry.items[ii].serial)
+					return static_cast<CACHE *>(registry.items[ii].cache);
+			}
+
+			return __AttachThread(registry);
+		}
+
+		CACHE *__AttachThread(__CasPoolRegistry &registry)
+		{
+			// 复用已作废的登记项，没有时追加
+			unsigned int item = registry.item_num;
+			for (unsigned int ii = 0; ii < registry.item_num; ++ii)
+			{
+				if (NULL == registry.items[ii].pool || (this == registry.items[ii].pool && serial != registry.items[ii].serial))
+				{
+					item = ii;
+					break;
+				}
+			}
+
+			if (item >= CAS_POOL_PER_THREAD)
+				return NULL;
+
+			pthread_mutex_lock(&mutex);
+
+			CACHE *cache = p_cache;
+			while (NULL != cache && 0 != cache->is_used.load(std::memory_order_relaxed))
+				cache = cache->next;
+
+			if (NULL == cache)
+			{
+				cache = new CACHE;
+				for (unsigned int ii = 0; ii < CAS_POOL_CLASS_MAX; ++ii)
+				{
+					cache->lists[ii].local_head = NULL;
+					cache->lists[ii].local_count = 0;
+					cache->lists[ii].remote_head.store(NULL, std::memory_order_relaxed);
+				}
+				cache->next = p_cache;
+				p_cache = cache;
+			}
+			cache->is_used.store(1, std::memory_order_relaxed);
+
+			pthread_mutex_unlock(&mutex);
+
+			registry.items[item].pool = this;
+			registry.items[item].serial = serial;
+			registry.items[item].cache = cache;
+			registry.items[item].release = __ReleaseThread;
+			if (item == registry.item_num)
+				++registry.item_num;
+
+			return cache;
+		}
+
+		// 线程退出时本地链表转入全局空闲栈，远程链表留在缓存中，由之后复用该缓存的线程取走
+		static void __ReleaseThread(void *pool, void *cache)
+		{
+			CasMessagePool *p_pool = static_cast<CasMessagePool *>(pool);
+			CACHE *p_cache = static_cast<CACHE *>(cache);
+			for (unsigned int ii = 0; ii < p_pool->class_num; ++ii)
+			{
+				FREE_LIST &free_list = p_cache->lists[ii];
+				if (NULL != free_list.local_head)
+				{
+					CasMessage *p_tail = free_list.local_head;
+					while (NULL != p_tail->next)
+						p_tail = p_tail->next;
+
+					p_pool->__PushGlobal(ii, free_list.local_head, p_tail, free_list.local_count);
+					free_list.local_head = NULL;
+					free_list.local_count = 0;
+				}
+			}
+
+			pthread_mutex_lock(&p_pool->mutex);
+			p_cache->is_used.store(0, std::memory_order_relaxed);
+			pthread_mutex_unlock(&p_pool->mutex);
+		}
+
+		// 本地链表为空时依次尝试远程链表、全局空闲栈、新slab
+		void __Refill(CACHE *cache, unsigned int size_class)
+		{
+			FREE_LIST &free_list = cache->lists[size_class];
+
+			CasMessage *p_head = free_list.remote_head.exchange(NULL, std::memory_order_acquire);
+			if (NULL != p_head)
+			{
+				unsigned long count = 0;
+				for (CasMessage *p_cur = p_head; NULL != p_cur; p_cur = p_cur->next)
+					++count;
+
+				free_list.local_head = p_head;
+				free_list.local_count = count;
+				return;
+			}
+
+			unsigned long count = 0;
+			p_head = __PopGlobal(size_class, count);
+			if (NULL == p_head)
+				p_head = __NewSlab(size_class, count);
+
+			free_list.local_head = p_head;
+			free_list.local_count = count;
+		}
+
+		// 本地链表过长时把前batch_size个转入全局空闲栈
+		void __Spill(FREE_LIST &free_list, unsigned int size_class)
+		{
+			unsigned int batch = batch_size[size_class];
+			CasMessage *p_head = free_list.local_head;
+			CasMessage *p_tail = p_head;
+			for (unsigned int ii = 1; ii < batch; ++ii)
+				p_tail = p_tail->next;
+
+			free_list.local_head = p_tail->next;
+			free_list.local_count -= batch;
+			p_tail->next = NULL;
+
+			__PushGlobal(size_class, p_head, p_tail, batch);
+		}
+
+		// 把head..tail这一批压入全局空闲栈，批内仍由next串联
+		void __PushGlobal(unsigned int size_class, CasMessage *p_head, CasMessage *p_tail, unsigned long count)
+		{
+			p_tail->next = NULL;
+			p_head->length = count;  // 空闲时length记录该批的个数
+
+			std::atomic<unsigned long> &head = global_free[size_class].head;
+			unsigned long current = head.load(std::memory_order_relaxed);
+			do
+			{
+				p_head->batch_next.store(__Unpack(current), std::memory_order_relaxed);
+			} while (false == head.compare_exchange_weak(current, __Pack(p_head, (current >> 48) + 1), std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		void __PushGlobal(unsigned int size_class, CasMessage *p_message, unsigned long count)
+		{
+			__PushGlobal(size_class, p_message, p_message, count);
+		}
+
+		/*
+		 * 弹出一批，读取栈顶的batch_next时该批可能已被其它线程弹出并重新使用，
+		 * slab在池析构前不释放，读到的旧值只会使cas失败，版本号保证同一地址重新入栈后cas也会失败
+		 */
+		CasMessage *__PopGlobal(unsigned int size_class, unsigned long &count)
+		{
+			std::atomic<unsigned long> &head = global_free[size_class].head;
+			unsigned long current = head.load(std::memory_order_acquire);
+			while (NULL != __Unpack(current))
+			{
+				CasMessage *p_head = __Unpack(current);
+				CasMessage *p_next = p_head->batch_next.load(std::memory_order_relaxed);
+				if (true == head.compare_exchange_weak(current, __Pack(p_next, (current >> 48) + 1), std::memory_order_acquire, std::memory_order_acquire))
+				{
+					count = p_head->length;
+					return p_head;
+				}
+			}
+
+			return NULL;
+		}
+
+		// 没有登记线程缓存的线程直接从全局空闲栈分配，一批中取一个，其余放回
+		CasMessage *__AllocateGlobal(unsigned int size_class, unsigned int length)
+		{
+			unsigned long count = 0;
+			CasMessage *p_head = __PopGlobal(size_class, count);
+			if (NULL == p_head)
+				p_head = __NewSlab(size_class, count);
+
+			if (count > 1)
+			{
+				CasMessage *p_tail = p_head->next;
+				while (NULL != p_tail->next)
+					p_tail = p_tail->next;
+
+				__PushGlobal(size_class, p_head->next, p_tail, count - 1);
+			}
+
+			p_head->owner = NULL;
+			p_head->length = length;
+			return p_head;
+		}
+
+		// 申请一个slab并切分为该等级的缓冲区，返回串联好的链表
+		CasMessage *__NewSlab(unsigned int size_class, unsigned long &count)
+		{
+			unsigned long header_size = (sizeof(SLAB) + alignof(CasMessage) - 1) & ~(alignof(CasMessage) - 1);
+			unsigned long block_size = sizeof(CasMessage) + ClassSize(size_class);
+			unsigned long bytes = slab_size > header_size + block_size ? slab_size : header_size + block_size;
+			count = (bytes - header_size) / block_size;
+
+			SLAB *slab = static_cast<SLAB *>(allocator.Allocate(bytes, 64));
+			slab->bytes = bytes;
+			reserved.fetch_add(bytes, std::memory_order_relaxed);
+
+			pthread_mutex_lock(&mutex);
+			slab->next = p_slab;
+			p_slab = slab;
+			pthread_mutex_unlock(&mutex);
+
+			char *p_block = reinterpret_cast<char *>(slab) + header_size;
+			CasMessage *p_head = NULL;
+			for (unsigned long ii = 0; ii < count; ++ii)
+			{
+				CasMessage *p_message = new (p_block + (count - 1 - ii) * block_size) CasMessage;
+				__InitMessage(p_message, NULL, size_class, 0);
+				p_message->next = p_head;
+				p_head = p_message;
+			}
+
+			return p_head;
+		}
+};
+
+#endif
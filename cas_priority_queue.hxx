@@ -0,0 +1,255 @@
+#ifndef __CAS_PRIORITY_QUEUE__
+#define __CAS_PRIORITY_QUEUE__
+
+#include "cas_queue.hxx"
+
+/*
+ * 	【多优先级通道的多生产多消费阻塞队列】
+ *
+ * LANES个优先级通道，每个通道是一个CasQueueNoBlockMPMC，通道0优先级最高
+ * 占用位图的第ii位表示通道ii可能有数据，消费者读一次位图再取最低位(ctz)即找到优先级最高的非空通道，
+ * 控制消息不会排在大量批量数据之后
+ * 防饿死权重weight：某通道连续被取weight个数据且更低优先级的通道也有数据时，让出一个给下一个非空通道，
+ * 低优先级通道在高优先级通道饱和时至少得到1/(weight+1)的份额；weight为0时为严格优先级
+ * 通道满时生产者阻塞，所有通道都空时消费者阻塞；只保证每个通道内先进先出
+ *
+ */
+template <class T, unsigned int LANES = 4>
+class CasPriorityQueueMPMC
+{
+	static_assert(LANES > 0 && LANES <= 64, "lanes must be in [1, 64]");
+
+	public:
+		// 每个通道queue_size个entry，weight为各通道初始的防饿死权重
+		CasPriorityQueueMPMC(int queue_size = 16384, unsigned int weight = 0)
+		{
+			for (unsigned int ii = 0; ii < LANES; ++ii)
+			{
+				lanes[ii].queue = new CasQueueNoBlockMPMC<T>(queue_size);
+				lanes[ii].weight.store(weight, std::memory_order_relaxed);
+				lanes[ii].credit.store((int)weight, std::memory_order_relaxed);
+			}
+
+			lane_bits.store(0, std::memory_order_relaxed);
+			product_signal.store(0, std::memory_order_relaxed);
+			consume_signal.store(0, std::memory_order_relaxed);
+		}
+
+		virtual ~CasPriorityQueueMPMC()
+		{
+			for (unsigned int ii = 0; ii < LANES; ++ii)
+			{
+				delete lanes[ii].queue;
+			}
+		}
+
+		// priority为通道编号，0最高，超出范围时按最低优先级处理
+		void Product(unsigned int priority, const T &t_product)
+		{
+			__Product(priority, t_product);
+		}
+
+		void Product(unsigned int priority, T &&t_product)
+		{
+			__Product(priority, std::move(t_product));
+		}
+
+		template <class... Args>
+		void Emplace(unsigned int priority, Args &&... args)
+		{
+			__Product(priority, std::forward<Args>(args)...);
+		}
+
+		// 通道满时返回false
+		bool TryProduct(unsigned int priority, const T &t_product)
+		{
+			return __TryProduct(__Lane(priority), t_product);
+		}
+
+		bool TryProduct(unsigned int priority, T &&t_product)
+		{
+			return __TryProduct(__Lane(priority), std::move(t_product));
+		}
+
+		// 取优先级最高的非空通道，所有通道都空时阻塞，p_priority不为NULL时返回数据所在的通道
+		void Consume(T &t_consume, unsigned int *p_priority = NULL)
+		{
+			unsigned int lane;
+			while (false == __TryConsume(t_consume, lane))
+			{
+				if (true == __CasSignalWait(consume_signal, [&]() { return __TryConsume(t_consume, lane); }))
+					break;
+			}
+
+			if (NULL != p_priority)
+				*p_priority = lane;
+
+			__CasSignalAwake(product_signal);
+		}
+
+		// 所有通道都空时返回false
+		bool TryConsume(T &t_consume, unsigned int *p_priority = NULL)
+		{
+			unsigned int lane;
+			if (false == __TryConsume(t_consume, lane))
+				return false;
+
+			if (NULL != p_priority)
+				*p_priority = lane;
+
+			__CasSignalAwake(product_signal);
+			return true;
+		}
+
+		// 运行期调整某通道的防饿死权重，0为严格优先级
+		void SetWeight(unsigned int priority, unsigned int weight)
+		{
+			CHANNEL &channel = lanes[__Lane(priority)];
+			channel.weight.store(weight, std::memory_order_relaxed);
+			channel.credit.store((int)weight, std::memory_order_relaxed);
+		}
+
+		// 某通道近似数据个数
+		unsigned long ApproxSize(unsigned int priority)
+		{
+			return lanes[__Lane(priority)].queue->ApproxSize();
+		}
+
+		// 各通道近似数据个数之和
+		unsigned long ApproxSize()
+		{
+			unsigned long size = 0;
+			for (unsigned int ii = 0; ii < LANES; ++ii)
+			{
+				size += lanes[ii].queue->ApproxSize();
+			}
+
+			return size;
+		}
+
+	private:
+		typedef struct alignas(64)
+		{
+			CasQueueNoBlockMPMC<T> *queue;
+			std::atomic<unsigned int> weight;
+			std::atomic<int> credit;  // 更低优先级通道有数据时还可以连续取的个数，降到0时让出一次
+		} CHANNEL;
+
+		CHANNEL lanes[LANES];
+		std::atomic<unsigned long> lane_bits __attribute__((aligned(64)));  // 通道占用位图，置位的通道可能为空，有数据的通道只会短暂地未置位
+		std::atomic<int> product_signal __attribute__((aligned(64)));  // 通道满时生产者睡眠的futex等待字，最低位表示有生产者等待
+		std::atomic<int> consume_signal __attribute__((aligned(64)));  // 所有通道都空时消费者睡眠的futex等待字，最低位表示有消费者等待
+
+		static inline unsigned int __Lane(unsigned int priority)
+		{
+			return priority < LANES ? priority : LANES - 1;
+		}
+
+		/*
+		 * 发布数据后全屏障再读位图，与消费者清除位图后全屏障再检查通道构成全序：
+		 * 要么生产者看到被清除的位并重新置位，要么消费者重新检查时取到数据
+		 * 位已置位时不写位图，通道持续有数据时生产者之间不争抢位图所在的缓存行
+		 */
+		template <class... Args>
+		inline bool __TryProduct(unsigned int lane, Args &&... args)
+		{
+			if (false == lanes[lane].queue->TryEmplace(std::forward<Args>(args)...))
+				return false;
+
+			unsigned long mask = 1UL << lane;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (0 == (lane_bits.load(std::memory_order_relaxed) & mask))
+				lane_bits.fetch_or(mask, std::memory_order_seq_cst);
+
+			__CasSignalAwake(consume_signal);
+			return true;
+		}
+
+		template <class... Args>
+		void __Product(unsigned int priority, Args &&... args)
+		{
+			unsigned int lane = __Lane(priority);
+			while (false == __TryProduct(lane, std::forward<Args>(args)...))
+			{
+				if (true == __CasSignalWait(product_signal, [&]() { return __TryProduct(lane, std::forward<Args>(args)...); }))
+					break;
+			}
+		}
+
+		/*
+		 * 位图中最低的置位即优先级最高的非空通道，本通道额度用完且更低优先级的通道也有数据时让出一个
+		 * 让出时依次尝试更低优先级的通道，从其中一个取到数据后才重置本通道的额度，位已过期的通道照常清除其位
+		 */
+		inline bool __TryConsume(T &t_consume, unsigned int &lane)
+		{
+			unsigned long bits = lane_bits.load(std::memory_order_acquire);
+			while (0 != bits)
+			{
+				lane = __builtin_ctzl(bits);
+				unsigned long lower = bits & ~((2UL << lane) - 1);  // 更低优先级的非空通道
+				if (0 != lower && true == __Yield(lane))
+				{
+					for (; 0 != lower; lower &= lower - 1)
+					{
+						unsigned int next = __builtin_ctzl(lower);
+						if (true == __ConsumeLane(next, t_consume))
+						{
+							__Refill(lane);
+							lane = next;
+							return true;
+						}
+
+						bits &= ~(1UL << next);
+					}
+				}
+
+				if (true == __ConsumeLane(lane, t_consume))
+					return true;
+
+				bits &= ~(1UL << lane);
+			}
+
+			return false;
+		}
+
+		// 从一个通道取数据，位置位但通道为空时清除该位，全屏障后再检查一次，期间生产的数据不会被遗漏
+		inline bool __ConsumeLane(unsigned int lane, T &t_consume)
+		{
+			if (true == lanes[lane].queue->Consume(t_consume))
+				return true;
+
+			unsigned long mask = 1UL << lane;
+			lane_bits.fetch_and(~mask, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (true == lanes[lane].queue->Consume(t_consume))
+			{
+				lane_bits.fetch_or(mask, std::memory_order_relaxed);  // 通道中可能还有数据
+				return true;
+			}
+
+			return false;
+		}
+
+		// 扣减通道的连续额度，额度已用完时返回true，应让出一次；多个消费者并发扣减时额度为近似值，可能短暂为负
+		inline bool __Yield(unsigned int lane)
+		{
+			CHANNEL &channel = lanes[lane];
+			if (0 == channel.weight.load(std::memory_order_relaxed))
+				return false;
+
+			if (channel.credit.load(std::memory_order_relaxed) <= 0)
+				return true;
+
+			channel.credit.fetch_sub(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// 成功让出后重置额度
+		inline void __Refill(unsigned int lane)
+		{
+			CHANNEL &channel = lanes[lane];
+			channel.credit.store((int)channel.weight.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+};
+
+#endif
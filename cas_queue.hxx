@@ -6,1549 +6,2005 @@
 #include <cmath>
 #include <pthread.h>
 #include <stdlib.h>
+#include <new>
+#include <utility>
+#include <atomic>
+#include <type_traits>
+#include <chrono>
+#include <unistd.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
 
 using namespace std;
 
-// 多生产者多消费者阻塞队列
+/*
+ * 	【队列entry布局策略，作为各队列类的模板参数】
+ *
+ * ALIGN	: 每个entry对齐到的字节数，0表示紧凑排列，64表示每个entry独占一个缓存行
+ * SCATTER	: 为true时将相邻的票号映射到不同缓存行上的entry，避免相邻entry的生产者和消费者伪共享
+ * SPLIT	: 为true时控制字(e_state、f_door、b_door等)与数据分别存放在两个数组中
+ *
+ */
+template <unsigned int A, bool S, bool P>
+struct CasLayout
+{
+	enum {ALIGN = A, SCATTER = S, SPLIT = P};
+};
+
+typedef CasLayout<0, false, false> CasLayoutCompact;	// 紧凑布局（默认）
+typedef CasLayout<64, false, false> CasLayoutPadded;	// 每个entry独占缓存行
+typedef CasLayout<0, true, false> CasLayoutScatter;	// 相邻票号打散到不同缓存行
+typedef CasLayout<0, false, true> CasLayoutSplit;	// 控制字与数据分离
+
+// entry中数据的原始存储，生产时就地构造T，消费时移出并析构
+template <class T, bool HAS_DATA = true>
+struct __CasStorage
+{
+	alignas(T) unsigned char data[sizeof(T)];
+
+	inline T *Get()
+	{
+		return reinterpret_cast<T *>(data);
+	}
+};
+
 template <class T>
-class CasQueueMPMC
+struct __CasStorage<T, false>
 {
-	public:
-		CasQueueMPMC()
-		{
-			size = 16384;
-			product_index = consume_index = 0;
+	inline T *Get()
+	{
+		return NULL;
+	}
+};
 
-			p_queue = new ENTRY [size];
+// 按ALIGN字节对齐的entry外壳，ALIGN为0时不做填充
+template <class E, unsigned int ALIGN>
+struct alignas(ALIGN) __CasCell : E {};
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
+template <class E>
+struct __CasCell<E, 0> : E {};
 
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+// 64字节缓存行能容纳的entry个数（向下取2的幂）的对数
+constexpr unsigned int __CasLineBits(size_t bytes)
+{
+	return bytes >= 64 ? 0 : 1 + __CasLineBits(bytes * 2);
+}
+
+/*
+ * 调度扰动点，定义CAS_QUEUE_FUZZ时在每个cas、票号领取、发布和挂起之前调用使用者提供的__CasFuzzPoint()，
+ * 由测试程序随机注入延迟或让出CPU，放大线程交错的窗口；不定义时为空，不产生任何指令
+ */
+#ifdef CAS_QUEUE_FUZZ
+void __CasFuzzPoint();
+#define __CAS_FUZZ_POINT() __CasFuzzPoint()
+#else
+#define __CAS_FUZZ_POINT()
+#endif
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+// 在futex等待字上挂起，仅当*addr仍等于val时才会真正阻塞，等待字必须为4字节；is_shared为true时等待字可以位于多个进程共享的内存中
+template <class W>
+inline void __CasFutexWait(W *addr, int val, bool is_shared = false)
+{
+	static_assert(4 == sizeof(W), "futex word must be 4 bytes");
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
-			}
-		}
+	__CAS_FUZZ_POINT();
+	syscall(SYS_futex, reinterpret_cast<int *>(addr), true == is_shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
 
-		CasQueueMPMC(int queue_size)
-		{
-			product_index = consume_index = 0;
+// 唤醒阻塞在futex等待字上的线程，默认唤醒一个
+template <class W>
+inline void __CasFutexWake(W *addr, int count = 1, bool is_shared = false)
+{
+	static_assert(4 == sizeof(W), "futex word must be 4 bytes");
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
+	syscall(SYS_futex, reinterpret_cast<int *>(addr), true == is_shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
+// 在futex等待字上挂起直到被唤醒或到达deadline，已超时返回false
+template <class W, class Clock, class Duration>
+inline bool __CasFutexWaitUntil(W *addr, int val, const std::chrono::time_point<Clock, Duration> &deadline, bool is_shared = false)
+{
+	static_assert(4 == sizeof(W), "futex word must be 4 bytes");
 
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+	long remain = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - Clock::now()).count();
+	if (remain <= 0)
+		return false;
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+	// 单次最多挂起10ms，弱内存序平台上即使错过唤醒也能及时重新检查
+	if (remain > 10000000)
+		remain = 10000000;
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
-			}
-		}
+	struct timespec timeout = {0, remain};
+	syscall(SYS_futex, reinterpret_cast<int *>(addr), true == is_shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, &timeout, NULL, 0);
+
+	return true;
+}
 
-		virtual ~CasQueueMPMC()
+// CPU自旋等待提示，降低自旋时的功耗并让出超线程的执行资源
+inline void __CasCpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+// 比较并交换，成功时返回true，调用者不需要失败时读到的当前值
+template <class V>
+inline bool __CasCompareSwap(std::atomic<V> &value, typename std::atomic<V>::value_type expected, typename std::atomic<V>::value_type desired, std::memory_order order)
+{
+	__CAS_FUZZ_POINT();
+	return value.compare_exchange_strong(expected, desired, order);
+}
+
+/*
+ * 	【等待位协议】
+ *
+ * 多个队列共用一个futex等待字signal时使用，最低位表示有线程等待，其余位随每次唤醒递增
+ * 等待者置等待位、全屏障后再尝试一次，仍失败才挂起，避免在尝试与睡眠之间错过唤醒
+ * 唤醒者发布数据后全屏障再读等待字，与等待者构成全序：要么等待者重试时看到数据，要么唤醒者看到等待位
+ * 唤醒者清除等待位并递增唤醒次数后再调用futex，同一批等待者只唤醒一次，
+ * 队列持续满或空时不会每次生产/消费都做一次系统调用
+ *
+ */
+
+// 一次等待：置等待位后调用retry，retry返回true时不挂起并返回true，否则挂起直到被唤醒后返回false
+template <class F>
+inline bool __CasSignalWait(std::atomic<int> &signal, F &&retry)
+{
+	int current_signal = signal.fetch_or(1, std::memory_order_seq_cst) | 1;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (true == retry())
+		return true;
+
+	__CasFutexWait(&signal, current_signal);
+	return false;
+}
+
+// 限时的一次等待，retry返回true或已到达deadline时返回true，调用者不再等待；被唤醒时返回false
+template <class F, class Clock, class Duration>
+inline bool __CasSignalWaitUntil(std::atomic<int> &signal, F &&retry, const std::chrono::time_point<Clock, Duration> &deadline)
+{
+	int current_signal = signal.fetch_or(1, std::memory_order_seq_cst) | 1;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (true == retry())
+		return true;
+
+	return false == __CasFutexWaitUntil(&signal, current_signal, deadline);
+}
+
+// 调用者发布数据后已做过全屏障时使用，连续唤醒多个等待字时只需一次全屏障
+inline void __CasSignalAwakeFenced(std::atomic<int> &signal)
+{
+	int current_signal = signal.load(std::memory_order_relaxed);
+	if (0 != (current_signal & 1) && true == __CasCompareSwap(signal, current_signal, (current_signal + 2) & ~1, std::memory_order_relaxed))
+		__CasFutexWake(&signal, INT_MAX);
+}
+
+// 有线程等待时才唤醒，先用全屏障保证前面发布的数据与对等待位的读取不会乱序
+inline void __CasSignalAwake(std::atomic<int> &signal)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	__CasSignalAwakeFenced(signal);
+}
+
+/*
+ * 	【阻塞队列的等待策略，作为阻塞队列类的第三个模板参数】
+ *
+ * Spin(spin)		: 在entry的等待字上第spin次轮询时调用，返回true继续轮询，返回false则在futex上挂起
+ * Done(spin, is_park)	: 一次等待结束时调用，spin为轮询次数，is_park表示是否挂起过
+ * Relax(spin)		: 无等待字可挂起的轮询中调用（如等待套圈的生产者出前门）
+ *
+ */
+
+// 立即挂起，不做自旋（默认）
+struct CasWaitPark
+{
+	inline bool Spin(unsigned int spin)
+	{
+		return false;
+	}
+
+	inline void Done(unsigned int spin, bool is_park)
+	{
+	}
+
+	inline void Relax(unsigned int spin)
+	{
+		if (spin < 64)
+			__CasCpuRelax();
+		else
+			sched_yield();
+	}
+};
+
+// 只自旋从不挂起，适合线程独占CPU核心的低延迟场景
+struct CasWaitSpin
+{
+	inline bool Spin(unsigned int spin)
+	{
+		__CasCpuRelax();
+		return true;
+	}
+
+	inline void Done(unsigned int spin, bool is_park)
+	{
+	}
+
+	inline void Relax(unsigned int spin)
+	{
+		__CasCpuRelax();
+	}
+};
+
+// 先自旋，再让出CPU若干次，最后挂起；自旋上限根据最近的等待结果自适应调整
+struct CasWaitAdaptive
+{
+	enum {MIN_SPIN = 16, MAX_SPIN = 4096, INIT_SPIN = 128, YIELD_COUNT = 8};
+
+	std::atomic<unsigned int> spin_limit;  // 多个等待者共享，只作为启发值，用relaxed读写
+	unsigned int max_spin;
+
+	CasWaitAdaptive()
+	{
+		// 单核机器上对方不可能在自旋期间到达，只让出CPU不自旋
+		max_spin = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? MAX_SPIN : 0;
+		spin_limit = max_spin < INIT_SPIN ? max_spin : INIT_SPIN;
+	}
+
+	inline bool Spin(unsigned int spin)
+	{
+		unsigned int limit = spin_limit.load(std::memory_order_relaxed);
+		if (spin < limit)
 		{
-			delete [] p_queue;
+			__CasCpuRelax();
+			return true;
 		}
 
-		void Product(T &t_product)
+		if (spin < limit + YIELD_COUNT)
 		{
-			// product_index为类成员变量，表示生产索引，利用unsigned long类型达到最大值后循环归零的特性递增生产索引, 为多个生产者原子性分配生产entry位置
-			unsigned long current_product_index = __sync_fetch_and_add(&product_index, 1);
-			current_product_index &= (size - 1);  // 代替取模操作提升性能，size为队列初始化entry个数，必须为2的N次幂
+			sched_yield();
+			return true;
+		}
 
-			// loop_entry_product 为防止多个生产者时，有些生产者速度快甩其它生产者一圈后与速度慢的生产者进入了同一个entry，此时快的生产者必须轮询等待慢的生产者生产完毕，而不能越过该entry，如果越过该entry可能导致在该entry的消费者永远阻塞
-loop_entry_product:
-			// 生产者进前门，使用cas的原因为有可能多个生产者的情况下，防止有速度快的生产者套圈后又回到了这个位置的entry后导致有多个生产者同时进入一个entry
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN, FRONT_DOOR_CLOSE);
-			if (true == is_enter)
-			{
-				// 判断entry状态，如果为空则置为生产状态
-				bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-				if (true == is_product)
-				{
-					// 生产数据
-					p_queue[current_product_index].data = t_product;
-					p_queue[current_product_index].p_wait = P_INIT;  // 每次生产完数据需要将p_wait初始化
+		return false;
+	}
 
-					__AwakeConsume(current_product_index);  // 判断是否唤醒消费者
+	// 在自旋阶段等到则把上限向两倍实际轮询次数靠拢，挂起过则减半，每次只调整差值的1/8
+	inline void Done(unsigned int spin, bool is_park)
+	{
+		if (0 == max_spin)
+			return;
 
-					// 打开前门
-					__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
+		int limit = spin_limit.load(std::memory_order_relaxed);
+		int target = true == is_park ? limit / 2 : spin * 2;
+		limit += (target - limit) / 8;
+
+		if (limit < MIN_SPIN)
+			limit = MIN_SPIN;
+		else if (limit > (int)max_spin)
+			limit = max_spin;
+
+		spin_limit.store(limit, std::memory_order_relaxed);
+	}
+
+	inline void Relax(unsigned int spin)
+	{
+		if (spin < max_spin)
+			__CasCpuRelax();
+		else
+			sched_yield();
+	}
+};
 
-					return;
-				}
-				else  // 该entry已经有数据 或 有消费者正在消费数据
-				{
-					bool is_wait = __sync_bool_compare_and_swap(&p_queue[current_product_index].p_wait, P_INIT, P_WAIT);
-					if (true == is_wait)  // 等待消费者唤醒
-					{
-						pthread_mutex_lock(&p_queue[current_product_index].product_mutex);
-						while (!p_queue[current_product_index].product_awake_flag)
-							pthread_cond_wait(&p_queue[current_product_index].product_cond, &p_queue[current_product_index].product_mutex);
-						pthread_mutex_unlock(&p_queue[current_product_index].product_mutex);
+/*
+ * 	【队列统计策略，作为阻塞队列类的第四个模板参数、非阻塞队列类的第三个模板参数】
+ *
+ * Add(stat, n)		: 在热路径上将编号为stat的计数器加n
+ * Sum(counter)		: 汇总各计数器到counter数组，供监控线程调用
+ *
+ */
 
-						// 生产数据
-						p_queue[current_product_index].data = t_product;
-						p_queue[current_product_index].p_wait = P_INIT;
-						p_queue[current_product_index].product_awake_flag = false;
+// 计数器编号
+enum cas_stat
+{
+	CAS_STAT_PRODUCT = 0,	// 生产成功的数据个数
+	CAS_STAT_CONSUME,	// 消费成功的数据个数
+	CAS_STAT_PRODUCT_FULL,	// 不阻塞的生产因队列满而失败的次数
+	CAS_STAT_CONSUME_EMPTY,	// 不阻塞的消费因队列空而失败的次数
+	CAS_STAT_PRODUCT_CAS,	// 推进product_index的cas被其它生产者抢先的次数
+	CAS_STAT_CONSUME_CAS,	// 推进consume_index的cas被其它消费者抢先的次数
+	CAS_STAT_PRODUCT_LAP,	// 生产者套圈碰撞：阻塞队列中进前门失败，非阻塞队列中票号已被其它生产者领取
+	CAS_STAT_CONSUME_LAP,	// 消费者套圈碰撞：阻塞队列中进后门失败，非阻塞队列中票号已被其它消费者领取
+	CAS_STAT_PRODUCT_RETRY,	// 阻塞队列中消费者已放弃唤醒但entry尚未置空的轮询次数
+	CAS_STAT_CONSUME_RETRY,	// 阻塞队列中生产者已放弃唤醒但entry尚未置满的轮询次数
+	CAS_STAT_PRODUCT_WAIT,	// 阻塞队列中生产者在p_wait上等待消费者唤醒的次数
+	CAS_STAT_CONSUME_WAIT,	// 阻塞队列中消费者在c_wait上等待生产者唤醒的次数
+	CAS_STAT_PARK,		// 在futex上挂起的次数
+	CAS_STAT_WAKE,		// futex唤醒的系统调用次数
+	CAS_STAT_SPIN,		// 等待期间按等待策略轮询的次数
+	CAS_STAT_COUNT
+};
 
-						__AwakeConsume(current_product_index);
+// 计数器名称，与cas_stat一一对应
+inline const char *CasStatName(unsigned int stat)
+{
+	static const char *names[CAS_STAT_COUNT] = {
+		"product", "consume", "product_full", "consume_empty",
+		"product_cas", "consume_cas", "product_lap", "consume_lap",
+		"product_retry", "consume_retry", "product_wait", "consume_wait",
+		"park", "wake", "spin"};
 
-						// 打开前门
-						__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
+	return stat < CAS_STAT_COUNT ? names[stat] : "unknown";
+}
 
-						return;
-					}
-					else  // p_wait已经被消费者置为2（忽略），说明消费者已经消费完毕，但e_state不一定被及时置为0（空），需要进行轮询式判断
-					{
-loop_product:
-						bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-						if (true == is_product)
-						{
-							// 生产数据
-							p_queue[current_product_index].data = t_product;
-							p_queue[current_product_index].p_wait = P_INIT;
-
-							__AwakeConsume(current_product_index);
-
-							// 打开前门
-							__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
-
-							return;	
-						}
-						else  // 此种情况极少发生，一旦发生循环判断
-						{
-							goto loop_product;
-						}
-					}
-				}
-			}
-			else  // 已经有生产者进入，继续获取entry位置
-			{
-				goto loop_entry_product;
-			}
-		}
+// 队列运行状态快照，由各队列类的Snapshot填写
+typedef struct
+{
+	unsigned long counter[CAS_STAT_COUNT];	// 各计数器的累计值，未开启统计时全为0
+	unsigned long size;	// 近似的数据个数
+	unsigned long capacity;	// 队列entry个数
+} CasQueueStats;
+
+/*
+ * 	【零拷贝生产/消费时领取到的entry】
+ *
+ * 生产者ClaimProduct领取entry后直接在entry中写数据，CommitProduct发布；消费者ClaimConsume领取后直接读entry中的数据，ReleaseConsume归还
+ * 领取失败（非阻塞队列满或空、阻塞队列已关闭）时p_data为NULL
+ */
+template <class T>
+struct CasSlot
+{
+	T *p_data;  // entry中的数据
+	unsigned long index;  // 阻塞队列中为entry下标，非阻塞队列中为票号
+
+	bool IsValid() const
+	{
+		return NULL != p_data;
+	}
+
+	T &operator*() const
+	{
+		return *p_data;
+	}
+
+	T *operator->() const
+	{
+		return p_data;
+	}
+};
 
-		void Consume(T &t_consume)
-		{
-			unsigned long current_consume_index = __sync_fetch_and_add(&consume_index, 1);
-			current_consume_index &= (size - 1);
+// 不统计（默认），Add为空函数，编译后热路径上不产生任何指令
+struct CasStatsNone
+{
+	inline void Add(unsigned int stat, unsigned long n = 1)
+	{
+	}
+
+	inline void Sum(unsigned long *counter)
+	{
+		for (unsigned int ii = 0; ii < CAS_STAT_COUNT; ++ii)
+			counter[ii] = 0;
+	}
+};
 
-loop_entry_consume:  // 防止多个消费者时，有些消费者速度快甩其它消费者一圈后与速度慢的消费者进入了同一个entry，此时快的消费者必须轮询等待慢的消费者消费完毕，而不能越过该entry
-			// 进后门
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN, BACK_DOOR_CLOSE);
-			if (true == is_enter)
-			{
-				// 判断entry状态
-				bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-				if (true == is_consume)
-				{
-					// 消费数据
-					t_consume = p_queue[current_consume_index].data;
-					p_queue[current_consume_index].c_wait = C_INIT;
+// 当前线程的计数器分片号，线程第一次计数时依次分配
+inline unsigned int __CasStatShard()
+{
+	static std::atomic<unsigned int> next_shard(0);
+	static thread_local unsigned int shard = next_shard.fetch_add(1, std::memory_order_relaxed);
 
-					__AwakeProduct(current_consume_index);
+	return shard;
+}
 
-					// 打开后门
-					__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
+// 按线程分片计数，每个分片独占缓存行，各线程只写自己的分片，不会因为统计在同一缓存行上争抢；SHARDS必须为2的N次幂，线程数超过SHARDS时分片共用
+template <unsigned int SHARDS = 16>
+struct CasStatsSharded
+{
+	static_assert(0 == (SHARDS & (SHARDS - 1)), "SHARDS must be a power of 2");
 
-					return;
-				}
-				else  // 该entry已经没有数据 或 有生产者正在生产数据
-				{
-					bool is_wait = __sync_bool_compare_and_swap(&p_queue[current_consume_index].c_wait, C_INIT, C_WAIT);
-					if (true == is_wait)  // 等待生产者唤醒
-					{
-						pthread_mutex_lock(&p_queue[current_consume_index].consume_mutex);
-						while (!p_queue[current_consume_index].consume_awake_flag)
-							pthread_cond_wait(&p_queue[current_consume_index].consume_cond, &p_queue[current_consume_index].consume_mutex);
-						pthread_mutex_unlock(&p_queue[current_consume_index].consume_mutex);
+	struct alignas(64) SHARD
+	{
+		std::atomic<unsigned long> counter[CAS_STAT_COUNT] = {};
+	};
 
-						// 消费数据
-						t_consume = p_queue[current_consume_index].data;
-						p_queue[current_consume_index].c_wait = C_INIT;
-						p_queue[current_consume_index].consume_awake_flag = false;
+	SHARD shards[SHARDS];
 
-						__AwakeProduct(current_consume_index);
+	inline void Add(unsigned int stat, unsigned long n = 1)
+	{
+		shards[__CasStatShard() & (SHARDS - 1)].counter[stat].fetch_add(n, std::memory_order_relaxed);
+	}
 
-						// 打开后门
-						__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
+	void Sum(unsigned long *counter)
+	{
+		for (unsigned int ii = 0; ii < CAS_STAT_COUNT; ++ii)
+		{
+			counter[ii] = 0;
+			for (unsigned int jj = 0; jj < SHARDS; ++jj)
+				counter[ii] += shards[jj].counter[ii].load(std::memory_order_relaxed);
+		}
+	}
+};
 
-						return;
-					}
-					else  // c_wait已经被生产者置为2（忽略），说明生产者已经生产完毕，但e_state不一定被及时置为2（满），需要进行轮询式判断
-					{
-loop_consume:
-						bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-						if (true == is_consume)
-						{
-							// 消费数据
-							t_consume = p_queue[current_consume_index].data;
-							p_queue[current_consume_index].c_wait = C_INIT;
-
-							__AwakeProduct(current_consume_index);
-
-							// 打开后门
-							__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
-
-							return;	
-						}
-						else  // 此种情况极少发生，一旦发生循环判断
-						{
-							goto loop_consume;
-						}
-					}
-				}
-			}
-			else  // 已经有消费者进入，继续获取entry位置
-			{
-				goto loop_entry_consume;
-			}
+/*
+ * 	【entry数组的内存分配策略，作为各队列类的最后一个模板参数】
+ *
+ * Allocate(bytes, align)	: 分配至少bytes字节、按align对齐的内存，失败时抛出std::bad_alloc
+ * Deallocate(p, bytes, align)	: 释放Allocate分配的内存，bytes、align与分配时相同
+ * IsZeroed()			: 分配出的内存是否已全部为0，为true时阻塞队列跳过控制字的初始化循环
+ *
+ * 使用者可以按同样的接口提供自己的策略，例如从预先分配好的内存池或者hugetlbfs文件中分配
+ */
+struct CasAllocNew
+{
+	inline void *Allocate(size_t bytes, size_t align)
+	{
+		return ::operator new(bytes, std::align_val_t(align));
+	}
+
+	inline void Deallocate(void *p, size_t bytes, size_t align)
+	{
+		::operator delete(p, std::align_val_t(align));
+	}
+
+	inline bool IsZeroed()
+	{
+		return false;
+	}
+};
+
+enum cas_page {CAS_PAGE_DEFAULT = 0, CAS_PAGE_2M = 21, CAS_PAGE_1G = 30};  // 页大小的对数，CAS_PAGE_DEFAULT为普通页
+enum cas_alloc {CAS_ALLOC_PREFAULT = 1, CAS_ALLOC_LOCK = 2};
+
+/*
+ * 	【mmap分配策略】
+ *
+ * PAGE		: CAS_PAGE_2M/CAS_PAGE_1G时使用MAP_HUGETLB大页，系统没有预留该大小的大页时退回普通页并建议内核使用透明大页
+ * NODE		: 不小于0时用mbind将内存绑定到该NUMA节点，在首次写入之前绑定
+ * FLAGS	: CAS_ALLOC_PREFAULT在构造时逐页写入，把缺页中断从热路径移到构造时；CAS_ALLOC_LOCK用mlock锁定内存不被换出，
+ *		  超出RLIMIT_MEMLOCK时mlock失败，忽略该错误
+ *
+ * 匿名映射的内存全部为0，阻塞队列构造时不再逐个初始化entry
+ */
+template <unsigned int PAGE = CAS_PAGE_2M, int NODE = -1, unsigned int FLAGS = CAS_ALLOC_PREFAULT>
+struct CasAllocMmap
+{
+	void *Allocate(size_t bytes, size_t align)
+	{
+		size_t length = __Length(bytes);
+		void *p = MAP_FAILED;
+		if (CAS_PAGE_DEFAULT != PAGE)
+			p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (PAGE << MAP_HUGE_SHIFT), -1, 0);
+
+		if (MAP_FAILED == p)
+		{
+			p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (MAP_FAILED == p)
+				throw std::bad_alloc();
+
+			if (CAS_PAGE_DEFAULT != PAGE)
+				madvise(p, length, MADV_HUGEPAGE);
 		}
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum front_door {FRONT_DOOR_OPEN = 0, FRONT_DOOR_CLOSE};
-		enum back_door {BACK_DOOR_OPEN = 0, BACK_DOOR_CLOSE};
-		enum product_wait {P_INIT = 0, P_WAIT, P_IGNORE};
-		enum consume_wait {C_INIT = 0, C_WAIT, C_IGNORE};
+		if constexpr (NODE >= 0)
+		{
+			unsigned long node_mask[NODE / 64 + 1] = {};
+			node_mask[NODE / 64] = 1UL << (NODE % 64);
+			syscall(SYS_mbind, p, length, MPOL_BIND, node_mask, sizeof(node_mask) * 8 + 1, 0);
+		}
 
-		/*每个队列由N个entry组成，每个entry的数据结构如下*/
-		typedef struct 
+		if (0 != (FLAGS & CAS_ALLOC_PREFAULT))
 		{
-			T data;  // 实际生产、消费的数据，可以为任意类型，对于复杂类型必须自己重置等于号操作符
+			size_t page_size = sysconf(_SC_PAGESIZE);
+			for (size_t offset = 0; offset < length; offset += page_size)
+				static_cast<volatile char *>(p)[offset] = 0;
+		}
 
-			/* 
-			 * 	【entry的四种状态】
-			 *
-			 * EMPTY	0: 表示entry为空可以生产
-			 * PRODUCT	1: 表示entry有生产者正在生产
-			 * FULL		2: 表示entry有数据可以消费
-			 * CONSUME	3: 表示有消费者正在消费
-			 *
-			 */
-			entry_state e_state;
+		if (0 != (FLAGS & CAS_ALLOC_LOCK))
+			mlock(p, length);
 
-			front_door f_door;	// 前门，防止多个生产者同时进入同一个entry，只有在多个生产者模式下此标识才有作用，因为有的生产者领先其它生产者套圈的情况出现
-			back_door b_door;	// 后门，防止多个消费者同时进入同一个entry，只有在多个消费者模式下此标识才有作用，因为有的消费者领先其它消费者套圈的情况出现
+		return p;
+	}
 
-			pthread_mutex_t product_mutex;
-			pthread_cond_t product_cond;	// 唤醒生产者条件变量
-			bool product_awake_flag;	// true：表示唤醒消费者
-			/*
-			 * 	【p_wait 表示生产者是否等待消费者唤醒，CAS阻塞队列的精髓】
-			 *
-			 * P_INIT	0: 初始值也即抢占值
-			 * P_WAIT	1: 生产者抢占成功后置，表示生产者需>要阻塞在该entry上等待消费者唤醒
-			 * P_IGNORE	2: 消费者抢占成功后置，表示忽略本次唤醒生产者
-			 *
-			 */
-			product_wait p_wait;
+	void Deallocate(void *p, size_t bytes, size_t align)
+	{
+		munmap(p, __Length(bytes));
+	}
 
-			pthread_mutex_t consume_mutex;
-			pthread_cond_t consume_cond;	// 唤醒消费者条件变量
-			bool consume_awake_flag;	// true：表示唤醒生产者
-			/*
-			 *	 【c_wait 表示消费者是否等待生产者唤醒，CAS阻塞队列的精髓】
-			 *
-			 * C_INIT	0: 初始值也即抢占值
-			 * C_WAIT	1: 消费者抢占成功后置，表示消费者需>要阻塞在该entry上等待生产者唤醒
-			 * C_IGNORE	2: 生产者抢占成功后置，表示忽略本次唤醒消费者
-			 */
-			consume_wait c_wait;
-		} ENTRY;
+	inline bool IsZeroed()
+	{
+		return true;
+	}
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
+	// 映射长度按页大小向上取整，退回普通页时也按同样的长度映射，释放时长度一致
+	static size_t __Length(size_t bytes)
+	{
+		size_t page_size = CAS_PAGE_DEFAULT != PAGE ? 1UL << PAGE : sysconf(_SC_PAGESIZE);
+		return (bytes + page_size - 1) & ~(page_size - 1);
+	}
+};
 
-		inline void __AwakeConsume(unsigned long __current_product_index)
-		{
-			// 判断是忽略消费者还是唤醒消费者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_product_index].c_wait, C_INIT, C_IGNORE);
-			if (true == is_ignore)  // 忽略消费者
-			{
-				__sync_lock_test_and_set(&p_queue[__current_product_index].e_state, FULL);
-			}
-			else  // 唤醒消费者
-			{			
-				p_queue[__current_product_index].e_state = FULL;
+typedef CasAllocMmap<CAS_PAGE_2M, -1, CAS_ALLOC_PREFAULT> CasAllocHuge;	// 2MB大页，构造时预先缺页
+typedef CasAllocMmap<CAS_PAGE_2M, -1, CAS_ALLOC_PREFAULT | CAS_ALLOC_LOCK> CasAllocHugeLocked;	// 2MB大页，预先缺页并锁定
 
-				pthread_mutex_lock(&p_queue[__current_product_index].consume_mutex);
-				p_queue[__current_product_index].consume_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_product_index].consume_cond);
-				pthread_mutex_unlock(&p_queue[__current_product_index].consume_mutex);
-			}
+// 数组至少按缓存行对齐
+template <class C>
+constexpr size_t __CasAllocAlign()
+{
+	return alignof(C) > 64 ? alignof(C) : 64;
+}
 
-			return;
-		}
+// 用分配策略分配count个C，C不是平凡默认构造时才逐个构造
+template <class C, class Alloc>
+inline C *__CasAllocArray(Alloc &allocator, unsigned long count)
+{
+	C *p = static_cast<C *>(allocator.Allocate(sizeof(C) * count, __CasAllocAlign<C>()));
+	if constexpr (false == std::is_trivially_default_constructible<C>::value)
+	{
+		for (unsigned long ii = 0; ii < count; ++ii)
+			new (&p[ii]) C;
+	}
+
+	return p;
+}
+
+template <class C, class Alloc>
+inline void __CasFreeArray(Alloc &allocator, C *p, unsigned long count)
+{
+	if (NULL != p)
+		allocator.Deallocate(p, sizeof(C) * count, __CasAllocAlign<C>());
+}
 
-		inline void __AwakeProduct(unsigned long __current_consume_index)
-		{
-			// 判断是忽略生产者还是唤醒生产者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_consume_index].p_wait, P_INIT, P_IGNORE);
-			if (true == is_ignore)  // 忽略生产者
-			{
-				__sync_lock_test_and_set(&p_queue[__current_consume_index].e_state, EMPTY);
-			}
-			else  // 唤醒生产者
-			{			
-				p_queue[__current_consume_index].e_state = EMPTY;
+// 多生产者时entry中的前门，单生产者时为空
+template <bool HAS_DOOR>
+struct __CasFrontDoor
+{
+	std::atomic<int> f_door;	// 前门，防止多个生产者同时进入同一个entry，因为有的生产者领先其它生产者套圈的情况出现
+};
 
-				pthread_mutex_lock(&p_queue[__current_consume_index].product_mutex);
-				p_queue[__current_consume_index].product_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_consume_index].product_cond);
-				pthread_mutex_unlock(&p_queue[__current_consume_index].product_mutex);
-			}
+template <>
+struct __CasFrontDoor<false> {};
 
-			return;
-		}
+// 多消费者时entry中的后门，单消费者时为空
+template <bool HAS_DOOR>
+struct __CasBackDoor
+{
+	std::atomic<int> b_door;	// 后门，防止多个消费者同时进入同一个entry，因为有的消费者领先其它消费者套圈的情况出现
 };
 
-// 多生产者单消费者阻塞队列
-template <class T>
-class CasQueueMPOC
+template <>
+struct __CasBackDoor<false> {};
+
+/*
+ * 	【阻塞队列】
+ *
+ * MP		: 是否多生产者，为false时生产索引不做原子操作，entry中没有前门
+ * MC		: 是否多消费者，为false时消费索引不做原子操作，entry中没有后门
+ * CAPACITY	: 编译期确定的entry个数(2的N次幂)，票号到entry下标的掩码为立即数；为0时由构造参数决定
+ *
+ */
+template <class T, bool MP, bool MC, unsigned int CAPACITY = 0, class Layout = CasLayoutCompact, class Wait = CasWaitPark, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+class __CasBlockQueue
 {
+	static_assert(0 == (CAPACITY & (CAPACITY - 1)), "CAPACITY must be 0 or a power of 2");
+
 	public:
-		CasQueueMPOC()
+		__CasBlockQueue()
 		{
-			size = 16384;
-			product_index = consume_index = 0;
+			size = 0 != CAPACITY ? CAPACITY : 16384;
+			__InitQueue();
+		}
 
-			p_queue = new ENTRY [size];
+		// 指定了CAPACITY时忽略queue_size
+		__CasBlockQueue(int queue_size)
+		{
+			size = 0 != CAPACITY ? CAPACITY : pow(2, (ceil(log2(queue_size))));
+			__InitQueue();
+		}
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+		virtual ~__CasBlockQueue()
+		{
+			// 析构队列中尚未被消费的数据
+			for (unsigned int ii = 0; ii < size; ++ii)
 			{
-				p_queue[ii].e_state = EMPTY;
+				if (FULL == p_queue[ii].e_state.load(std::memory_order_relaxed))
+					__Data(ii)->~T();
+			}
 
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
+			__CasFreeArray(allocator, p_queue, size);
+			__CasFreeArray(allocator, p_data, Layout::SPLIT ? size : 0);
+		}
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+		// 队列关闭后返回false
+		bool Product(const T &t_product)
+		{
+			return __Product(t_product);
+		}
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
-			}
+		bool Product(T &&t_product)
+		{
+			return __Product(std::move(t_product));
 		}
 
-		CasQueueMPOC(int queue_size)
+		// 在entry中就地构造数据，省去一次临时对象的构造和拷贝
+		template <class... Args>
+		bool Emplace(Args &&... args)
 		{
-			product_index = consume_index = 0;
+			return __Product(std::forward<Args>(args)...);
+		}
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
+		// 队列关闭后不再阻塞，取完剩余数据后返回false
+		bool Consume(T &t_consume)
+		{
+			if (true == __IsClosed())
+				return __DrainConsume(t_consume);
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
+			unsigned long current_consume_index = __NextConsume(1);
+			current_consume_index = __Slot(current_consume_index);
+			if (true == __ConsumeEntry(current_consume_index, t_consume))
+				return true;
 
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
+			return __DrainConsume(t_consume);  // 等待中队列关闭且该票号不会再有数据，继续取后面票号上的剩余数据
+		}
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+		// 只在当前票号对应的entry为空时生产，队列满或已关闭时立即返回false
+		template <class U>
+		bool TryProduct(U &&t_product)
+		{
+			unsigned long current_product_index;
+			if (true == __IsClosed() || 0 == __ClaimProduct(1, current_product_index))
+				return false;
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
-			}
+			return __ProductEntry(__Slot(current_product_index), std::forward<U>(t_product));
 		}
 
-		virtual ~CasQueueMPOC()
+		// 只在当前票号对应的entry有数据时消费，队列空时立即返回false
+		bool TryConsume(T &t_consume)
 		{
-			delete [] p_queue;
+			unsigned long current_consume_index;
+			if (0 == __ClaimConsume(1, current_consume_index))
+				return false;
+
+			return __ConsumeEntry(__Slot(current_consume_index), t_consume);
 		}
 
-		void Product(T &t_product)
+		// 限时生产，超时或队列关闭时返回false
+		template <class U, class Rep, class Period>
+		bool TryProductFor(U &&t_product, const std::chrono::duration<Rep, Period> &timeout)
 		{
-			unsigned long current_product_index = __sync_fetch_and_add(&product_index, 1);
-			current_product_index &= (size - 1);
+			return TryProductUntil(std::forward<U>(t_product), std::chrono::steady_clock::now() + timeout);
+		}
 
-loop_entry_product:
-			// 进前门
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN, FRONT_DOOR_CLOSE);
-			if (true == is_enter)
+		template <class U, class Clock, class Duration>
+		bool TryProductUntil(U &&t_product, const std::chrono::time_point<Clock, Duration> &deadline)
+		{
+			unsigned long current_product_index;
+			while (false == __IsClosed())
 			{
-				// 判断entry状态
-				bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-				if (true == is_product)
-				{
-					// 生产数据
-					p_queue[current_product_index].data = t_product;
-					p_queue[current_product_index].p_wait = P_INIT;
-
-					__AwakeConsume(current_product_index);
+				if (1 == __ClaimProduct(1, current_product_index))
+					return __ProductEntry(__Slot(current_product_index), std::forward<U>(t_product));
 
-					// 打开前门
-					__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
+				// 队列满时不领取票号，睡眠在队列级的等待字上，直到有消费者腾出entry
+				if (false == __SleepUntil(product_sleep, product_signal, product_index, EMPTY, deadline))
+					return false;
+			}
 
-					return;
-				}
-				else  // 该entry已经有数据 或 有消费者正在消费数据
-				{
-					bool is_wait = __sync_bool_compare_and_swap(&p_queue[current_product_index].p_wait, P_INIT, P_WAIT);
-					if (true == is_wait)  // 等待消费者唤醒
-					{
-						pthread_mutex_lock(&p_queue[current_product_index].product_mutex);
-						while (!p_queue[current_product_index].product_awake_flag)
-							pthread_cond_wait(&p_queue[current_product_index].product_cond, &p_queue[current_product_index].product_mutex);
-						pthread_mutex_unlock(&p_queue[current_product_index].product_mutex);
+			return false;
+		}
 
-						// 生产数据
-						p_queue[current_product_index].data = t_product;
-						p_queue[current_product_index].p_wait = P_INIT;
-						p_queue[current_product_index].product_awake_flag = false;
+		// 限时消费，超时或队列关闭且已无数据时返回false
+		template <class Rep, class Period>
+		bool TryConsumeFor(T &t_consume, const std::chrono::duration<Rep, Period> &timeout)
+		{
+			return TryConsumeUntil(t_consume, std::chrono::steady_clock::now() + timeout);
+		}
 
-						__AwakeConsume(current_product_index);
+		template <class Clock, class Duration>
+		bool TryConsumeUntil(T &t_consume, const std::chrono::time_point<Clock, Duration> &deadline)
+		{
+			unsigned long current_consume_index;
+			for (;;)
+			{
+				if (1 == __ClaimConsume(1, current_consume_index))
+					return __ConsumeEntry(__Slot(current_consume_index), t_consume);
 
-						// 打开前门
-						__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
+				if (true == __IsClosed())
+					return __DrainConsume(t_consume);
 
-						return;
-					}
-					else  // p_wait已经被消费者置为2（忽略），说明消费者已经消费完毕，但e_state不一定被及时置为0（空），需要进行轮询式判断
-					{
-loop_product:
-						bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-						if (true == is_product)
-						{
-							// 生产数据
-							p_queue[current_product_index].data = t_product;
-							p_queue[current_product_index].p_wait = P_INIT;
-
-							__AwakeConsume(current_product_index);
-
-							// 打开前门
-							__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
-
-							return;	
-						}
-						else  // 此种情况极少发生，一旦发生循环判断
-						{
-							goto loop_product;
-						}
-					}
-				}
-			}
-			else  // 已经有生产者进入，继续获取entry位置
-			{
-				goto loop_entry_product;
+				if (false == __SleepUntil(consume_sleep, consume_signal, consume_index, FULL, deadline))
+					return false;
 			}
 		}
 
-		void Consume(T &t_consume)
+		// 一次领取n个连续票号后逐个生产，多生产者时减少在product_index上的竞争，返回实际生产的个数，仅在队列关闭时小于n
+		unsigned long ProductBulk(const T *t_products, unsigned long n)
 		{
-			unsigned long current_consume_index = consume_index++;
-			current_consume_index &= (size - 1);
+			if (true == __IsClosed())
+				return 0;
 
-			// 判断entry状态
-			if (true == __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME))
-			{
-				// 消费数据
-				t_consume = p_queue[current_consume_index].data;
-				p_queue[current_consume_index].c_wait = C_INIT;
+			unsigned long current_product_index = __NextProduct(n);
+			unsigned long count = 0;
+			while (count < n && true == __ProductEntry(__Slot(current_product_index + count), t_products[count]))
+				++count;
 
-				__AwakeProduct(current_consume_index);
+			return count;
+		}
 
-				return;
-			}
-			else  // 该entry已经没有数据 或 有生产者正在生产数据
-			{
-				bool is_wait = __sync_bool_compare_and_swap(&p_queue[current_consume_index].c_wait, C_INIT, C_WAIT);
-				if (true == is_wait)  // 等待生产者唤醒
-				{
-					pthread_mutex_lock(&p_queue[current_consume_index].consume_mutex);
-					while (!p_queue[current_consume_index].consume_awake_flag)
-						pthread_cond_wait(&p_queue[current_consume_index].consume_cond, &p_queue[current_consume_index].consume_mutex);
-					pthread_mutex_unlock(&p_queue[current_consume_index].consume_mutex);
+		// 只领取从当前票号开始连续为空的entry，返回实际生产的个数，队列满或已关闭时返回0而不阻塞
+		unsigned long TryProductBulk(const T *t_products, unsigned long n)
+		{
+			unsigned long current_product_index;
+			if (true == __IsClosed())
+				return 0;
 
-					// 消费数据
-					t_consume = p_queue[current_consume_index].data;
-					p_queue[current_consume_index].c_wait = C_INIT;
-					p_queue[current_consume_index].consume_awake_flag = false;
+			// 领取时为空的entry可能被套圈的慢生产者先占用，之后队列关闭时放弃，与ProductBulk相同在第一个放弃的entry处停止
+			unsigned long claimed = __ClaimProduct(n, current_product_index);
+			unsigned long count = 0;
+			while (count < claimed && true == __ProductEntry(__Slot(current_product_index + count), t_products[count]))
+				++count;
 
-					__AwakeProduct(current_consume_index);
+			return count;
+		}
 
-					return;
-				}
-				else  // c_wait已经被生产者置为2（忽略），说明生产者已经生产完毕，但e_state不一定被及时置为2（满），需要进行轮询式判断
-				{
-loop_consume:
-					if (true == __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME))
-					{
-						// 消费数据
-						t_consume = p_queue[current_consume_index].data;
-						p_queue[current_consume_index].c_wait = C_INIT;
+		// 一次领取n个连续票号后逐个消费，阻塞直到消费满n个数据，队列关闭时返回实际消费的个数
+		unsigned long ConsumeBulk(T *t_consumes, unsigned long n)
+		{
+			if (true == __IsClosed())
+			{
+				unsigned long count = 0;
+				while (count < n && true == __DrainConsume(t_consumes[count]))
+					++count;
 
-						__AwakeProduct(current_consume_index);
+				return count;
+			}
 
-						return;
-					}
-					else  // 此种情况极少发生，一旦发生循环判断
-					{
-						goto loop_consume;
-					}
-				}
+			unsigned long current_consume_index = __NextConsume(n);
+			// 已领取的票号必须逐个处理完，放弃的entry不占用输出位置
+			unsigned long count = 0;
+			for (unsigned long ii = 0; ii < n; ++ii)
+			{
+				if (true == __ConsumeEntry(__Slot(current_consume_index + ii), t_consumes[count]))
+					++count;
 			}
+
+			// 有票号被放弃说明队列已关闭，用剩余的输出位置继续取后面票号上的数据
+			while (count < n && true == __DrainConsume(t_consumes[count]))
+				++count;
+
+			return count;
 		}
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum front_door {FRONT_DOOR_OPEN = 0, FRONT_DOOR_CLOSE};
-		enum product_wait {P_INIT = 0, P_WAIT, P_IGNORE};
-		enum consume_wait {C_INIT = 0, C_WAIT, C_IGNORE};
+		// 只领取从当前票号开始连续有数据的entry，返回实际消费的个数，队列空时返回0而不阻塞
+		unsigned long TryConsumeBulk(T *t_consumes, unsigned long max)
+		{
+			unsigned long current_consume_index;
+			// 领取时有数据的entry可能被套圈的慢消费者先取走，之后队列关闭时放弃，放弃的entry不占用输出位置
+			unsigned long claimed = __ClaimConsume(max, current_consume_index);
+			unsigned long count = 0;
+			for (unsigned long ii = 0; ii < claimed; ++ii)
+			{
+				if (true == __ConsumeEntry(__Slot(current_consume_index + ii), t_consumes[count]))
+					++count;
+			}
 
-		typedef struct 
+			return count;
+		}
+
+		/*
+		 * 领取一个entry供调用者直接写入，entry中的数据已默认构造（没有构造函数的简单类型不做初始化），写完后调用CommitProduct发布
+		 * 发布前该entry上的消费者一直等待，领取后必须尽快提交；队列已关闭时返回的slot无效
+		 */
+		CasSlot<T> ClaimProduct()
 		{
-			T data;
+			CasSlot<T> slot = {NULL, 0};
+			if (true == __IsClosed())
+				return slot;
 
-			entry_state e_state;
+			slot.index = __Slot(__NextProduct(1));
+			if (true == __EnterProduct(slot.index))
+				slot.p_data = new (__Data(slot.index)) T;
 
-			front_door f_door;
+			return slot;
+		}
 
-			pthread_mutex_t product_mutex;
-			pthread_cond_t product_cond;
-			bool product_awake_flag;  // true：表示生产者等待消费者唤醒，false：表示生产者已被消费者唤醒
-			product_wait p_wait;
+		// 只在当前票号对应的entry为空时领取，队列满或已关闭时返回的slot无效
+		CasSlot<T> TryClaimProduct()
+		{
+			CasSlot<T> slot = {NULL, 0};
+			unsigned long current_product_index;
+			if (true == __IsClosed() || 0 == __ClaimProduct(1, current_product_index))
+				return slot;
 
-			pthread_mutex_t consume_mutex;
-			pthread_cond_t consume_cond;
-			bool consume_awake_flag;  // true：表示消费者等待生产者唤醒，false：表示消费者已被生产者唤醒
-			consume_wait c_wait;
-		} ENTRY;
+			slot.index = __Slot(current_product_index);
+			if (true == __EnterProduct(slot.index))
+				slot.p_data = new (__Data(slot.index)) T;
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
+			return slot;
+		}
 
-		inline void __AwakeConsume(unsigned long __current_product_index)
+		// 发布ClaimProduct领取的entry，之后slot无效
+		void CommitProduct(CasSlot<T> &slot)
 		{
-			// 判断是忽略消费者还是唤醒消费者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_product_index].c_wait, C_INIT, C_IGNORE);
-			if (true == is_ignore)  // 忽略消费者
+			__LeaveProduct(slot.index);
+			slot.p_data = NULL;
+		}
+
+		// 领取一个有数据的entry供调用者直接读取，读完后调用ReleaseConsume归还；队列关闭且已无数据时返回的slot无效
+		CasSlot<T> ClaimConsume()
+		{
+			CasSlot<T> slot = {NULL, 0};
+			if (false == __IsClosed())
 			{
-				__sync_lock_test_and_set(&p_queue[__current_product_index].e_state, FULL);
+				slot.index = __Slot(__NextConsume(1));
+				if (true == __EnterConsume(slot.index))
+				{
+					slot.p_data = __Data(slot.index);
+					return slot;
+				}
 			}
-			else  // 唤醒消费者
-			{			
-				p_queue[__current_product_index].e_state = FULL;
 
-				pthread_mutex_lock(&p_queue[__current_product_index].consume_mutex);
-				p_queue[__current_product_index].consume_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_product_index].consume_cond);
-				pthread_mutex_unlock(&p_queue[__current_product_index].consume_mutex);
+			// 队列已关闭，与__DrainConsume相同，跳过生产者已放弃的票号
+			unsigned long current_consume_index;
+			while (true == __ClaimDrain(current_consume_index))
+			{
+				slot.index = __Slot(current_consume_index);
+				if (true == __EnterConsume(slot.index))
+				{
+					slot.p_data = __Data(slot.index);
+					break;
+				}
 			}
 
-			return;
+			return slot;
 		}
 
-		inline void __AwakeProduct(unsigned long __current_consume_index)
+		// 只在当前票号对应的entry有数据时领取，队列空时返回的slot无效
+		CasSlot<T> TryClaimConsume()
 		{
-			// 判断是忽略生产者还是唤醒生产者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_consume_index].p_wait, P_INIT, P_IGNORE);
-			if (true == is_ignore)  // 忽略生产者
-			{
-				__sync_lock_test_and_set(&p_queue[__current_consume_index].e_state, EMPTY);
-			}
-			else  // 唤醒生产者
-			{			
-				p_queue[__current_consume_index].e_state = EMPTY;
+			CasSlot<T> slot = {NULL, 0};
+			unsigned long current_consume_index;
+			if (0 == __ClaimConsume(1, current_consume_index))
+				return slot;
 
-				pthread_mutex_lock(&p_queue[__current_consume_index].product_mutex);
-				p_queue[__current_consume_index].product_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_consume_index].product_cond);
-				pthread_mutex_unlock(&p_queue[__current_consume_index].product_mutex);
-			}
+			slot.index = __Slot(current_consume_index);
+			if (true == __EnterConsume(slot.index))
+				slot.p_data = __Data(slot.index);
 
-			return;
+			return slot;
 		}
-};
 
-// 单生产者多消费者阻塞队列
-template <class T>
-class CasQueueOPMC
-{
-	public:
-		CasQueueOPMC()
+		// 析构entry中的数据并归还ClaimConsume领取的entry，之后slot无效
+		void ReleaseConsume(CasSlot<T> &slot)
 		{
-			size = 16384;
-			product_index = consume_index = 0;
+			slot.p_data->~T();
+			__LeaveConsume(slot.index);
+			slot.p_data = NULL;
+		}
 
-			p_queue = new ENTRY [size];
+		/*
+		 * 关闭队列，唤醒所有阻塞在entry上以及限时等待的生产者和消费者
+		 * 关闭后生产一律返回false，消费不再阻塞，取完剩余数据后返回false
+		 * 关闭前已领取票号的生产者在关闭后才进入entry时放弃；消费者关闭后依次领取到product_index为止，
+		 * 跳过放弃的票号，因此持续消费直到返回false时，每一个返回true的生产都会被消费
+		 */
+		void Close()
+		{
+			closed.store(1, std::memory_order_seq_cst);
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+			for (unsigned int ii = 0; ii < size; ++ii)
 			{
-				p_queue[ii].e_state = EMPTY;
+				if (true == __CasCompareSwap(p_queue[ii].p_wait, P_WAIT, P_CLOSE, std::memory_order_seq_cst) || true == __CasCompareSwap(p_queue[ii].p_wait, P_SLEEP, P_CLOSE, std::memory_order_seq_cst))
+					__CasFutexWake(&p_queue[ii].p_wait);
 
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+				if (true == __CasCompareSwap(p_queue[ii].c_wait, C_WAIT, C_CLOSE, std::memory_order_seq_cst) || true == __CasCompareSwap(p_queue[ii].c_wait, C_SLEEP, C_CLOSE, std::memory_order_seq_cst))
+					__CasFutexWake(&p_queue[ii].c_wait);
+			}
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+			__WakeSleepers(product_signal);
+			__WakeSleepers(consume_signal);
+		}
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
-			}
+		bool IsClosed()
+		{
+			return __IsClosed();
 		}
 
-		CasQueueOPMC(int queue_size)
+		// 近似的数据个数，生产者和消费者并发时只作为监控参考
+		unsigned long ApproxSize()
 		{
-			product_index = consume_index = 0;
+			long count = (long)(product_index.load(std::memory_order_relaxed) - consume_index.load(std::memory_order_relaxed));
+			if (count < 0)
+				return 0;  // 消费者领取票号后阻塞等待时消费索引领先生产索引
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
+			return count < (long)__Size() ? count : __Size();
+		}
+
+		// 运行状态快照，可由监控线程定期调用
+		void Snapshot(CasQueueStats &queue_stats)
+		{
+			stats.Sum(queue_stats.counter);
+			queue_stats.size = ApproxSize();
+			queue_stats.capacity = __Size();
+		}
+
+	private:
+		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
+		enum front_door {FRONT_DOOR_OPEN = 0, FRONT_DOOR_CLOSE};
+		enum back_door {BACK_DOOR_OPEN = 0, BACK_DOOR_CLOSE};
+		enum product_wait {P_INIT = 0, P_WAIT, P_IGNORE, P_AWAKE, P_CLOSE, P_SLEEP};
+		enum consume_wait {C_INIT = 0, C_WAIT, C_IGNORE, C_AWAKE, C_CLOSE, C_SLEEP};
+
+		/*每个队列由N个entry组成，每个entry的数据结构如下*/
+		typedef struct : __CasStorage<T, !Layout::SPLIT>, __CasFrontDoor<MP>, __CasBackDoor<MC>  // 非SPLIT布局时数据与控制字存放在同一个entry中，前门/后门只在多生产者/多消费者时存在
+		{
+
+			/*
+			 * 	【entry的四种状态】
+			 *
+			 * EMPTY	0: 表示entry为空可以生产
+			 * PRODUCT	1: 表示entry有生产者正在生产
+			 * FULL		2: 表示entry有数据可以消费
+			 * CONSUME	3: 表示有消费者正在消费
+			 *
+			 */
+			std::atomic<entry_state> e_state;
+
+			/*
+			 * 	【p_wait 表示生产者是否等待消费者唤醒，CAS阻塞队列的精髓】
+			 *
+			 * P_INIT	0: 初始值也即抢占值
+			 * P_WAIT	1: 生产者抢占成功后置，表示生产者需>要阻塞在该entry上等待消费者唤醒
+			 * P_IGNORE	2: 消费者抢占成功后置，表示忽略本次唤醒生产者
+			 * P_AWAKE	3: 消费者唤醒生产者时置，p_wait同时作为futex等待字，生产者阻塞在p_wait上
+			 * P_CLOSE	4: 队列关闭时由Close或生产者自己置，表示放弃等待
+			 * P_SLEEP	5: 生产者自旋结束准备挂起时由P_WAIT置，消费者只在此时才需要futex唤醒
+			 *
+			 */
+			std::atomic<product_wait> p_wait;
+
+			/*
+			 *	 【c_wait 表示消费者是否等待生产者唤醒，CAS阻塞队列的精髓】
+			 *
+			 * C_INIT	0: 初始值也即抢占值
+			 * C_WAIT	1: 消费者抢占成功后置，表示消费者需>要阻塞在该entry上等待生产者唤醒
+			 * C_IGNORE	2: 生产者抢占成功后置，表示忽略本次唤醒消费者
+			 * C_AWAKE	3: 生产者唤醒消费者时置，c_wait同时作为futex等待字，消费者阻塞在c_wait上
+			 * C_CLOSE	4: 队列关闭时由Close或消费者自己置，表示放弃等待
+			 * C_SLEEP	5: 消费者自旋结束准备挂起时由C_WAIT置，生产者只在此时才需要futex唤醒
+			 */
+			std::atomic<consume_wait> c_wait;
+		} ENTRY;
+
+		typedef __CasCell<ENTRY, Layout::ALIGN> CELL;
+		typedef __CasCell<__CasStorage<T>, Layout::ALIGN> DATA_CELL;
+
+		CELL *p_queue __attribute__((aligned(64)));
+		DATA_CELL *p_data;  // SPLIT布局时存放数据的数组，否则为NULL
+		unsigned int size __attribute__((aligned(64)));
+		Wait wait_strategy;  // 等待策略，自适应策略中保存最近的自旋上限
+		Stats stats;  // 统计策略，默认不统计
+		Alloc allocator;  // entry数组的内存分配策略
+		unsigned int scatter_bits;  // SCATTER布局时一个缓存行内entry个数的对数
+		unsigned int line_bits;  // SCATTER布局时缓存行个数的对数
+		std::atomic<unsigned long> product_index __attribute__((aligned(64)));
+		std::atomic<unsigned long> consume_index __attribute__((aligned(64)));
+		std::atomic<int> closed;  // 队列是否已关闭
+		std::atomic<unsigned int> product_sleep __attribute__((aligned(64)));  // 限时等待空entry的生产者个数
+		std::atomic<int> product_signal;  // 限时等待的生产者睡眠在该futex等待字上
+		std::atomic<unsigned int> consume_sleep __attribute__((aligned(64)));  // 限时等待数据的消费者个数
+		std::atomic<int> consume_signal;  // 限时等待的消费者睡眠在该futex等待字上
+
+		inline void __InitQueue()
+		{
+			product_index.store(0, std::memory_order_relaxed);
+			consume_index.store(0, std::memory_order_relaxed);
+			closed.store(0, std::memory_order_relaxed);
+			product_sleep.store(0, std::memory_order_relaxed);
+			product_signal.store(0, std::memory_order_relaxed);
+			consume_sleep.store(0, std::memory_order_relaxed);
+			consume_signal.store(0, std::memory_order_relaxed);
+
+			__AllocQueue();
+
+			// 所有控制字的初始值都为0，分配策略给出的内存已清零时不必逐个初始化
+			if (true == allocator.IsZeroed())
+				return;
 
 			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+			for (unsigned int ii = 0; ii < size; ++ii)
 			{
-				p_queue[ii].e_state = EMPTY;
+				p_queue[ii].e_state.store(EMPTY, std::memory_order_relaxed);
 
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+				if constexpr (MP)
+					p_queue[ii].f_door.store(FRONT_DOOR_OPEN, std::memory_order_relaxed);
+				if constexpr (MC)
+					p_queue[ii].b_door.store(BACK_DOOR_OPEN, std::memory_order_relaxed);
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+				p_queue[ii].p_wait.store(P_INIT, std::memory_order_relaxed);
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
+				p_queue[ii].c_wait.store(C_INIT, std::memory_order_relaxed);
 			}
 		}
 
-		virtual ~CasQueueOPMC()
+		inline void __AllocQueue()
 		{
-			delete [] p_queue;
+			p_queue = __CasAllocArray<CELL>(allocator, size);
+			p_data = Layout::SPLIT ? __CasAllocArray<DATA_CELL>(allocator, size) : NULL;
+
+			// 打散布局下一个缓存行内的K个entry对应的票号相隔size/K，相邻票号必然落在不同的缓存行
+			scatter_bits = 0;
+			line_bits = __builtin_ctz(size);
+			if (Layout::SCATTER)
+			{
+				unsigned int entry_bits = Layout::SPLIT ? __CasLineBits(sizeof(CELL) < sizeof(DATA_CELL) ? sizeof(CELL) : sizeof(DATA_CELL)) : __CasLineBits(sizeof(CELL));
+				scatter_bits = entry_bits < line_bits ? entry_bits : line_bits;
+				line_bits -= scatter_bits;
+			}
 		}
 
-		void Product(T &t_product)
+		// entry个数，指定了CAPACITY时为编译期常量
+		inline unsigned long __Size()
 		{
-			unsigned long current_product_index = product_index++;
-			current_product_index &= (size - 1);
+			return 0 != CAPACITY ? CAPACITY : size;
+		}
 
-			// 判断entry状态
-			if (true == __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT))
-			{
-				// 生产数据
-				p_queue[current_product_index].data = t_product;
-				p_queue[current_product_index].p_wait = P_INIT;
+		// 票号映射为entry下标
+		inline unsigned long __Slot(unsigned long __index)
+		{
+			__index &= (__Size() - 1);  // 代替取模操作提升性能，size必须为2的N次幂
+			if (Layout::SCATTER)
+				__index = ((__index & ((1UL << line_bits) - 1)) << scatter_bits) | (__index >> line_bits);
 
-				__AwakeConsume(current_product_index);
+			return __index;
+		}
 
-				return;
-			}
-			else  // 该entry已经有数据 或 有消费者正在消费数据
-			{
-				if (true == __sync_bool_compare_and_swap(&p_queue[current_product_index].p_wait, P_INIT, P_WAIT))
-				{
-					pthread_mutex_lock(&p_queue[current_product_index].product_mutex);
-					while (!p_queue[current_product_index].product_awake_flag)
-						pthread_cond_wait(&p_queue[current_product_index].product_cond, &p_queue[current_product_index].product_mutex);
-					pthread_mutex_unlock(&p_queue[current_product_index].product_mutex);
+		inline T *__Data(unsigned long __index)
+		{
+			return Layout::SPLIT ? p_data[__index].Get() : p_queue[__index].Get();
+		}
 
-					// 生产数据
-					p_queue[current_product_index].data = t_product;
-					p_queue[current_product_index].p_wait = P_INIT;
-					p_queue[current_product_index].product_awake_flag = false;
+		// 从票号__index开始连续为空的entry个数，最多n个
+		inline unsigned long __EmptyPrefix(unsigned long __index, unsigned long n)
+		{
+			unsigned long count = 0;
+			while (count < n && count < __Size() && EMPTY == p_queue[__Slot(__index + count)].e_state.load(std::memory_order_acquire))
+				++count;
 
-					__AwakeConsume(current_product_index);
+			return count;
+		}
 
-					return;
-				}
-				else  // p_wait已经被消费者置为2（忽略），说明消费者已经消费完毕，但e_state不一定被及时置为0（空），需要进行轮询式判断
-				{
-loop_product:
-					bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-					if (true == is_product)
-					{
-						// 生产数据
-						p_queue[current_product_index].data = t_product;
-						p_queue[current_product_index].p_wait = P_INIT;
+		// 从票号__index开始连续有数据的entry个数，最多n个
+		inline unsigned long __FullPrefix(unsigned long __index, unsigned long n)
+		{
+			unsigned long count = 0;
+			while (count < n && count < __Size() && FULL == p_queue[__Slot(__index + count)].e_state.load(std::memory_order_acquire))
+				++count;
 
-						__AwakeConsume(current_product_index);
+			return count;
+		}
 
-						return;
-					}
-					else  // 此种情况极少发生，一旦发生循环判断
-					{
-						goto loop_product;
-					}
-				}
-			}
+		// 等待者在自己的等待字上登记后用seq_cst读，与Close先写closed再检查等待字构成全序，不会错过关闭
+		inline bool __IsClosed(std::memory_order order = std::memory_order_acquire)
+		{
+			return 0 != closed.load(order);
 		}
 
-		void Consume(T &t_consume)
+		// 领取n个连续的生产票号，返回第一个；product_index利用unsigned long达到最大值后循环归零的特性递增，多生产者时原子性分配
+		inline unsigned long __NextProduct(unsigned long n)
 		{
-			unsigned long current_consume_index = __sync_fetch_and_add(&consume_index, 1);
-			current_consume_index &= (size - 1);
+			__CAS_FUZZ_POINT();
+			if constexpr (MP)
+				return product_index.fetch_add(n, std::memory_order_relaxed);  // 票号只用于分配entry，数据的可见性由entry状态保证
 
-loop_entry_consume:  // 防止多个消费者时，有些消费者速度快甩其它消费者一圈后与速度慢的消费者进入了同一个entry，此时快的消费者必须轮询等待慢的消费者消费完毕，而不能越过该entry
-			// 进后门
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN, BACK_DOOR_CLOSE);
-			if (true == is_enter)
-			{
-				// 判断entry状态
-				bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-				if (true == is_consume)
-				{
-					// 消费数据
-					t_consume = p_queue[current_consume_index].data;
-					p_queue[current_consume_index].c_wait = C_INIT;
+			unsigned long current_product_index = product_index.load(std::memory_order_relaxed);
+			product_index.store(current_product_index + n, std::memory_order_relaxed);
+			return current_product_index;
+		}
 
-					__AwakeProduct(current_consume_index);
+		// 领取n个连续的消费票号，返回第一个
+		inline unsigned long __NextConsume(unsigned long n)
+		{
+			__CAS_FUZZ_POINT();
+			if constexpr (MC)
+				return consume_index.fetch_add(n, std::memory_order_relaxed);
 
-					// 打开后门
-					__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
+			unsigned long current_consume_index = consume_index.load(std::memory_order_relaxed);
+			consume_index.store(current_consume_index + n, std::memory_order_relaxed);
+			return current_consume_index;
+		}
 
-					return;
+		// 领取从当前票号开始连续为空的entry，最多n个，返回领取的个数，first为第一个票号
+		inline unsigned long __ClaimProduct(unsigned long n, unsigned long &first)
+		{
+			unsigned long count;
+			for (;;)
+			{
+				first = product_index.load(std::memory_order_relaxed);
+				count = __EmptyPrefix(first, n);
+				if (0 == count)
+				{
+					stats.Add(CAS_STAT_PRODUCT_FULL);
+					return 0;
 				}
-				else  // 该entry已经没有数据 或 有生产者正在生产数据
+
+				if constexpr (false == MP)
 				{
-					bool is_wait = __sync_bool_compare_and_swap(&p_queue[current_consume_index].c_wait, C_INIT, C_WAIT);
-					if (true == is_wait)  // 等待生产者唤醒
-					{
-						pthread_mutex_lock(&p_queue[current_consume_index].consume_mutex);
-						while (!p_queue[current_consume_index].consume_awake_flag)
-							pthread_cond_wait(&p_queue[current_consume_index].consume_cond, &p_queue[current_consume_index].consume_mutex);
-						pthread_mutex_unlock(&p_queue[current_consume_index].consume_mutex);
+					product_index.store(first + count, std::memory_order_relaxed);
+					break;
+				}
+				else if (true == __CasCompareSwap(product_index, first, first + count, std::memory_order_relaxed))
+					break;
 
-						// 消费数据
-						t_consume = p_queue[current_consume_index].data;
-						p_queue[current_consume_index].c_wait = C_INIT;
-						p_queue[current_consume_index].consume_awake_flag = false;
+				stats.Add(CAS_STAT_PRODUCT_CAS);  // 被其它生产者抢先
+			}
 
-						__AwakeProduct(current_consume_index);
+			return count;
+		}
 
-						// 打开后门
-						__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
+		// 领取从当前票号开始连续有数据的entry，最多n个，返回领取的个数，first为第一个票号
+		inline unsigned long __ClaimConsume(unsigned long n, unsigned long &first)
+		{
+			unsigned long count;
+			for (;;)
+			{
+				first = consume_index.load(std::memory_order_relaxed);
+				count = __FullPrefix(first, n);
+				if (0 == count)
+				{
+					stats.Add(CAS_STAT_CONSUME_EMPTY);
+					return 0;
+				}
 
-						return;
-					}
-					else  // c_wait已经被生产者置为2（忽略），说明生产者已经生产完毕，但e_state不一定被及时置为2（满），需要进行轮询式判断
-					{
-loop_consume:
-						bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-						if (true == is_consume)
-						{
-							// 消费数据
-							t_consume = p_queue[current_consume_index].data;
-							p_queue[current_consume_index].c_wait = C_INIT;
-
-							__AwakeProduct(current_consume_index);
-
-							// 打开后门
-							__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
-
-							return;	
-						}
-						else  // 此种情况极少发生，一旦发生循环判断
-						{
-							goto loop_consume;
-						}
-					}
+				if constexpr (false == MC)
+				{
+					consume_index.store(first + count, std::memory_order_relaxed);
+					break;
 				}
+				else if (true == __CasCompareSwap(consume_index, first, first + count, std::memory_order_relaxed))
+					break;
+
+				stats.Add(CAS_STAT_CONSUME_CAS);  // 被其它消费者抢先
 			}
-			else  // 已经有消费者进入，继续获取entry位置
-			{
-				goto loop_entry_consume;
-			}
-		}
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum back_door {BACK_DOOR_OPEN = 0, BACK_DOOR_CLOSE};
-		enum product_wait {P_INIT = 0, P_WAIT, P_IGNORE};
-		enum consume_wait {C_INIT = 0, C_WAIT, C_IGNORE};
+			return count;
+		}
 
-		typedef struct 
+		// 队列关闭后领取一个生产者已领取的票号，不要求entry已有数据，已领取到product_index时返回false
+		inline bool __ClaimDrain(unsigned long &first)
 		{
-			T data;
-
-			entry_state e_state;
+			for (;;)
+			{
+				first = consume_index.load(std::memory_order_relaxed);
+				if ((long)(product_index.load(std::memory_order_seq_cst) - first) <= 0)
+					return false;
 
-			back_door b_door;
+				if constexpr (false == MC)
+				{
+					consume_index.store(first + 1, std::memory_order_relaxed);
+					return true;
+				}
+				else if (true == __CasCompareSwap(consume_index, first, first + 1, std::memory_order_relaxed))
+					return true;
 
-			pthread_mutex_t product_mutex;
-			pthread_cond_t product_cond;
-			bool product_awake_flag;  // true：表示生产者等待消费者唤醒，false：表示生产者已被消费者唤醒
-			product_wait p_wait;
+				stats.Add(CAS_STAT_CONSUME_CAS);
+			}
+		}
 
-			pthread_mutex_t consume_mutex;
-			pthread_cond_t consume_cond;
-			bool consume_awake_flag;  // true：表示消费者等待生产者唤醒，false：表示消费者已被生产者唤醒
-			consume_wait c_wait;
-		} ENTRY;
+		/*
+		 * 队列关闭后的消费：生产者放弃的票号对应的entry一直为空，只按有数据的前缀领取会停在这样的空洞前，
+		 * 之后的票号上已生产的数据无人消费，因此逐个领取到product_index，entry上没有生产者时放弃该票号继续下一个
+		 */
+		bool __DrainConsume(T &t_consume)
+		{
+			unsigned long current_consume_index;
+			while (true == __ClaimDrain(current_consume_index))
+			{
+				if (true == __ConsumeEntry(__Slot(current_consume_index), t_consume))
+					return true;
+			}
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
+			return false;
+		}
 
-		inline void __AwakeConsume(unsigned long __current_product_index)
+		// 限时等待者睡眠在队列级的等待字signal上，返回false表示已超时
+		template <class Clock, class Duration>
+		inline bool __SleepUntil(std::atomic<unsigned int> &sleep, std::atomic<int> &signal, std::atomic<unsigned long> &index, entry_state state, const std::chrono::time_point<Clock, Duration> &deadline)
 		{
-			// 判断是忽略消费者还是唤醒消费者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_product_index].c_wait, C_INIT, C_IGNORE);
-			if (true == is_ignore)  // 忽略消费者
+			sleep.fetch_add(1, std::memory_order_seq_cst);
+			int current_signal = signal.load(std::memory_order_acquire);
+
+			// 登记睡眠后再检查一次entry，避免在检查与睡眠之间错过唤醒；与唤醒方先写entry状态再读sleep构成全序
+			unsigned long current_index = __Slot(index.load(std::memory_order_relaxed));
+			bool is_ready = state == p_queue[current_index].e_state.load(std::memory_order_seq_cst) || true == __IsClosed(std::memory_order_seq_cst);
+			bool is_wake = is_ready;
+			if (false == is_wake)
 			{
-				__sync_lock_test_and_set(&p_queue[__current_product_index].e_state, FULL);
+				stats.Add(CAS_STAT_PARK);
+				is_wake = __CasFutexWaitUntil(&signal, current_signal, deadline);
 			}
-			else  // 唤醒消费者
-			{			
-				p_queue[__current_product_index].e_state = FULL;
 
-				pthread_mutex_lock(&p_queue[__current_product_index].consume_mutex);
-				p_queue[__current_product_index].consume_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_product_index].consume_cond);
-				pthread_mutex_unlock(&p_queue[__current_product_index].consume_mutex);
-			}
+			sleep.fetch_sub(1, std::memory_order_relaxed);
+			return is_wake;
+		}
 
-			return;
+		// 唤醒所有睡眠在等待字signal上的限时等待者
+		inline void __WakeSleepers(std::atomic<int> &signal)
+		{
+			stats.Add(CAS_STAT_WAKE);
+			signal.fetch_add(1, std::memory_order_release);
+			__CasFutexWake(&signal, INT_MAX);
 		}
 
-		inline void __AwakeProduct(unsigned long __current_consume_index)
+		// 将数据移出entry并析构entry中的对象
+		inline void __Take(unsigned long __index, T &t_consume)
 		{
-			// 判断是忽略生产者还是唤醒生产者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_consume_index].p_wait, P_INIT, P_IGNORE);
-			if (true == is_ignore)  // 忽略生产者
-			{
-				p_queue[__current_consume_index].e_state = EMPTY;
-			}
-			else  // 唤醒生产者
-			{			
-				__sync_lock_test_and_set(&p_queue[__current_consume_index].e_state, EMPTY);
+			T *p_data = __Data(__index);
+			t_consume = std::move(*p_data);
+			p_data->~T();
+		}
 
-				pthread_mutex_lock(&p_queue[__current_consume_index].product_mutex);
-				p_queue[__current_consume_index].product_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_consume_index].product_cond);
-				pthread_mutex_unlock(&p_queue[__current_consume_index].product_mutex);
-			}
+		template <class... Args>
+		bool __Product(Args &&... args)
+		{
+			if (true == __IsClosed())
+				return false;
 
-			return;
+			unsigned long current_product_index = __NextProduct(1);
+			current_product_index = __Slot(current_product_index);
+			return __ProductEntry(current_product_index, std::forward<Args>(args)...);
 		}
-};
 
-// 单生产者单消费者阻塞队列
-template <class T>
-class CasQueueOPOC
-{
-	public:
-		CasQueueOPOC()
+		// 在已领取票号对应的entry上生产数据
+		template <class... Args>
+		bool __ProductEntry(unsigned long current_product_index, Args &&... args)
 		{
-			size = 16384;
-			product_index = consume_index = 0;
+			if (false == __EnterProduct(current_product_index))
+				return false;
 
-			p_queue = new ENTRY [size];
+			// 生产数据
+			new (__Data(current_product_index)) T(std::forward<Args>(args)...);
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
+			__LeaveProduct(current_product_index);
+			return true;
+		}
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+		// 在已领取票号对应的entry上消费数据
+		bool __ConsumeEntry(unsigned long current_consume_index, T &t_consume)
+		{
+			if (false == __EnterConsume(current_consume_index))
+				return false;
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
-			}
+			// 消费数据
+			__Take(current_consume_index, t_consume);
+
+			__LeaveConsume(current_consume_index);
+			return true;
 		}
 
-		CasQueueOPOC(int queue_size)
+		// 进入entry并等到entry为空，之后可以在entry中写数据，队列已关闭时返回false
+		inline bool __EnterProduct(unsigned long current_product_index)
 		{
-			product_index = consume_index = 0;
+			unsigned int spin = 0;  // 轮询次数，由等待策略决定pause还是让出CPU
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
+			// 多生产者时，有些生产者速度快甩其它生产者一圈后与速度慢的生产者进入了同一个entry，此时快的生产者必须轮询等待慢的生产者生产完毕，而不能越过该entry，如果越过该entry可能导致在该entry的消费者永远阻塞
+			if constexpr (MP)
+			{
+				// 生产者进前门，已经有生产者进入时继续轮询
+				while (false == __CasCompareSwap(p_queue[current_product_index].f_door, FRONT_DOOR_OPEN, FRONT_DOOR_CLOSE, std::memory_order_acquire))
+				{
+					stats.Add(CAS_STAT_PRODUCT_LAP);
+					wait_strategy.Relax(spin++);
+				}
+			}
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+			// 判断entry状态，如果为空则置为生产状态
+			if (false == __CasCompareSwap(p_queue[current_product_index].e_state, EMPTY, PRODUCT, std::memory_order_seq_cst))
 			{
-				p_queue[ii].e_state = EMPTY;
+				// 该entry已经有数据 或 有消费者正在消费数据
+				if (true == __CasCompareSwap(p_queue[current_product_index].p_wait, P_INIT, P_WAIT, std::memory_order_seq_cst))  // 等待消费者唤醒
+				{
+					if (false == __WaitProduct(current_product_index))  // 队列已关闭，放弃生产
+					{
+						__OpenFrontDoor(current_product_index);
+						return false;
+					}
 
-				pthread_mutex_init(&p_queue[ii].product_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].product_cond, NULL);
-				p_queue[ii].product_awake_flag = false;
-				p_queue[ii].p_wait = P_INIT;
+					// 消费者已将entry置为EMPTY后唤醒，此时只有本生产者会改变e_state
+					p_queue[current_product_index].e_state.store(PRODUCT, std::memory_order_seq_cst);
+				}
+				else  // p_wait已经被消费者置为P_IGNORE，说明消费者已经消费完毕，但e_state不一定被及时置为EMPTY，需要进行轮询式判断
+				{
+					while (false == __CasCompareSwap(p_queue[current_product_index].e_state, EMPTY, PRODUCT, std::memory_order_seq_cst))  // 此种情况极少发生
+					{
+						stats.Add(CAS_STAT_PRODUCT_RETRY);
+						wait_strategy.Relax(spin++);
+					}
+				}
+			}
 
-				pthread_mutex_init(&p_queue[ii].consume_mutex, NULL);
-				pthread_cond_init(&p_queue[ii].consume_cond, NULL);
-				p_queue[ii].consume_awake_flag = false;
-				p_queue[ii].c_wait = C_INIT;
+			/*
+			 * 置为PRODUCT后再检查一次关闭，与消费者因关闭放弃前在__CloseConsume中读e_state构成全序：
+			 * 要么消费者看到PRODUCT并等待本次生产完毕，要么这里看到关闭后还原entry并放弃，不会出现生产成功而消费者已离开
+			 */
+			if (true == __IsClosed(std::memory_order_seq_cst))
+			{
+				p_queue[current_product_index].p_wait.store(P_INIT, std::memory_order_relaxed);
+				p_queue[current_product_index].e_state.store(EMPTY, std::memory_order_release);
+				__OpenFrontDoor(current_product_index);
+				return false;
 			}
-		}
 
-		virtual ~CasQueueOPOC()
-		{
-			delete [] p_queue;
+			return true;
 		}
 
-		void Product(T &t_product)
+		// entry中的数据已写好，发布数据并离开entry
+		inline void __LeaveProduct(unsigned long current_product_index)
 		{
-			unsigned long current_product_index = product_index++;
-			current_product_index &= (size - 1);
-
-			// 判断entry状态
-			if (true == __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT))
-			{
-				// 生产数据
-				p_queue[current_product_index].data = t_product;
-				p_queue[current_product_index].p_wait = P_INIT;
+			p_queue[current_product_index].p_wait.store(P_INIT, std::memory_order_relaxed);  // 每次生产完数据需要将p_wait初始化，由之后发布entry状态的写带给消费者
 
-				__AwakeConsume(current_product_index);
+			__AwakeConsume(current_product_index);  // 判断是否唤醒消费者
 
-				return;
-			}
-			else  // 该entry已经有数据 或 有消费者正在消费数据
-			{
-				if (true == __sync_bool_compare_and_swap(&p_queue[current_product_index].p_wait, P_INIT, P_WAIT))
-				{
-					pthread_mutex_lock(&p_queue[current_product_index].product_mutex);
-					while (!p_queue[current_product_index].product_awake_flag)
-						pthread_cond_wait(&p_queue[current_product_index].product_cond, &p_queue[current_product_index].product_mutex);
-					pthread_mutex_unlock(&p_queue[current_product_index].product_mutex);
+			__OpenFrontDoor(current_product_index);
 
-					// 生产数据
-					p_queue[current_product_index].data = t_product;
-					p_queue[current_product_index].p_wait = P_INIT;
-					p_queue[current_product_index].product_awake_flag = false;
+			stats.Add(CAS_STAT_PRODUCT);
+		}
 
-					__AwakeConsume(current_product_index);
+		// 进入entry并等到entry有数据，之后可以读entry中的数据，队列已关闭且该entry不会再有数据时返回false
+		inline bool __EnterConsume(unsigned long current_consume_index)
+		{
+			unsigned int spin = 0;  // 轮询次数，由等待策略决定pause还是让出CPU
 
-					return;
+			// 多消费者时，有些消费者速度快甩其它消费者一圈后与速度慢的消费者进入了同一个entry，此时快的消费者必须轮询等待慢的消费者消费完毕，而不能越过该entry
+			if constexpr (MC)
+			{
+				// 进后门，已经有消费者进入时继续轮询
+				while (false == __CasCompareSwap(p_queue[current_consume_index].b_door, BACK_DOOR_OPEN, BACK_DOOR_CLOSE, std::memory_order_acquire))
+				{
+					stats.Add(CAS_STAT_CONSUME_LAP);
+					wait_strategy.Relax(spin++);
 				}
-				else  // p_wait已经被消费者置为2（忽略），说明消费者已经消费完毕，但e_state不一定被及时置为0（空），需要进行轮询式判断
+			}
+
+			// 判断entry状态
+			if (false == __CasCompareSwap(p_queue[current_consume_index].e_state, FULL, CONSUME, std::memory_order_acquire))
+			{
+				// 该entry已经没有数据 或 有生产者正在生产数据
+				if (true == __CasCompareSwap(p_queue[current_consume_index].c_wait, C_INIT, C_WAIT, std::memory_order_seq_cst))  // 等待生产者唤醒
 				{
-loop_product:
-					bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-					if (true == is_product)
+					if (false == __WaitConsume(current_consume_index) && false == __CloseConsume(current_consume_index))  // 队列已关闭且该entry不会再有数据，放弃消费
 					{
-						// 生产数据
-						p_queue[current_product_index].data = t_product;
-						p_queue[current_product_index].p_wait = P_INIT;
-
-						__AwakeConsume(current_product_index);
-
-						return;
+						__OpenBackDoor(current_consume_index);
+						return false;
 					}
-					else  // 此种情况极少发生，一旦发生循环判断
+				}
+				else  // c_wait已经被生产者置为C_IGNORE，说明生产者已经生产完毕，但e_state不一定被及时置为FULL，需要进行轮询式判断
+				{
+					while (false == __CasCompareSwap(p_queue[current_consume_index].e_state, FULL, CONSUME, std::memory_order_acquire))  // 此种情况极少发生
 					{
-						goto loop_product;
+						stats.Add(CAS_STAT_CONSUME_RETRY);
+						wait_strategy.Relax(spin++);
 					}
 				}
 			}
+
+			return true;
 		}
 
-		void Consume(T &t_consume)
+		// entry中的数据已取走并析构，归还entry并离开
+		inline void __LeaveConsume(unsigned long current_consume_index)
 		{
-			unsigned long current_consume_index = consume_index++;
-			current_consume_index &= (size - 1);
-
-			// 判断entry状态
-			if (true == __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME))
-			{
-				// 消费数据
-				t_consume = p_queue[current_consume_index].data;
-				p_queue[current_consume_index].c_wait = C_INIT;
+			p_queue[current_consume_index].c_wait.store(C_INIT, std::memory_order_relaxed);
 
-				__AwakeProduct(current_consume_index);
+			__AwakeProduct(current_consume_index);
 
-				return;
-			}
-			else  // 该entry已经没有数据 或 有生产者正在生产数据
-			{
-				bool is_wait = __sync_bool_compare_and_swap(&p_queue[current_consume_index].c_wait, C_INIT, C_WAIT);
-				if (true == is_wait)  // 等待生产者唤醒
-				{
-					pthread_mutex_lock(&p_queue[current_consume_index].consume_mutex);
-					while (!p_queue[current_consume_index].consume_awake_flag)
-						pthread_cond_wait(&p_queue[current_consume_index].consume_cond, &p_queue[current_consume_index].consume_mutex);
-					pthread_mutex_unlock(&p_queue[current_consume_index].consume_mutex);
+			__OpenBackDoor(current_consume_index);
 
-					// 消费数据
-					t_consume = p_queue[current_consume_index].data;
-					p_queue[current_consume_index].c_wait = C_INIT;
-					p_queue[current_consume_index].consume_awake_flag = false;
+			stats.Add(CAS_STAT_CONSUME);
+		}
 
-					__AwakeProduct(current_consume_index);
+		// 打开前门，release写把entry上的操作交给套圈后进门的生产者
+		inline void __OpenFrontDoor(unsigned long __index)
+		{
+			if constexpr (MP)
+				p_queue[__index].f_door.store(FRONT_DOOR_OPEN, std::memory_order_release);
+		}
 
-					return;
-				}
-				else  // c_wait已经被生产者置为2（忽略），说明生产者已经生产完毕，但e_state不一定被及时置为2（满），需要进行轮询式判断
-				{
-loop_consume:
-					bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-					if (true == is_consume)
-					{
-						// 消费数据
-						t_consume = p_queue[current_consume_index].data;
-						p_queue[current_consume_index].c_wait = C_INIT;
+		// 打开后门
+		inline void __OpenBackDoor(unsigned long __index)
+		{
+			if constexpr (MC)
+				p_queue[__index].b_door.store(BACK_DOOR_OPEN, std::memory_order_release);
+		}
 
-						__AwakeProduct(current_consume_index);
+		/*
+		 * 等待消费者唤醒：先按等待策略自旋，策略要求挂起时将p_wait由P_WAIT置为P_SLEEP后在futex上挂起，
+		 * 消费者只有看到P_SLEEP时才需要调用futex唤醒。p_wait本身即为futex等待字，不会丢失唤醒
+		 * 队列关闭时返回false，Close与等待者都是先写后读，至少有一方能看到对方，因此也不会错过关闭
+		 */
+		inline bool __WaitProduct(unsigned long __index)
+		{
+			stats.Add(CAS_STAT_PRODUCT_WAIT);
 
-						return;
-					}
-					else  // 此种情况极少发生，一旦发生循环判断
-					{
-						goto loop_consume;
-					}
+			std::atomic<product_wait> &p_wait = p_queue[__index].p_wait;
+			unsigned int spin = 0;
+			bool is_park = false;
+			for (;;)
+			{
+				product_wait current_wait = p_wait.load(std::memory_order_acquire);
+				if (P_WAIT != current_wait && P_SLEEP != current_wait)
+					break;
+
+				if (true == __IsClosed(std::memory_order_seq_cst))
+					__CasCompareSwap(p_wait, current_wait, P_CLOSE, std::memory_order_relaxed);
+				else if (true == wait_strategy.Spin(spin++))
+					continue;
+				else if (P_SLEEP == current_wait || true == __CasCompareSwap(p_wait, P_WAIT, P_SLEEP, std::memory_order_relaxed))
+				{
+					is_park = true;
+					stats.Add(CAS_STAT_PARK);
+					__CasFutexWait(&p_wait, P_SLEEP);
 				}
 			}
-		}
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum product_wait {P_INIT = 0, P_WAIT, P_IGNORE};
-		enum consume_wait {C_INIT = 0, C_WAIT, C_IGNORE};
+			wait_strategy.Done(spin, is_park);
+			stats.Add(CAS_STAT_SPIN, spin);
+
+			// 还原p_wait后放弃该entry，若还原前消费者已经置为P_AWAKE则entry已空，照常生产，失败时的acquire读保证看到消费者取走数据
+			return false == __CasCompareSwap(p_wait, P_CLOSE, P_INIT, std::memory_order_acquire);
+		}
 
-		typedef struct 
+		// 等待生产者唤醒，过程与__WaitProduct相同，队列关闭时返回false
+		inline bool __WaitConsume(unsigned long __index)
 		{
-			T data;
+			stats.Add(CAS_STAT_CONSUME_WAIT);
+
+			std::atomic<consume_wait> &c_wait = p_queue[__index].c_wait;
+			unsigned int spin = 0;
+			bool is_park = false;
+			for (;;)
+			{
+				consume_wait current_wait = c_wait.load(std::memory_order_acquire);
+				if (C_WAIT != current_wait && C_SLEEP != current_wait)
+					break;
+
+				if (true == __IsClosed(std::memory_order_seq_cst))
+					__CasCompareSwap(c_wait, current_wait, C_CLOSE, std::memory_order_relaxed);
+				else if (true == wait_strategy.Spin(spin++))
+					continue;
+				else if (C_SLEEP == current_wait || true == __CasCompareSwap(c_wait, C_WAIT, C_SLEEP, std::memory_order_relaxed))
+				{
+					is_park = true;
+					stats.Add(CAS_STAT_PARK);
+					__CasFutexWait(&c_wait, C_SLEEP);
+				}
+			}
 
-			entry_state e_state;
+			wait_strategy.Done(spin, is_park);
+			stats.Add(CAS_STAT_SPIN, spin);
 
-			pthread_mutex_t product_mutex;
-			pthread_cond_t product_cond;
-			bool product_awake_flag;  // true：表示生产者等待消费者唤醒，false：表示生产者已被消费者唤醒
-			product_wait p_wait;
+			return false == __CasCompareSwap(c_wait, C_CLOSE, C_INIT, std::memory_order_acquire);
+		}
 
-			pthread_mutex_t consume_mutex;
-			pthread_cond_t consume_cond;
-			bool consume_awake_flag;  // true：表示消费者等待生产者唤醒，false：表示消费者已被生产者唤醒
-			consume_wait c_wait;
-		} ENTRY;
+		// 消费者因关闭放弃等待后，若生产者正在该entry上生产则等其生产完毕后照常消费，生产者看到关闭而放弃时entry还原为EMPTY
+		inline bool __CloseConsume(unsigned long __index)
+		{
+			while (PRODUCT == p_queue[__index].e_state.load(std::memory_order_seq_cst))
+				__CasCpuRelax();
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
+			return __CasCompareSwap(p_queue[__index].e_state, FULL, CONSUME, std::memory_order_acquire);
+		}
 
 		inline void __AwakeConsume(unsigned long __current_product_index)
 		{
 			// 判断是忽略消费者还是唤醒消费者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_product_index].c_wait, C_INIT, C_IGNORE);
+			bool is_ignore = __CasCompareSwap(p_queue[__current_product_index].c_wait, C_INIT, C_IGNORE, std::memory_order_relaxed);
 			if (true == is_ignore)  // 忽略消费者
 			{
-				__sync_lock_test_and_set(&p_queue[__current_product_index].e_state, FULL);
+				p_queue[__current_product_index].e_state.store(FULL, std::memory_order_seq_cst);
 			}
 			else  // 唤醒消费者
-			{			
-				p_queue[__current_product_index].e_state = FULL;
+			{
+				p_queue[__current_product_index].e_state.store(FULL, std::memory_order_seq_cst);
 
-				pthread_mutex_lock(&p_queue[__current_product_index].consume_mutex);
-				p_queue[__current_product_index].consume_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_product_index].consume_cond);
-				pthread_mutex_unlock(&p_queue[__current_product_index].consume_mutex);
+				// 将c_wait置为C_AWAKE，消费者已经挂起时才通过futex唤醒，仍在自旋的消费者会自行看到C_AWAKE
+				__CAS_FUZZ_POINT();
+				if (C_SLEEP == p_queue[__current_product_index].c_wait.exchange(C_AWAKE, std::memory_order_release))
+				{
+					stats.Add(CAS_STAT_WAKE);
+					__CasFutexWake(&p_queue[__current_product_index].c_wait);
+				}
 			}
 
-			return;
+			// 唤醒限时等待的消费者
+			if (0 != consume_sleep.load(std::memory_order_seq_cst))
+				__WakeSleepers(consume_signal);
 		}
 
 		inline void __AwakeProduct(unsigned long __current_consume_index)
 		{
 			// 判断是忽略生产者还是唤醒生产者
-			bool is_ignore = __sync_bool_compare_and_swap(&p_queue[__current_consume_index].p_wait, P_INIT, P_IGNORE);
+			bool is_ignore = __CasCompareSwap(p_queue[__current_consume_index].p_wait, P_INIT, P_IGNORE, std::memory_order_relaxed);
 			if (true == is_ignore)  // 忽略生产者
 			{
-				__sync_lock_test_and_set(&p_queue[__current_consume_index].e_state, EMPTY);
+				p_queue[__current_consume_index].e_state.store(EMPTY, std::memory_order_seq_cst);
 			}
 			else  // 唤醒生产者
-			{			
-				p_queue[__current_consume_index].e_state = EMPTY;
+			{
+				p_queue[__current_consume_index].e_state.store(EMPTY, std::memory_order_seq_cst);
 
-				pthread_mutex_lock(&p_queue[__current_consume_index].product_mutex);
-				p_queue[__current_consume_index].product_awake_flag = true;
-				pthread_cond_signal(&p_queue[__current_consume_index].product_cond);
-				pthread_mutex_unlock(&p_queue[__current_consume_index].product_mutex);
+				// 将p_wait置为P_AWAKE，生产者已经挂起时才通过futex唤醒，仍在自旋的生产者会自行看到P_AWAKE
+				__CAS_FUZZ_POINT();
+				if (P_SLEEP == p_queue[__current_consume_index].p_wait.exchange(P_AWAKE, std::memory_order_release))
+				{
+					stats.Add(CAS_STAT_WAKE);
+					__CasFutexWake(&p_queue[__current_consume_index].p_wait);
+				}
 			}
 
-			return;
+			// 唤醒限时等待的生产者
+			if (0 != product_sleep.load(std::memory_order_seq_cst))
+				__WakeSleepers(product_signal);
 		}
 };
 
-// 多生产者多消费者非阻塞队列
-template <class T>
-class CasQueueNoBlockMPMC
+/*
+ * 	【非阻塞队列】
+ *
+ * MP		: 是否多生产者，为false时生产者确认entry为空后直接推进生产索引，不做cas
+ * MC		: 是否多消费者，为false时消费者确认entry有数据后直接推进消费索引，不做cas
+ * CAPACITY	: 编译期确定的entry个数(2的N次幂)，票号到entry下标的掩码为立即数；为0时由构造参数决定
+ *
+ */
+template <class T, bool MP, bool MC, unsigned int CAPACITY = 0, class Layout = CasLayoutCompact, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+class __CasNoBlockQueue
 {
+	static_assert(0 == (CAPACITY & (CAPACITY - 1)), "CAPACITY must be 0 or a power of 2");
+	static_assert(1 != CAPACITY, "CAPACITY of a non-blocking queue must be at least 2");
+
 	public:
-		CasQueueNoBlockMPMC()
+		__CasNoBlockQueue()
 		{
-			size = 16384;
-			product_index = consume_index = 0;
+			size = 0 != CAPACITY ? CAPACITY : 16384;
+			__InitQueue();
+		}
 
-			p_queue = new ENTRY [size];
+		// 指定了CAPACITY时忽略queue_size
+		__CasNoBlockQueue(int queue_size)
+		{
+			size = 0 != CAPACITY ? CAPACITY : pow(2, (ceil(log2(queue_size))));
+			if (size < 2)
+				size = 2;  // 序号协议至少需要两个entry才能区分空和满
+			__InitQueue();
+		}
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+		virtual ~__CasNoBlockQueue()
+		{
+			// 析构队列中尚未被消费的数据
+			for (unsigned long ii = consume_index.load(std::memory_order_relaxed); ii != product_index.load(std::memory_order_relaxed); ++ii)
 			{
-				p_queue[ii].e_state = EMPTY;
-
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+				if (ii + 1 == p_queue[__Slot(ii)].seq.load(std::memory_order_relaxed))
+					__Data(__Slot(ii))->~T();
 			}
+
+			__CasFreeArray(allocator, p_queue, size);
+			__CasFreeArray(allocator, p_data, Layout::SPLIT ? size : 0);
 		}
 
-		CasQueueNoBlockMPMC(int queue_size)
+		bool Product(const T &t_product)
 		{
-			product_index = consume_index = 0;
-
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
+			return __Product(t_product);
+		}
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
+		bool Product(T &&t_product)
+		{
+			return __Product(std::move(t_product));
+		}
 
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
-			}
+		// 在entry中就地构造数据，队列满返回false且不构造
+		template <class... Args>
+		bool TryEmplace(Args &&... args)
+		{
+			return __Product(std::forward<Args>(args)...);
 		}
 
-		virtual ~CasQueueNoBlockMPMC()
+		// 只有确认票号对应的entry有数据后才推进consume_index，失败时不会消耗票号
+		bool Consume(T &t_consume)
 		{
-			delete [] p_queue;
+			unsigned long current_consume_index;
+			if (false == __ClaimOne<MC>(consume_index, 1, current_consume_index, CAS_STAT_CONSUME_EMPTY, CAS_STAT_CONSUME_CAS, CAS_STAT_CONSUME_LAP))
+				return false;  // queue is empty
+
+			__ConsumeEntry(current_consume_index, t_consume);
+
+			return true;
 		}
 
-		bool Product(T &t_product)
+		// 领取从当前票号开始连续为空的entry，多生产者时用一次cas领取，返回实际生产的个数，队列满时返回0
+		unsigned long ProductBulk(const T *t_products, unsigned long n)
 		{
-			unsigned long current_product_index = __sync_fetch_and_add(&product_index, 1);
-			current_product_index &= (size - 1);
+			unsigned long current_product_index;
+			unsigned long count = __ClaimBulk<MP>(product_index, 0, n, current_product_index, CAS_STAT_PRODUCT_FULL, CAS_STAT_PRODUCT_CAS);
 
-loop_product:
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN, FRONT_DOOR_CLOSE);
-			if (true == is_enter)
+			if constexpr (false == MP && false == MC)
 			{
-				bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-				if (true == is_product)
-				{
+				if (0 == count)
+					return 0;
 
-					p_queue[current_product_index].data = t_product;
-					__sync_lock_test_and_set(&p_queue[current_product_index].e_state, FULL);
-					__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
+				for (unsigned long ii = 0; ii < count; ++ii)
+					new (__Data(__Slot(current_product_index + ii))) T(t_products[ii]);
 
-					return true;
-				}
-				else
-				{
-					__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
-					return false;  // queue is full
-				}
+				__Publish(current_product_index, count, 1);
+				stats.Add(CAS_STAT_PRODUCT, count);
 			}
 			else
 			{
-				goto loop_product;
+				for (unsigned long ii = 0; ii < count; ++ii)
+					__ProductEntry(current_product_index + ii, t_products[ii]);
 			}
+
+			return count;
 		}
 
-		bool Consume(T &t_consume)
+		// 领取从当前票号开始连续有数据的entry，多消费者时用一次cas领取，返回实际消费的个数，队列空时返回0
+		unsigned long ConsumeBulk(T *t_consumes, unsigned long max)
 		{
-			unsigned long current_consume_index = __sync_fetch_and_add(&consume_index, 1);
-			current_consume_index &= (size - 1);
+			unsigned long current_consume_index;
+			unsigned long count = __ClaimBulk<MC>(consume_index, 1, max, current_consume_index, CAS_STAT_CONSUME_EMPTY, CAS_STAT_CONSUME_CAS);
 
-loop_consume:
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN, BACK_DOOR_CLOSE);
-			if (true == is_enter)
+			if constexpr (false == MP && false == MC)
 			{
-				bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-				if (true == is_consume)
-				{
-					t_consume = p_queue[current_consume_index].data;
-					__sync_lock_test_and_set(&p_queue[current_consume_index].e_state, EMPTY);
-					__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
+				if (0 == count)
+					return 0;
 
-					return true;
-				}
-				else
-				{
-					__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
-					return false;  // queue is enpty
-				}
+				for (unsigned long ii = 0; ii < count; ++ii)
+					__Take(__Slot(current_consume_index + ii), t_consumes[ii]);
+
+				__Publish(current_consume_index, count, __Size());
+				stats.Add(CAS_STAT_CONSUME, count);
 			}
 			else
 			{
-				goto loop_consume;
+				for (unsigned long ii = 0; ii < count; ++ii)
+					__ConsumeEntry(current_consume_index + ii, t_consumes[ii]);
 			}
 
+			return count;
 		}
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum front_door {FRONT_DOOR_OPEN = 0, FRONT_DOOR_CLOSE};
-		enum back_door {BACK_DOOR_OPEN = 0, BACK_DOOR_CLOSE};
-
-		typedef struct
+		/*
+		 * 领取一个空entry供调用者直接写入，entry中的数据已默认构造（没有构造函数的简单类型不做初始化），写完后调用CommitProduct发布
+		 * 队列满时返回的slot无效，不消耗票号；发布前持有后续票号的消费者看到该entry为空
+		 */
+		CasSlot<T> ClaimProduct()
 		{
-			T data;
+			CasSlot<T> slot = {NULL, 0};
+			if (true == __ClaimOne<MP>(product_index, 0, slot.index, CAS_STAT_PRODUCT_FULL, CAS_STAT_PRODUCT_CAS, CAS_STAT_PRODUCT_LAP))
+				slot.p_data = new (__Data(__Slot(slot.index))) T;
 
-			entry_state e_state;
-
-			front_door f_door;
-			back_door b_door;
-		} ENTRY;
-
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
-};
+			return slot;
+		}
 
-// 多生产者单消费者非阻塞队列
-template <class T>
-class CasQueueNoBlockMPOC
-{
-	public:
-		CasQueueNoBlockMPOC()
+		// 发布ClaimProduct领取的entry，之后slot无效
+		void CommitProduct(CasSlot<T> &slot)
 		{
-			size = 16384;
-			product_index = consume_index = 0;
-
-			p_queue = new ENTRY [size];
-
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
-
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
-			}
+			__CAS_FUZZ_POINT();
+			p_queue[__Slot(slot.index)].seq.store(slot.index + 1, std::memory_order_release);
+			stats.Add(CAS_STAT_PRODUCT);
+			slot.p_data = NULL;
 		}
 
-		CasQueueNoBlockMPOC(int queue_size)
+		// 领取一个有数据的entry供调用者直接读取，读完后调用ReleaseConsume归还；队列空时返回的slot无效
+		CasSlot<T> ClaimConsume()
 		{
-			product_index = consume_index = 0;
+			CasSlot<T> slot = {NULL, 0};
+			if (true == __ClaimOne<MC>(consume_index, 1, slot.index, CAS_STAT_CONSUME_EMPTY, CAS_STAT_CONSUME_CAS, CAS_STAT_CONSUME_LAP))
+				slot.p_data = __Data(__Slot(slot.index));
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
-
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
-
-				p_queue[ii].f_door = FRONT_DOOR_OPEN;
-			}
+			return slot;
 		}
 
-		virtual ~CasQueueNoBlockMPOC()
+		// 析构entry中的数据并归还ClaimConsume领取的entry，之后slot无效
+		void ReleaseConsume(CasSlot<T> &slot)
 		{
-			delete [] p_queue;
+			slot.p_data->~T();
+			__CAS_FUZZ_POINT();
+			p_queue[__Slot(slot.index)].seq.store(slot.index + __Size(), std::memory_order_release);
+			stats.Add(CAS_STAT_CONSUME);
+			slot.p_data = NULL;
 		}
 
-		bool Product(T &t_product)
+		// 近似的数据个数，生产者和消费者并发时只作为监控参考
+		unsigned long ApproxSize()
 		{
-			unsigned long current_product_index = __sync_fetch_and_add(&product_index, 1);
-			current_product_index &= (size - 1);
-
-loop_product:
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN, FRONT_DOOR_CLOSE);
-			if (true == is_enter)
-			{
-				bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-				if (true == is_product)
-				{
+			long count = (long)(product_index.load(std::memory_order_relaxed) - consume_index.load(std::memory_order_relaxed));
+			if (count < 0)
+				return 0;  // 两个索引先后读取，期间消费者可能已经追上
 
-					p_queue[current_product_index].data = t_product;
-					__sync_lock_test_and_set(&p_queue[current_product_index].e_state, FULL);
-					__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
-
-					return true;
-				}
-				else
-				{
-					__sync_lock_test_and_set(&p_queue[current_product_index].f_door, FRONT_DOOR_OPEN);
-					return false;  // queue is full
-				}
-			}
-			else
-			{
-				goto loop_product;
-			}
+			return count < (long)__Size() ? count : __Size();
 		}
 
-		bool Consume(T &t_consume)
+		// 运行状态快照，可由监控线程定期调用
+		void Snapshot(CasQueueStats &queue_stats)
 		{
-			unsigned long current_consume_index = consume_index++;
-			current_consume_index &= (size - 1);
-
-			bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-			if (true == is_consume)
-			{
-				t_consume = p_queue[current_consume_index].data;
-				__sync_lock_test_and_set(&p_queue[current_consume_index].e_state, EMPTY);
-
-				return true;
-			}
-			else
-			{
-				return false;  // queue is enpty
-			}
+			stats.Sum(queue_stats.counter);
+			queue_stats.size = ApproxSize();
+			queue_stats.capacity = __Size();
 		}
 
 	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum front_door {FRONT_DOOR_OPEN = 0, FRONT_DOOR_CLOSE};
-
-		typedef struct
+		typedef struct : __CasStorage<T, !Layout::SPLIT>  // 非SPLIT布局时数据与控制字存放在同一个entry中
 		{
-			T data;
-
-			entry_state e_state;
-
-			front_door f_door;
+			/*
+			 * 	【seq 表示entry的序号，非阻塞队列的核心】
+			 *
+			 * seq == 票号		: entry为空，持有该票号的生产者可以生产
+			 * seq == 票号 + 1	: entry有数据，持有该票号的消费者可以消费
+			 * seq == 票号 + size	: 消费完毕，entry留给下一圈的生产者
+			 *
+			 * 生产者、消费者先读seq确认entry可用后才推进product_index、consume_index，
+			 * 队列满或空时直接返回false，不会消耗票号导致生产者和消费者错位
+			 */
+			std::atomic<unsigned long> seq;
 		} ENTRY;
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
-};
+		typedef __CasCell<ENTRY, Layout::ALIGN> CELL;
+		typedef __CasCell<__CasStorage<T>, Layout::ALIGN> DATA_CELL;
 
-// 单生产者多消费者非阻塞队列
-template <class T>
-class CasQueueNoBlockOPMC
-{
-	public:
-		CasQueueNoBlockOPMC()
+		CELL *p_queue __attribute__((aligned(64)));
+		DATA_CELL *p_data;  // SPLIT布局时存放数据的数组，否则为NULL
+		unsigned int size __attribute__((aligned(64)));
+		Stats stats;  // 统计策略，默认不统计
+		Alloc allocator;  // entry数组的内存分配策略
+		unsigned int scatter_bits;  // SCATTER布局时一个缓存行内entry个数的对数
+		unsigned int line_bits;  // SCATTER布局时缓存行个数的对数
+		std::atomic<unsigned long> product_index __attribute__((aligned(64)));
+		std::atomic<unsigned long> consume_index __attribute__((aligned(64)));
+
+		inline void __InitQueue()
 		{
-			size = 16384;
-			product_index = consume_index = 0;
+			product_index.store(0, std::memory_order_relaxed);
+			consume_index.store(0, std::memory_order_relaxed);
 
-			p_queue = new ENTRY [size];
+			__AllocQueue();
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+			// 初始化队列，第一圈中票号为ii的entry序号为ii，表示可以生产
+			for (unsigned long ii = 0; ii < size; ++ii)
 			{
-				p_queue[ii].e_state = EMPTY;
-
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+				p_queue[__Slot(ii)].seq.store(ii, std::memory_order_relaxed);
 			}
 		}
 
-		CasQueueNoBlockOPMC(int queue_size)
+		inline void __AllocQueue()
 		{
-			product_index = consume_index = 0;
+			p_queue = __CasAllocArray<CELL>(allocator, size);
+			p_data = Layout::SPLIT ? __CasAllocArray<DATA_CELL>(allocator, size) : NULL;
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
-
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
+			// 打散布局下一个缓存行内的K个entry对应的票号相隔size/K，相邻票号必然落在不同的缓存行
+			scatter_bits = 0;
+			line_bits = __builtin_ctz(size);
+			if (Layout::SCATTER)
 			{
-				p_queue[ii].e_state = EMPTY;
-
-				p_queue[ii].b_door = BACK_DOOR_OPEN;
+				unsigned int entry_bits = Layout::SPLIT ? __CasLineBits(sizeof(CELL) < sizeof(DATA_CELL) ? sizeof(CELL) : sizeof(DATA_CELL)) : __CasLineBits(sizeof(CELL));
+				scatter_bits = entry_bits < line_bits ? entry_bits : line_bits;
+				line_bits -= scatter_bits;
 			}
 		}
 
-		virtual ~CasQueueNoBlockOPMC()
+		// entry个数，指定了CAPACITY时为编译期常量
+		inline unsigned long __Size()
 		{
-			delete [] p_queue;
+			return 0 != CAPACITY ? CAPACITY : size;
 		}
 
-		bool Product(T &t_product)
+		// 票号映射为entry下标
+		inline unsigned long __Slot(unsigned long __index)
 		{
-			unsigned long current_product_index = product_index++;
-			current_product_index &= (size - 1);
+			__index &= (__Size() - 1);
+			if (Layout::SCATTER)
+				__index = ((__index & ((1UL << line_bits) - 1)) << scatter_bits) | (__index >> line_bits);
 
-			bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-			if (true == is_product)
-			{
+			return __index;
+		}
 
-				p_queue[current_product_index].data = t_product;
-				__sync_lock_test_and_set(&p_queue[current_product_index].e_state, FULL);
+		inline T *__Data(unsigned long __index)
+		{
+			return Layout::SPLIT ? p_data[__index].Get() : p_queue[__index].Get();
+		}
 
-				return true;
-			}
-			else
-			{
-				return false;  // queue is full
-			}
+		// 从票号__index开始连续可用的entry个数，最多n个；offset为0时统计空entry，为1时统计有数据的entry
+		inline unsigned long __ReadyPrefix(unsigned long __index, unsigned long offset, unsigned long n)
+		{
+			unsigned long count = 0;
+			while (count < n && count < __Size() && __index + count + offset == p_queue[__Slot(__index + count)].seq.load(std::memory_order_acquire))
+				++count;
+
+			return count;
 		}
 
-		bool Consume(T &t_consume)
+		/*
+		 * 领取索引index上的一个票号，offset为0时领取空entry，为1时领取有数据的entry
+		 * 只有确认票号对应的entry可用后才推进索引，多个线程共享该索引时用cas推进，失败时不会消耗票号
+		 */
+		template <bool MULTI>
+		inline bool __ClaimOne(std::atomic<unsigned long> &index, unsigned long offset, unsigned long &current, unsigned int fail_stat, unsigned int cas_stat, unsigned int lap_stat)
 		{
-			unsigned long current_consume_index = __sync_fetch_and_add(&consume_index, 1);
-			current_consume_index &= (size - 1);
+			if constexpr (false == MULTI)
+			{
+				current = index.load(std::memory_order_relaxed);
+				if (current + offset != p_queue[__Slot(current)].seq.load(std::memory_order_acquire))
+				{
+					stats.Add(fail_stat);
+					return false;
+				}
+
+				index.store(current + 1, std::memory_order_relaxed);
+				return true;
+			}
 
-loop_consume:
-			bool is_enter = __sync_bool_compare_and_swap(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN, BACK_DOOR_CLOSE);
-			if (true == is_enter)
+			current = index.load(std::memory_order_relaxed);
+			for (;;)
 			{
-				bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-				if (true == is_consume)
+				unsigned long seq = p_queue[__Slot(current)].seq.load(std::memory_order_acquire);
+				long diff = (long)(seq - (current + offset));
+				if (0 == diff)
 				{
-					t_consume = p_queue[current_consume_index].data;
-					__sync_lock_test_and_set(&p_queue[current_consume_index].e_state, EMPTY);
-					__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
+					// 票号只用于分配entry，数据的可见性由seq的acquire/release保证，推进索引用relaxed即可
+					__CAS_FUZZ_POINT();
+					if (true == index.compare_exchange_strong(current, current + 1, std::memory_order_relaxed))
+						return true;
 
-					return true;
+					stats.Add(cas_stat);  // 被其它线程抢先，current已更新为最新的票号，重试
 				}
-				else
+				else if (diff < 0)
 				{
-					__sync_lock_test_and_set(&p_queue[current_consume_index].b_door, BACK_DOOR_OPEN);
-					return false;  // queue is enpty
+					stats.Add(fail_stat);
+					return false;  // 生产时队列满，消费时队列空
+				}
+				else  // 其它线程已经领取了该票号
+				{
+					stats.Add(lap_stat);
+					current = index.load(std::memory_order_relaxed);
 				}
 			}
-			else
-			{
-				goto loop_consume;
-			}
-
 		}
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
-		enum back_door {BACK_DOOR_OPEN = 0, BACK_DOOR_CLOSE};
-
-		typedef struct
+		// 领取索引index上从当前票号开始连续可用的entry，最多n个，返回领取的个数，first为第一个票号
+		template <bool MULTI>
+		inline unsigned long __ClaimBulk(std::atomic<unsigned long> &index, unsigned long offset, unsigned long n, unsigned long &first, unsigned int fail_stat, unsigned int cas_stat)
 		{
-			T data;
+			unsigned long count;
+			for (;;)
+			{
+				first = index.load(std::memory_order_relaxed);
+				count = __ReadyPrefix(first, offset, n);
+				if (0 == count)
+				{
+					stats.Add(fail_stat);
+					return 0;
+				}
 
-			entry_state e_state;
+				if constexpr (false == MULTI)
+				{
+					index.store(first + count, std::memory_order_relaxed);
+					break;
+				}
+				else if (true == __CasCompareSwap(index, first, first + count, std::memory_order_relaxed))
+					break;
 
-			back_door b_door;
-		} ENTRY;
+				stats.Add(cas_stat);
+			}
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
-};
+			return count;
+		}
 
-// 单生产者单消费者非阻塞队列
-template <class T>
-class CasQueueNoBlockOPOC
-{
-	public:
-		CasQueueNoBlockOPOC()
+		// 将数据移出entry并析构entry中的对象
+		inline void __Take(unsigned long __index, T &t_consume)
 		{
-			size = 16384;
-			product_index = consume_index = 0;
-
-			p_queue = new ENTRY [size];
-
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
-			}
+			T *p_data = __Data(__index);
+			t_consume = std::move(*p_data);
+			p_data->~T();
 		}
 
-		CasQueueNoBlockOPOC(int queue_size)
+		template <class... Args>
+		bool __Product(Args &&... args)
 		{
-			product_index = consume_index = 0;
+			unsigned long current_product_index;
+			if (false == __ClaimOne<MP>(product_index, 0, current_product_index, CAS_STAT_PRODUCT_FULL, CAS_STAT_PRODUCT_CAS, CAS_STAT_PRODUCT_LAP))
+				return false;  // queue is full
 
-			size = pow(2, (ceil(log2(queue_size))));
-			p_queue = new ENTRY [size];
+			__ProductEntry(current_product_index, std::forward<Args>(args)...);
 
-			// 初始化队列
-			for (int ii = 0; ii < size; ++ii)
-			{
-				p_queue[ii].e_state = EMPTY;
-			}
+			return true;
 		}
 
-		virtual ~CasQueueNoBlockOPOC()
+		// 在已领取的票号上生产数据，release写seq发布数据
+		template <class... Args>
+		inline void __ProductEntry(unsigned long current_product_index, Args &&... args)
 		{
-			delete [] p_queue;
+			unsigned long slot = __Slot(current_product_index);
+			new (__Data(slot)) T(std::forward<Args>(args)...);
+			__CAS_FUZZ_POINT();
+			p_queue[slot].seq.store(current_product_index + 1, std::memory_order_release);
+			stats.Add(CAS_STAT_PRODUCT);
 		}
 
-		bool Product(T &t_product)
+		// 在已领取的票号上消费数据，seq置为下一圈生产者的票号
+		inline void __ConsumeEntry(unsigned long current_consume_index, T &t_consume)
 		{
-			unsigned long current_product_index = product_index++;
-
-			current_product_index &= (size - 1);
-
-			bool is_product = __sync_bool_compare_and_swap(&p_queue[current_product_index].e_state, EMPTY, PRODUCT);
-			if (true == is_product)
-			{
+			unsigned long slot = __Slot(current_consume_index);
+			__Take(slot, t_consume);
+			__CAS_FUZZ_POINT();
+			p_queue[slot].seq.store(current_consume_index + __Size(), std::memory_order_release);
+			stats.Add(CAS_STAT_CONSUME);
+		}
 
-				p_queue[current_product_index].data = t_product;
-				__sync_lock_test_and_set(&p_queue[current_product_index].e_state, FULL);
+		/*
+		 * 单生产者单消费者时entry按票号顺序被释放和填充，批量生产先写完所有数据，
+		 * 再从后往前置entry序号，最后以一次release写发布第一个entry，消费者看到第一个entry有数据时整批数据均已可见；
+		 * 整批生产、消费中没有逐个entry的原子读改写操作，对简单类型的数据拷贝可被编译器向量化
+		 * 有多个生产者或消费者时，对方可能按单个entry的序号抢先使用后面的entry，只能逐个release发布
+		 */
+		inline void __Publish(unsigned long __index, unsigned long count, unsigned long step)
+		{
+			for (unsigned long ii = count - 1; ii > 0; --ii)
+				p_queue[__Slot(__index + ii)].seq.store(__index + ii + step, std::memory_order_relaxed);
 
-				return true;
-			}
-			else
-			{
-				return false;  // queue is full
-			}
+			p_queue[__Slot(__index)].seq.store(__index + step, std::memory_order_release);
 		}
+};
 
-		bool Consume(T &t_consume)
-		{
-			unsigned long current_consume_index = consume_index++;
+enum cas_side {CAS_ONE = 0, CAS_MANY};  // 生产者、消费者一方是单线程还是多线程
+
+/*
+ * 	【编译期特化的队列】
+ *
+ * PRODUCERS/CONSUMERS	: CAS_ONE时省去该方索引上的原子操作以及entry的前门/后门
+ * BLOCKING		: true为阻塞队列，false为非阻塞队列(Wait策略不起作用)
+ * CAPACITY		: 非0时entry个数为编译期常量，构造参数queue_size被忽略
+ * Alloc		: entry数组的内存分配策略，默认CasAllocNew
+ *
+ * 例如 CasQueue<long, CAS_ONE, CAS_ONE, false, 1024> 为容量1024的单生产者单消费者非阻塞队列
+ */
+template <class T, cas_side PRODUCERS, cas_side CONSUMERS, bool BLOCKING = true, unsigned int CAPACITY = 0, class Layout = CasLayoutCompact, class Wait = CasWaitPark, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueue = typename std::conditional<BLOCKING,
+	__CasBlockQueue<T, CAS_MANY == PRODUCERS, CAS_MANY == CONSUMERS, CAPACITY, Layout, Wait, Stats, Alloc>,
+	__CasNoBlockQueue<T, CAS_MANY == PRODUCERS, CAS_MANY == CONSUMERS, CAPACITY, Layout, Stats, Alloc>>::type;
 
-			current_consume_index &= (size - 1);
+// 多生产者多消费者阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Wait = CasWaitPark, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueMPMC = __CasBlockQueue<T, true, true, 0, Layout, Wait, Stats, Alloc>;
 
-			bool is_consume = __sync_bool_compare_and_swap(&p_queue[current_consume_index].e_state, FULL, CONSUME);
-			if (true == is_consume)
-			{
-				t_consume = p_queue[current_consume_index].data;
-				__sync_lock_test_and_set(&p_queue[current_consume_index].e_state, EMPTY);
+// 多生产者单消费者阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Wait = CasWaitPark, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueMPOC = __CasBlockQueue<T, true, false, 0, Layout, Wait, Stats, Alloc>;
 
-				return true;
-			}
-			else
-			{
-				return false;  // queue is enpty
-			}
-		}
+// 单生产者多消费者阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Wait = CasWaitPark, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueOPMC = __CasBlockQueue<T, false, true, 0, Layout, Wait, Stats, Alloc>;
 
-	private:
-		enum entry_state {EMPTY = 0, PRODUCT, FULL, CONSUME};
+// 单生产者单消费者阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Wait = CasWaitPark, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueOPOC = __CasBlockQueue<T, false, false, 0, Layout, Wait, Stats, Alloc>;
 
-		typedef struct
-		{
-			T data;
+// 多生产者多消费者非阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueNoBlockMPMC = __CasNoBlockQueue<T, true, true, 0, Layout, Stats, Alloc>;
 
-			entry_state e_state;
-		} ENTRY;
+// 多生产者单消费者非阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueNoBlockMPOC = __CasNoBlockQueue<T, true, false, 0, Layout, Stats, Alloc>;
 
-		ENTRY *p_queue __attribute__((aligned(64)));
-		unsigned int size __attribute__((aligned(64)));
-		unsigned long product_index __attribute__((aligned(64)));
-		unsigned long consume_index __attribute__((aligned(64)));
-};
+// 单生产者多消费者非阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueNoBlockOPMC = __CasNoBlockQueue<T, false, true, 0, Layout, Stats, Alloc>;
+
+// 单生产者单消费者非阻塞队列
+template <class T, class Layout = CasLayoutCompact, class Stats = CasStatsNone, class Alloc = CasAllocNew>
+using CasQueueNoBlockOPOC = __CasNoBlockQueue<T, false, false, 0, Layout, Stats, Alloc>;
 
 #endif
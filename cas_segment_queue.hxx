@@ -0,0 +1,474 @@
+#ifndef __CAS_SEGMENT_QUEUE__
+#define __CAS_SEGMENT_QUEUE__
+
+#include "cas_queue.hxx"
+
+/*
+ * 	【分段无界队列】
+ *
+ * 队列由若干段(segment)组成的单向链表构成，生产者写tail段，消费者读head段
+ * 段内票号线性递增不回绕，一段写满时从段池中取一个空段链接到末尾，一段读完后整段退役
+ * 退役的段要等所有可能还持有它的线程离开后才能回收进段池，由两个纪元的用户计数器判断
+ * 只有段的切换(链接新段、退役、回收)在互斥锁保护的慢路径上，段内生产/消费与非阻塞队列一样只有一次原子操作
+ *
+ */
+template <class T>
+struct __CasSegment
+{
+	enum entry_state {EMPTY = 0, FULL};
+
+	typedef struct : __CasStorage<T>
+	{
+		std::atomic<entry_state> e_state;
+	} ENTRY;
+
+	ENTRY *p_queue;
+	std::atomic<__CasSegment *> next;  // 链表中的下一段
+	__CasSegment *retire_next;  // 退役链表/段池中的下一段，不能复用next，退役后其它线程可能还在通过next离开该段
+	unsigned long retire_epoch;  // 退役时的纪元
+	std::atomic<unsigned long> product_index __attribute__((aligned(64)));
+	std::atomic<unsigned long> consume_index __attribute__((aligned(64)));
+
+	__CasSegment(unsigned int size)
+	{
+		p_queue = new ENTRY [size];
+		Reset(size);
+	}
+
+	~__CasSegment()
+	{
+		delete [] p_queue;
+	}
+
+	void Reset(unsigned int size)
+	{
+		for (unsigned int ii = 0; ii < size; ++ii)
+			p_queue[ii].e_state.store(EMPTY, std::memory_order_relaxed);
+
+		next.store(NULL, std::memory_order_relaxed);
+		retire_next = NULL;
+		retire_epoch = 0;
+		product_index.store(0, std::memory_order_relaxed);
+		consume_index.store(0, std::memory_order_relaxed);
+	}
+};
+
+// 多生产者多消费者分段非阻塞队列，只有达到段数上限时Product才返回false
+template <class T>
+class CasSegmentQueueNoBlockMPMC
+{
+	public:
+		/*
+		 * segment_size	: 每段的entry个数
+		 * max_segment	: 链上最多的段数，即高水位，0表示不限制
+		 * pool_size	: 段池中最多保留的空段个数，多余的空段直接释放内存
+		 */
+		CasSegmentQueueNoBlockMPMC(int segment_size = 1024, unsigned int max_segment = 0, unsigned int pool_size = 2)
+		{
+			size = pow(2, (ceil(log2(segment_size))));
+
+			// 段内票号不回绕，只有一段时读完后无法再链接新段，上限至少为2
+			this->max_segment = (0 != max_segment && max_segment < 2) ? 2 : max_segment;
+			this->pool_size = pool_size;
+
+			epoch.store(2, std::memory_order_relaxed);
+			users[0].store(0, std::memory_order_relaxed);
+			users[1].store(0, std::memory_order_relaxed);
+
+			pool = retire_head = retire_tail = NULL;
+			pool_count = 0;
+			pthread_mutex_init(&mutex, NULL);
+
+			SEGMENT *segment = new SEGMENT(size);
+			head.store(segment, std::memory_order_relaxed);
+			tail.store(segment, std::memory_order_relaxed);
+			segment_count.store(1, std::memory_order_relaxed);
+		}
+
+		virtual ~CasSegmentQueueNoBlockMPMC()
+		{
+			// 析构链上尚未被消费的数据
+			SEGMENT *segment = head.load(std::memory_order_relaxed);
+			while (NULL != segment)
+			{
+				unsigned long product_index = segment->product_index.load(std::memory_order_relaxed);
+				unsigned long end = product_index < size ? product_index : size;
+				for (unsigned long ii = segment->consume_index.load(std::memory_order_relaxed); ii < end; ++ii)
+				{
+					if (SEGMENT::FULL == segment->p_queue[ii].e_state.load(std::memory_order_relaxed))
+						segment->p_queue[ii].Get()->~T();
+				}
+
+				SEGMENT *next = segment->next.load(std::memory_order_relaxed);
+				delete segment;
+				segment = next;
+			}
+
+			__DeleteList(retire_head);
+			__DeleteList(pool);
+			pthread_mutex_destroy(&mutex);
+		}
+
+		bool Product(const T &t_product)
+		{
+			return __Product(t_product);
+		}
+
+		bool Product(T &&t_product)
+		{
+			return __Product(std::move(t_product));
+		}
+
+		template <class... Args>
+		bool TryEmplace(Args &&... args)
+		{
+			return __Product(std::forward<Args>(args)...);
+		}
+
+		bool Consume(T &t_consume)
+		{
+			unsigned long current_epoch = __Enter();
+			bool is_consume = false;
+
+			for (;;)
+			{
+				SEGMENT *segment = head.load(std::memory_order_acquire);
+				unsigned long current_consume_index = segment->consume_index.load(std::memory_order_relaxed);
+
+				// 本段已经读完，转到下一段并退役本段
+				if (current_consume_index >= size)
+				{
+					SEGMENT *next = segment->next.load(std::memory_order_acquire);
+					if (NULL == next)
+						break;
+
+					__AdvanceHead(segment, next);
+					continue;
+				}
+
+				// 与非阻塞队列一样，确认entry有数据后才推进消费索引，队列空时不消耗票号
+				ENTRY *entry = &segment->p_queue[current_consume_index];
+				if (SEGMENT::FULL != entry->e_state.load(std::memory_order_acquire))
+					break;
+
+				if (true == __CasCompareSwap(segment->consume_index, current_consume_index, current_consume_index + 1, std::memory_order_relaxed))
+				{
+					t_consume = std::move(*entry->Get());
+					entry->Get()->~T();
+					is_consume = true;
+					break;
+				}
+			}
+
+			__Leave(current_epoch);
+			return is_consume;
+		}
+
+		// 当前链上的段数，包括正在被链接的新段
+		unsigned int SegmentCount()
+		{
+			return segment_count.load(std::memory_order_relaxed);
+		}
+
+	private:
+		typedef __CasSegment<T> SEGMENT;
+		typedef typename SEGMENT::ENTRY ENTRY;
+
+		std::atomic<SEGMENT *> head __attribute__((aligned(64)));
+		std::atomic<SEGMENT *> tail __attribute__((aligned(64)));
+		unsigned int size __attribute__((aligned(64)));  // 每段entry个数
+		unsigned int max_segment;
+		unsigned int pool_size;
+
+		/*
+		 * 	【纪元与用户计数器】
+		 *
+		 * 每次生产/消费前在当前纪元对应的users中登记，结束后注销
+		 * 纪元从E推进到E+1的前提是users[(E-1)&1]为0，即已没有线程停留在纪元E-1
+		 * 在纪元E退役的段在纪元推进到E+2时，所有可能持有它的线程都已离开，可以回收
+		 *
+		 */
+		std::atomic<unsigned long> epoch __attribute__((aligned(64)));
+		std::atomic<long> users[2] __attribute__((aligned(64)));
+
+		// 以下成员只在持有mutex时访问（segment_count可无锁读取）
+		pthread_mutex_t mutex __attribute__((aligned(64)));
+		std::atomic<unsigned int> segment_count;
+		SEGMENT *pool;  // 段池
+		unsigned int pool_count;
+		SEGMENT *retire_head;  // 按退役顺序排列的退役段
+		SEGMENT *retire_tail;
+
+		template <class... Args>
+		bool __Product(Args &&... args)
+		{
+			unsigned long current_epoch = __Enter();
+			bool is_product = false;
+
+			for (;;)
+			{
+				SEGMENT *segment = tail.load(std::memory_order_acquire);
+				unsigned long current_product_index = segment->product_index.fetch_add(1, std::memory_order_relaxed);
+
+				// 段内票号由fetch_and_add独占分配，直接构造后发布
+				if (current_product_index < size)
+				{
+					ENTRY *entry = &segment->p_queue[current_product_index];
+					new (entry->Get()) T(std::forward<Args>(args)...);
+					entry->e_state.store(SEGMENT::FULL, std::memory_order_release);
+					is_product = true;
+					break;
+				}
+
+				// 本段已写满，链接新段，多个生产者同时链接时只有一个成功，其余的段放回段池
+				SEGMENT *next = segment->next.load(std::memory_order_acquire);
+				if (NULL == next)
+				{
+					next = __NewSegment();
+					if (NULL == next)  // 达到段数上限
+						break;
+
+					// 新段由段池中的Reset初始化，release发布给从next拿到它的线程
+					if (false == __CasCompareSwap(segment->next, NULL, next, std::memory_order_release))
+					{
+						__PoolSegment(next);
+						next = segment->next.load(std::memory_order_acquire);
+					}
+				}
+
+				__CasCompareSwap(tail, segment, next, std::memory_order_release);
+			}
+
+			__Leave(current_epoch);
+			return is_product;
+		}
+
+		inline unsigned long __Enter()
+		{
+			for (;;)
+			{
+				unsigned long current_epoch = epoch.load(std::memory_order_seq_cst);
+				users[current_epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+
+				// 登记期间纪元已推进则撤销重来，登记到的计数器可能已被用于判断回收
+				if (current_epoch == epoch.load(std::memory_order_seq_cst))
+					return current_epoch;
+
+				users[current_epoch & 1].fetch_sub(1, std::memory_order_release);
+			}
+		}
+
+		inline void __Leave(unsigned long current_epoch)
+		{
+			// release使本线程对段的访问先于回收者读到计数器归零
+			users[current_epoch & 1].fetch_sub(1, std::memory_order_release);
+		}
+
+		// 先让tail越过旧段再移动head，保证旧段退役后不会再被新进入的线程拿到
+		inline void __AdvanceHead(SEGMENT *segment, SEGMENT *next)
+		{
+			__CasCompareSwap(tail, segment, next, std::memory_order_release);
+			if (true == __CasCompareSwap(head, segment, next, std::memory_order_release))
+			{
+				pthread_mutex_lock(&mutex);
+
+				segment->retire_epoch = epoch.load(std::memory_order_relaxed);
+				if (NULL == retire_tail)
+					retire_head = segment;
+				else
+					retire_tail->retire_next = segment;
+				retire_tail = segment;
+				segment_count.fetch_sub(1, std::memory_order_relaxed);
+
+				__Reclaim();
+				pthread_mutex_unlock(&mutex);
+			}
+		}
+
+		// 尝试推进纪元，并回收已经没有线程持有的退役段，需持有mutex
+		inline void __Reclaim()
+		{
+			unsigned long current_epoch = epoch.load(std::memory_order_relaxed);
+			if (0 == users[(current_epoch - 1) & 1].load(std::memory_order_seq_cst))
+				epoch.store(++current_epoch, std::memory_order_seq_cst);
+
+			while (NULL != retire_head && retire_head->retire_epoch + 2 <= current_epoch)
+			{
+				SEGMENT *segment = retire_head;
+				retire_head = segment->retire_next;
+				if (NULL == retire_head)
+					retire_tail = NULL;
+
+				__FreeSegment(segment);
+			}
+		}
+
+		// 从段池中取空段，段池为空时分配新段，达到段数上限时返回NULL
+		inline SEGMENT *__NewSegment()
+		{
+			SEGMENT *segment = NULL;
+
+			pthread_mutex_lock(&mutex);
+			__Reclaim();
+
+			if (0 == max_segment || segment_count.load(std::memory_order_relaxed) < max_segment)
+			{
+				if (NULL != pool)
+				{
+					segment = pool;
+					pool = segment->retire_next;
+					--pool_count;
+					segment->Reset(size);
+				}
+				else
+				{
+					segment = new SEGMENT(size);
+				}
+
+				segment_count.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			pthread_mutex_unlock(&mutex);
+			return segment;
+		}
+
+		// 链接失败的新段还没有被其它线程看到，直接放回段池
+		inline void __PoolSegment(SEGMENT *segment)
+		{
+			pthread_mutex_lock(&mutex);
+			segment_count.fetch_sub(1, std::memory_order_relaxed);
+			__FreeSegment(segment);
+			pthread_mutex_unlock(&mutex);
+		}
+
+		// 放入段池，段池已满时释放内存，需持有mutex
+		inline void __FreeSegment(SEGMENT *segment)
+		{
+			if (pool_count < pool_size)
+			{
+				segment->retire_next = pool;
+				pool = segment;
+				++pool_count;
+			}
+			else
+			{
+				delete segment;
+			}
+		}
+
+		inline void __DeleteList(SEGMENT *segment)
+		{
+			while (NULL != segment)
+			{
+				SEGMENT *next = segment->retire_next;
+				delete segment;
+				segment = next;
+			}
+		}
+};
+
+// 多生产者多消费者分段阻塞队列，队列空时消费者阻塞，达到段数上限时生产者阻塞
+template <class T>
+class CasSegmentQueueMPMC
+{
+	public:
+		CasSegmentQueueMPMC(int segment_size = 1024, unsigned int max_segment = 0, unsigned int pool_size = 2)
+			: queue(segment_size, max_segment, pool_size)
+		{
+			product_sleep.store(0, std::memory_order_relaxed);
+			product_signal.store(0, std::memory_order_relaxed);
+			consume_sleep.store(0, std::memory_order_relaxed);
+			consume_signal.store(0, std::memory_order_relaxed);
+		}
+
+		void Product(const T &t_product)
+		{
+			__Product(t_product);
+		}
+
+		void Product(T &&t_product)
+		{
+			__Product(std::move(t_product));
+		}
+
+		template <class... Args>
+		void Emplace(Args &&... args)
+		{
+			__Product(std::forward<Args>(args)...);
+		}
+
+		void Consume(T &t_consume)
+		{
+			while (false == queue.Consume(t_consume))
+			{
+				// 登记睡眠后再尝试一次，避免在尝试与睡眠之间错过唤醒
+				consume_sleep.fetch_add(1, std::memory_order_seq_cst);
+				int current_signal = consume_signal.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				bool is_consume = queue.Consume(t_consume);
+				if (false == is_consume)
+					__CasFutexWait(&consume_signal, current_signal);
+				consume_sleep.fetch_sub(1, std::memory_order_relaxed);
+
+				if (true == is_consume)
+					break;
+			}
+
+			__Awake(product_sleep, product_signal);
+		}
+
+		bool TryConsume(T &t_consume)
+		{
+			if (false == queue.Consume(t_consume))
+				return false;
+
+			__Awake(product_sleep, product_signal);
+			return true;
+		}
+
+		unsigned int SegmentCount()
+		{
+			return queue.SegmentCount();
+		}
+
+	private:
+		CasSegmentQueueNoBlockMPMC<T> queue;
+		std::atomic<unsigned int> product_sleep __attribute__((aligned(64)));  // 因达到段数上限而睡眠的生产者个数
+		std::atomic<int> product_signal;
+		std::atomic<unsigned int> consume_sleep __attribute__((aligned(64)));  // 因队列空而睡眠的消费者个数
+		std::atomic<int> consume_signal;
+
+		template <class... Args>
+		void __Product(Args &&... args)
+		{
+			// 只有达到段数上限时才会失败，失败时参数没有被移动，可以重试
+			while (false == queue.TryEmplace(std::forward<Args>(args)...))
+			{
+				product_sleep.fetch_add(1, std::memory_order_seq_cst);
+				int current_signal = product_signal.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				bool is_product = queue.TryEmplace(std::forward<Args>(args)...);
+				if (false == is_product)
+					__CasFutexWait(&product_signal, current_signal);
+				product_sleep.fetch_sub(1, std::memory_order_relaxed);
+
+				if (true == is_product)
+					break;
+			}
+
+			__Awake(consume_sleep, consume_signal);
+		}
+
+		// 有线程睡眠时才唤醒，先用全屏障保证前面发布的entry与对sleep的读取不会乱序
+		inline void __Awake(std::atomic<unsigned int> &sleep, std::atomic<int> &signal)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (0 != sleep.load(std::memory_order_relaxed))
+			{
+				signal.fetch_add(1, std::memory_order_release);
+				__CasFutexWake(&signal, INT_MAX);
+			}
+		}
+};
+
+#endif
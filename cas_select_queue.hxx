@@ -0,0 +1,325 @@
+#ifndef __CAS_SELECT_QUEUE__
+#define __CAS_SELECT_QUEUE__
+
+#include "cas_queue.hxx"
+
+/*
+ * 	【同时等待多个队列(Select)】
+ *
+ * 一个消费者服务多个输入(例如控制消息的CasQueueOPOC和数据的CasQueueMPOC)时，不必轮询非阻塞队列，也不必每个队列一个线程
+ * 多个CasSelectQueue共用一个CasSelector，每个队列在选择器的就绪位图中占一位，生产者发布数据后置位，有消费者等待时才唤醒
+ * CasSelect(selector, CasOn(queue0, t0), CasOn(queue1, t1), ...)只尝试位图中置位的队列，
+ * 从其中一个取出一个数据并返回它在参数中的序号，所有队列都空时睡眠在选择器的futex等待字上
+ * 各队列按轮转顺序尝试，数据多的队列不会饿死其它队列；队列的类型T可以各不相同
+ *
+ */
+
+#define CAS_SELECT_BITS 64	// 就绪位图的位数，即一个选择器最多可注册的队列个数
+
+/*
+ * 	【一个Select分支，由CasOn生成】
+ *
+ * 记录队列在位图中的位置以及取数据的函数，不同类型的队列可以放在同一个数组中
+ */
+typedef struct
+{
+	int index;  // 为-1时队列没有注册到选择器上，Select跳过该分支
+	void *p_queue;
+	void *p_data;
+	bool (*try_consume)(void *p_queue, void *p_data);
+} CasSelectCase;
+
+class CasSelector
+{
+	public:
+		CasSelector()
+		{
+			ready_bits.store(0, std::memory_order_relaxed);
+			signal.store(0, std::memory_order_relaxed);
+			closed.store(false, std::memory_order_relaxed);
+			source_num.store(0, std::memory_order_relaxed);
+			cursor.store(0, std::memory_order_relaxed);
+		}
+
+		virtual ~CasSelector()
+		{
+		}
+
+		// 由CasSelectQueue构造时调用，返回队列在位图中的位置，已注册CAS_SELECT_BITS个队列时返回-1
+		int Attach()
+		{
+			unsigned int index = source_num.load(std::memory_order_relaxed);
+			do
+			{
+				if (index >= CAS_SELECT_BITS)
+					return -1;
+			} while (false == source_num.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+			return (int)index;
+		}
+
+		/*
+		 * 生产者发布数据后调用
+		 * 发布数据后全屏障再读位图，与消费者清除位图后全屏障再检查队列构成全序：
+		 * 要么生产者看到被清除的位并重新置位，要么消费者重新检查时取到数据
+		 * 位已置位时不写位图，队列持续有数据时生产者之间不争抢位图所在的缓存行
+		 */
+		void Ready(int index)
+		{
+			unsigned long mask = 1UL << index;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (0 == (ready_bits.load(std::memory_order_relaxed) & mask))
+				ready_bits.fetch_or(mask, std::memory_order_seq_cst);
+
+			__CasSignalAwake(signal);
+		}
+
+		// 所有队列都空时阻塞，返回取到数据的分支序号；选择器关闭且所有队列都空时返回-1
+		int Select(const CasSelectCase *cases, unsigned int n)
+		{
+			int selected;
+			while (-1 == (selected = __TrySelect(cases, n)))
+			{
+				if (true == __CasSignalWait(signal, [&]() { return -1 != (selected = __TrySelect(cases, n)) || true == closed.load(std::memory_order_relaxed); }))
+					break;
+			}
+
+			return selected;
+		}
+
+		// 所有队列都空时立即返回-1
+		int TrySelect(const CasSelectCase *cases, unsigned int n)
+		{
+			return __TrySelect(cases, n);
+		}
+
+		// 限时等待，超时或选择器关闭且所有队列都空时返回-1
+		template <class Clock, class Duration>
+		int SelectUntil(const CasSelectCase *cases, unsigned int n, const std::chrono::time_point<Clock, Duration> &deadline)
+		{
+			int selected;
+			while (-1 == (selected = __TrySelect(cases, n)))
+			{
+				if (true == __CasSignalWaitUntil(signal, [&]() { return -1 != (selected = __TrySelect(cases, n)) || true == closed.load(std::memory_order_relaxed); }, deadline))
+					break;
+			}
+
+			return selected;
+		}
+
+		// 唤醒所有等待的消费者，之后Select取完剩余数据后返回-1，不影响生产
+		void Close()
+		{
+			closed.store(true, std::memory_order_seq_cst);
+			signal.fetch_add(2, std::memory_order_seq_cst);
+			__CasFutexWake(&signal, INT_MAX);
+		}
+
+		bool IsClosed()
+		{
+			return closed.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<unsigned long> ready_bits __attribute__((aligned(64)));  // 就绪位图，置位的队列可能为空，有数据的队列只会短暂地未置位
+		std::atomic<int> signal __attribute__((aligned(64)));  // 所有队列都空时消费者睡眠的futex等待字，最低位表示有消费者等待
+		std::atomic<bool> closed;
+		std::atomic<unsigned int> source_num;
+		std::atomic<unsigned int> cursor;  // 下一次Select从哪个分支开始尝试，多个消费者并发更新时为近似值
+
+		/*
+		 * 从上次取到数据的下一个分支开始轮转，只尝试位图中置位的队列
+		 * 位置位但队列为空时清除该位，全屏障后再检查一次，期间生产的数据不会被遗漏
+		 */
+		inline int __TrySelect(const CasSelectCase *cases, unsigned int n)
+		{
+			unsigned long bits = ready_bits.load(std::memory_order_acquire);
+			if (0 == bits)
+				return -1;
+
+			unsigned int start = cursor.load(std::memory_order_relaxed);
+			for (unsigned int kk = 0; kk < n; ++kk)
+			{
+				unsigned int ii = start + kk < n ? start + kk : start + kk - n;
+				const CasSelectCase &select_case = cases[ii];
+				if (select_case.index < 0)
+					continue;
+
+				unsigned long mask = 1UL << select_case.index;
+				if (0 == (bits & mask))
+					continue;
+
+				if (true == select_case.try_consume(select_case.p_queue, select_case.p_data))
+					return __Selected(ii, n);
+
+				ready_bits.fetch_and(~mask, std::memory_order_seq_cst);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (true == select_case.try_consume(select_case.p_queue, select_case.p_data))
+				{
+					ready_bits.fetch_or(mask, std::memory_order_relaxed);  // 队列中可能还有数据
+					return __Selected(ii, n);
+				}
+			}
+
+			return -1;
+		}
+
+		inline int __Selected(unsigned int ii, unsigned int n)
+		{
+			cursor.store(ii + 1 < n ? ii + 1 : 0, std::memory_order_relaxed);
+			return (int)ii;
+		}
+};
+
+/*
+ * 	【可被Select的队列】
+ *
+ * Queue可以是阻塞或非阻塞队列，生产接口与Queue相同(阻塞队列满时阻塞，非阻塞队列满时返回false)，成功后通知选择器
+ * 消费者通过CasSelect取数据，也可以直接调用TryConsume；同一个选择器上的所有队列由同一组消费者服务
+ * 选择器上已注册CAS_SELECT_BITS个队列时构造的队列没有注册成功，IsAttached()返回false，生产接口返回false/0
+ */
+template <class T, class Queue = CasQueueMPOC<T>>
+class CasSelectQueue
+{
+	public:
+		CasSelectQueue(CasSelector &selector, int queue_size = 16384) : queue(queue_size), selector(selector)
+		{
+			index = selector.Attach();
+		}
+
+		virtual ~CasSelectQueue()
+		{
+		}
+
+		bool Product(const T &t_product)
+		{
+			if (index < 0 || false == queue.Product(t_product))
+				return false;
+
+			selector.Ready(index);
+			return true;
+		}
+
+		bool Product(T &&t_product)
+		{
+			if (index < 0 || false == queue.Product(std::move(t_product)))
+				return false;
+
+			selector.Ready(index);
+			return true;
+		}
+
+		// 阻塞队列满时不阻塞，与非阻塞队列的Product相同，队列满时返回false
+		template <class U>
+		bool TryProduct(U &&t_product)
+		{
+			if (index < 0 || false == __TryProduct(std::forward<U>(t_product)))
+				return false;
+
+			selector.Ready(index);
+			return true;
+		}
+
+		// 批量生产只通知一次，返回实际生产的个数
+		unsigned long ProductBulk(const T *t_products, unsigned long n)
+		{
+			if (index < 0)
+				return 0;
+
+			unsigned long count = queue.ProductBulk(t_products, n);
+			if (0 != count)
+				selector.Ready(index);
+
+			return count;
+		}
+
+		// 队列空时立即返回false，阻塞队列也不会阻塞
+		bool TryConsume(T &t_consume)
+		{
+			if constexpr (true == __HasTryConsume<Queue>::value)
+				return queue.TryConsume(t_consume);
+			else
+				return queue.Consume(t_consume);
+		}
+
+		// 队列在选择器位图中的位置，没有注册成功时为-1
+		int Index()
+		{
+			return index;
+		}
+
+		bool IsAttached()
+		{
+			return index >= 0;
+		}
+
+		Queue &GetQueue()
+		{
+			return queue;
+		}
+
+		unsigned long ApproxSize()
+		{
+			return queue.ApproxSize();
+		}
+
+	private:
+		Queue queue;
+		CasSelector &selector;
+		int index;
+
+		// 阻塞队列有TryConsume/TryProduct，非阻塞队列的Consume/Product本身不阻塞
+		template <class Q, class = void>
+		struct __HasTryConsume : std::false_type {};
+
+		template <class Q>
+		struct __HasTryConsume<Q, std::void_t<decltype(std::declval<Q &>().TryConsume(std::declval<T &>()))>> : std::true_type {};
+
+		template <class U>
+		inline bool __TryProduct(U &&t_product)
+		{
+			if constexpr (true == __HasTryConsume<Queue>::value)
+				return queue.TryProduct(std::forward<U>(t_product));
+			else
+				return queue.Product(std::forward<U>(t_product));
+		}
+};
+
+template <class T, class Queue>
+inline bool __CasSelectTryConsume(void *p_queue, void *p_data)
+{
+	return static_cast<CasSelectQueue<T, Queue> *>(p_queue)->TryConsume(*static_cast<T *>(p_data));
+}
+
+// 生成一个Select分支：queue有数据时取到t_consume中
+template <class T, class Queue>
+inline CasSelectCase CasOn(CasSelectQueue<T, Queue> &queue, T &t_consume)
+{
+	return CasSelectCase {queue.Index(), &queue, &t_consume, &__CasSelectTryConsume<T, Queue>};
+}
+
+// 阻塞直到某个分支取到数据，返回分支在参数中的序号(从0开始)；选择器关闭且所有队列都空时返回-1
+template <class... Cases>
+inline int CasSelect(CasSelector &selector, const Cases &... cases)
+{
+	const CasSelectCase select_cases[] = {cases...};
+	return selector.Select(select_cases, sizeof...(Cases));
+}
+
+// 不阻塞，所有队列都空时返回-1
+template <class... Cases>
+inline int CasTrySelect(CasSelector &selector, const Cases &... cases)
+{
+	const CasSelectCase select_cases[] = {cases...};
+	return selector.TrySelect(select_cases, sizeof...(Cases));
+}
+
+// 限时等待，超时时返回-1，可用selector.IsClosed()区分超时与关闭
+template <class Rep, class Period, class... Cases>
+inline int CasSelectFor(CasSelector &selector, const std::chrono::duration<Rep, Period> &timeout, const Cases &... cases)
+{
+	const CasSelectCase select_cases[] = {cases...};
+	return selector.SelectUntil(select_cases, sizeof...(Cases), std::chrono::steady_clock::now() + timeout);
+}
+
+#endif
@@ -0,0 +1,523 @@
+#ifndef __CAS_SHM_QUEUE__
+#define __CAS_SHM_QUEUE__
+
+#include <fcntl.h>
+#include <errno.h>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cas_queue.hxx"
+
+/*
+ * 	【跨进程共享内存队列】
+ *
+ * 队列头(索引、等待字)和entry数组放在一块shm_open或文件映射的内存中，由一个进程Create，其它进程按名字Attach
+ * 各进程映射到的地址不同，共享内存中只保存entry数组相对队列头的偏移量，不保存任何指针
+ * 生产/消费协议与非阻塞队列相同(entry序号seq)，阻塞队列在队列头的等待字上使用跨进程的futex
+ * 数据按字节拷贝进出共享内存，只支持可平凡拷贝(trivially copyable)的数据类型
+ * 队列头和entry位于其它进程也会映射的内存中，不在其中构造std::atomic对象，
+ * 索引、seq和等待字是按自然边界对齐的普通整数，统一用显式内存序的__atomic内建函数访问(与std::atomic_ref等价，不依赖C++20)
+ *
+ */
+
+// 共享内存的映射方式，可以按位组合
+enum cas_shm_flag
+{
+	CAS_SHM_DEFAULT = 0,	// name为shm_open的名字，形如"/queue_name"
+	CAS_SHM_FILE = 1,	// name为文件路径，可以是普通文件，也可以是hugetlbfs上的文件
+	CAS_SHM_HUGEPAGE = 2	// 映射长度按2MB对齐并建议内核使用大页，映射hugetlbfs上的文件时必须使用
+};
+
+template <class T>
+class __CasShmRing
+{
+	public:
+		enum {MAGIC = 0x43415351, HUGEPAGE_SIZE = 2 * 1024 * 1024};
+
+		typedef struct
+		{
+			unsigned long seq;  // 与非阻塞队列相同，seq == 票号表示可生产，seq == 票号 + 1表示可消费
+			T data;
+		} ENTRY;
+
+		typedef struct
+		{
+			unsigned int magic;  // 创建者初始化完成后最后写入，Attach时据此判断队列是否可用
+			unsigned int entry_size;  // sizeof(ENTRY)，Attach时校验两端的数据类型是否一致
+			unsigned int size;  // entry个数，2的N次幂
+			unsigned long map_size;  // 映射的总长度
+			unsigned long data_offset;  // entry数组相对队列头的偏移量
+			unsigned long product_index __attribute__((aligned(64)));
+			unsigned long consume_index __attribute__((aligned(64)));
+			unsigned int product_sleep __attribute__((aligned(64)));  // 阻塞等待空entry的生产者个数
+			int product_signal;  // 阻塞的生产者睡眠在该futex等待字上
+			unsigned int consume_sleep __attribute__((aligned(64)));  // 阻塞等待数据的消费者个数
+			int consume_signal;  // 阻塞的消费者睡眠在该futex等待字上
+		} HEADER;
+
+		static_assert(std::is_trivially_copyable<T>::value, "shared memory queue requires a trivially copyable type");
+
+		HEADER *p_header;
+		ENTRY *p_queue;  // 本进程中entry数组的地址，由p_header和data_offset算出
+
+		__CasShmRing()
+		{
+			p_header = NULL;
+			p_queue = NULL;
+		}
+
+		~__CasShmRing()
+		{
+			Detach();
+		}
+
+		// 创建并初始化共享内存队列，同名队列已存在时返回false
+		bool Create(const char *name, int queue_size, int flags)
+		{
+			if (NULL != p_header)
+				return false;
+
+			unsigned int size = pow(2, (ceil(log2(queue_size))));
+			if (size < 2)
+				size = 2;  // 序号协议至少需要两个entry才能区分空和满
+
+			unsigned long data_offset = (sizeof(HEADER) + 63) & ~63UL;
+			unsigned long map_size = data_offset + sizeof(ENTRY) * size;
+			if (0 != (flags & CAS_SHM_HUGEPAGE))
+				map_size = (map_size + HUGEPAGE_SIZE - 1) & ~(unsigned long)(HUGEPAGE_SIZE - 1);
+
+			int fd = __Open(name, flags, O_RDWR | O_CREAT | O_EXCL);
+			if (fd < 0)
+				return false;
+
+			if (0 != ftruncate(fd, map_size) || false == __Map(fd, map_size, flags))
+			{
+				close(fd);
+				Unlink(name, flags);
+				return false;
+			}
+			close(fd);
+
+			// 新建的映射内容全为0，只需初始化第一圈的序号
+			p_header->entry_size = sizeof(ENTRY);
+			p_header->size = size;
+			p_header->map_size = map_size;
+			p_header->data_offset = data_offset;
+			p_queue = (ENTRY *)((char *)p_header + data_offset);
+			for (unsigned long ii = 0; ii < size; ++ii)
+			{
+				p_queue[ii].seq = ii;
+			}
+
+			__atomic_store_n(&p_header->magic, MAGIC, __ATOMIC_RELEASE);
+
+			return true;
+		}
+
+		// 按名字映射其它进程创建的队列，队列不存在、尚未初始化完成、数据类型不一致或队列头损坏时返回false
+		bool Attach(const char *name, int flags)
+		{
+			if (NULL != p_header)
+				return false;
+
+			int fd = __Open(name, flags, O_RDWR);
+			if (fd < 0)
+				return false;
+
+			struct stat file_stat;
+			bool is_map = 0 == fstat(fd, &file_stat) && (unsigned long)file_stat.st_size >= sizeof(HEADER) && true == __Map(fd, file_stat.st_size, flags);
+			close(fd);
+			if (false == is_map)
+				return false;
+
+			if (MAGIC != __atomic_load_n(&p_header->magic, __ATOMIC_ACQUIRE) || sizeof(ENTRY) != p_header->entry_size || (unsigned long)file_stat.st_size != p_header->map_size
+				|| false == __IsValidLayout(p_header->size, p_header->data_offset, p_header->map_size))
+			{
+				munmap(p_header, file_stat.st_size);
+				p_header = NULL;
+				return false;
+			}
+
+			p_queue = (ENTRY *)((char *)p_header + p_header->data_offset);
+
+			return true;
+		}
+
+		// 解除本进程的映射，共享内存本身要等Unlink且所有进程都解除映射后才释放
+		void Detach()
+		{
+			if (NULL == p_header)
+				return;
+
+			munmap(p_header, p_header->map_size);
+			p_header = NULL;
+			p_queue = NULL;
+		}
+
+		static bool Unlink(const char *name, int flags)
+		{
+			return 0 == (0 != (flags & CAS_SHM_FILE) ? unlink(name) : shm_unlink(name));
+		}
+
+		inline ENTRY *Entry(unsigned long __index)
+		{
+			return &p_queue[__index & (p_header->size - 1)];
+		}
+
+		unsigned long ApproxSize()
+		{
+			long count = (long)(__atomic_load_n(&p_header->product_index, __ATOMIC_RELAXED) - __atomic_load_n(&p_header->consume_index, __ATOMIC_RELAXED));
+			if (count < 0)
+				return 0;  // 两个索引先后读取，期间消费者可能已经追上
+
+			return count < (long)p_header->size ? count : p_header->size;
+		}
+
+	private:
+		static int __Open(const char *name, int flags, int oflag)
+		{
+			return 0 != (flags & CAS_SHM_FILE) ? open(name, oflag, 0600) : shm_open(name, oflag, 0600);
+		}
+
+		// 损坏的或其它程序的共享内存中entry个数不是2的N次幂、或entry数组超出映射范围时不能使用，否则取模和下标会越界
+		static bool __IsValidLayout(unsigned int size, unsigned long data_offset, unsigned long map_size)
+		{
+			if (size < 2 || 0 != (size & (size - 1)))
+				return false;
+
+			if (data_offset < sizeof(HEADER) || 0 != data_offset % alignof(ENTRY) || data_offset > map_size)
+				return false;
+
+			return (unsigned long)size * sizeof(ENTRY) <= map_size - data_offset;
+		}
+
+		bool __Map(int fd, unsigned long map_size, int flags)
+		{
+			void *addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (MAP_FAILED == addr)
+				return false;
+
+			// tmpfs上的映射只有在内核允许shmem透明大页时才会生效，失败不影响使用
+			if (0 != (flags & CAS_SHM_HUGEPAGE))
+				madvise(addr, map_size, MADV_HUGEPAGE);
+
+			p_header = (HEADER *)addr;
+
+			return true;
+		}
+};
+
+// 跨进程多生产者多消费者非阻塞队列
+template <class T>
+class CasShmQueueNoBlockMPMC
+{
+	public:
+		typedef T VALUE;
+
+		bool Create(const char *name, int queue_size, int flags = CAS_SHM_DEFAULT)
+		{
+			return ring.Create(name, queue_size, flags);
+		}
+
+		bool Attach(const char *name, int flags = CAS_SHM_DEFAULT)
+		{
+			return ring.Attach(name, flags);
+		}
+
+		void Detach()
+		{
+			ring.Detach();
+		}
+
+		static bool Unlink(const char *name, int flags = CAS_SHM_DEFAULT)
+		{
+			return __CasShmRing<T>::Unlink(name, flags);
+		}
+
+		// 只有确认票号对应的entry为空后才用cas推进product_index，队列满时返回false且不消耗票号
+		bool Product(const T &t_product)
+		{
+			unsigned long *product_index = &ring.p_header->product_index;
+			unsigned long current_product_index = __atomic_load_n(product_index, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				unsigned long seq = __atomic_load_n(&ring.Entry(current_product_index)->seq, __ATOMIC_ACQUIRE);
+				long diff = (long)(seq - current_product_index);
+				if (0 == diff)
+				{
+					// 失败时current_product_index被更新为最新的票号，被其它生产者抢先时用它重试
+					if (true == __atomic_compare_exchange_n(product_index, &current_product_index, current_product_index + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;  // queue is full
+				}
+				else  // 其它生产者已经领取了该票号
+				{
+					current_product_index = __atomic_load_n(product_index, __ATOMIC_RELAXED);
+				}
+			}
+
+			typename __CasShmRing<T>::ENTRY *p_entry = ring.Entry(current_product_index);
+			p_entry->data = t_product;
+			__atomic_store_n(&p_entry->seq, current_product_index + 1, __ATOMIC_RELEASE);
+
+			return true;
+		}
+
+		// 只有确认票号对应的entry有数据后才用cas推进consume_index，队列空时返回false且不消耗票号
+		bool Consume(T &t_consume)
+		{
+			unsigned long *consume_index = &ring.p_header->consume_index;
+			unsigned long current_consume_index = __atomic_load_n(consume_index, __ATOMIC_RELAXED);
+			for (;;)
+			{
+				unsigned long seq = __atomic_load_n(&ring.Entry(current_consume_index)->seq, __ATOMIC_ACQUIRE);
+				long diff = (long)(seq - (current_consume_index + 1));
+				if (0 == diff)
+				{
+					// 失败时current_consume_index被更新为最新的票号，被其它消费者抢先时用它重试
+					if (true == __atomic_compare_exchange_n(consume_index, &current_consume_index, current_consume_index + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;  // queue is empty
+				}
+				else  // 其它消费者已经领取了该票号
+				{
+					current_consume_index = __atomic_load_n(consume_index, __ATOMIC_RELAXED);
+				}
+			}
+
+			typename __CasShmRing<T>::ENTRY *p_entry = ring.Entry(current_consume_index);
+			t_consume = p_entry->data;
+			__atomic_store_n(&p_entry->seq, current_consume_index + ring.p_header->size, __ATOMIC_RELEASE);
+
+			return true;
+		}
+
+		unsigned long ApproxSize()
+		{
+			return ring.ApproxSize();
+		}
+
+		typename __CasShmRing<T>::HEADER *Header()
+		{
+			return ring.p_header;
+		}
+
+	private:
+		__CasShmRing<T> ring;
+};
+
+// 跨进程单生产者单消费者非阻塞队列，所有进程中同时只能有一个生产者和一个消费者
+template <class T>
+class CasShmQueueNoBlockOPOC
+{
+	public:
+		typedef T VALUE;
+
+		bool Create(const char *name, int queue_size, int flags = CAS_SHM_DEFAULT)
+		{
+			return ring.Create(name, queue_size, flags);
+		}
+
+		bool Attach(const char *name, int flags = CAS_SHM_DEFAULT)
+		{
+			return ring.Attach(name, flags);
+		}
+
+		void Detach()
+		{
+			ring.Detach();
+		}
+
+		static bool Unlink(const char *name, int flags = CAS_SHM_DEFAULT)
+		{
+			return __CasShmRing<T>::Unlink(name, flags);
+		}
+
+		// 只有一个生产者，不需要cas，product_index只由生产者自己写
+		bool Product(const T &t_product)
+		{
+			unsigned long current_product_index = __atomic_load_n(&ring.p_header->product_index, __ATOMIC_RELAXED);
+			typename __CasShmRing<T>::ENTRY *p_entry = ring.Entry(current_product_index);
+			if (current_product_index != __atomic_load_n(&p_entry->seq, __ATOMIC_ACQUIRE))
+				return false;  // queue is full
+
+			__atomic_store_n(&ring.p_header->product_index, current_product_index + 1, __ATOMIC_RELAXED);
+			p_entry->data = t_product;
+			__atomic_store_n(&p_entry->seq, current_product_index + 1, __ATOMIC_RELEASE);
+
+			return true;
+		}
+
+		bool Consume(T &t_consume)
+		{
+			unsigned long current_consume_index = __atomic_load_n(&ring.p_header->consume_index, __ATOMIC_RELAXED);
+			typename __CasShmRing<T>::ENTRY *p_entry = ring.Entry(current_consume_index);
+			if (current_consume_index + 1 != __atomic_load_n(&p_entry->seq, __ATOMIC_ACQUIRE))
+				return false;  // queue is empty
+
+			__atomic_store_n(&ring.p_header->consume_index, current_consume_index + 1, __ATOMIC_RELAXED);
+			t_consume = p_entry->data;
+			__atomic_store_n(&p_entry->seq, current_consume_index + ring.p_header->size, __ATOMIC_RELEASE);
+
+			return true;
+		}
+
+		unsigned long ApproxSize()
+		{
+			return ring.ApproxSize();
+		}
+
+		typename __CasShmRing<T>::HEADER *Header()
+		{
+			return ring.p_header;
+		}
+
+	private:
+		__CasShmRing<T> ring;
+};
+
+/*
+ * 跨进程阻塞队列，在非阻塞队列基础上增加等待：队列满时生产者、队列空时消费者睡眠在队列头的futex等待字上
+ * 等待字位于共享内存中，使用非PRIVATE的futex，可以唤醒其它进程中的线程
+ * 限时等待每次最多挂起10ms，对方进程异常退出后限时等待仍会按时返回
+ */
+template <class Q>
+class __CasShmBlockQueue
+{
+	public:
+		typedef typename Q::VALUE T;
+
+		bool Create(const char *name, int queue_size, int flags = CAS_SHM_DEFAULT)
+		{
+			return queue.Create(name, queue_size, flags);
+		}
+
+		bool Attach(const char *name, int flags = CAS_SHM_DEFAULT)
+		{
+			return queue.Attach(name, flags);
+		}
+
+		void Detach()
+		{
+			queue.Detach();
+		}
+
+		static bool Unlink(const char *name, int flags = CAS_SHM_DEFAULT)
+		{
+			return Q::Unlink(name, flags);
+		}
+
+		void Product(const T &t_product)
+		{
+			__Wait(queue.Header()->product_sleep, queue.Header()->product_signal, [&]() { return queue.Product(t_product); }, std::chrono::steady_clock::time_point::max());
+			__Awake(queue.Header()->consume_sleep, queue.Header()->consume_signal);
+		}
+
+		void Consume(T &t_consume)
+		{
+			__Wait(queue.Header()->consume_sleep, queue.Header()->consume_signal, [&]() { return queue.Consume(t_consume); }, std::chrono::steady_clock::time_point::max());
+			__Awake(queue.Header()->product_sleep, queue.Header()->product_signal);
+		}
+
+		bool TryProduct(const T &t_product)
+		{
+			if (false == queue.Product(t_product))
+				return false;
+
+			__Awake(queue.Header()->consume_sleep, queue.Header()->consume_signal);
+			return true;
+		}
+
+		bool TryConsume(T &t_consume)
+		{
+			if (false == queue.Consume(t_consume))
+				return false;
+
+			__Awake(queue.Header()->product_sleep, queue.Header()->product_signal);
+			return true;
+		}
+
+		// 队列满时最多等待timeout，超时返回false
+		template <class Rep, class Period>
+		bool TryProductFor(const T &t_product, const std::chrono::duration<Rep, Period> &timeout)
+		{
+			if (false == __Wait(queue.Header()->product_sleep, queue.Header()->product_signal, [&]() { return queue.Product(t_product); }, std::chrono::steady_clock::now() + timeout))
+				return false;
+
+			__Awake(queue.Header()->consume_sleep, queue.Header()->consume_signal);
+			return true;
+		}
+
+		// 队列空时最多等待timeout，超时返回false
+		template <class Rep, class Period>
+		bool TryConsumeFor(T &t_consume, const std::chrono::duration<Rep, Period> &timeout)
+		{
+			if (false == __Wait(queue.Header()->consume_sleep, queue.Header()->consume_signal, [&]() { return queue.Consume(t_consume); }, std::chrono::steady_clock::now() + timeout))
+				return false;
+
+			__Awake(queue.Header()->product_sleep, queue.Header()->product_signal);
+			return true;
+		}
+
+		unsigned long ApproxSize()
+		{
+			return queue.ApproxSize();
+		}
+
+	private:
+		Q queue;
+
+		// 反复尝试直到成功或到达deadline，登记睡眠后再尝试一次，避免在尝试与睡眠之间错过唤醒
+		template <class F, class Clock, class Duration>
+		inline bool __Wait(unsigned int &sleep, int &signal, F try_once, const std::chrono::time_point<Clock, Duration> &deadline)
+		{
+			while (false == try_once())
+			{
+				__atomic_fetch_add(&sleep, 1, __ATOMIC_SEQ_CST);
+				int current_signal = __atomic_load_n(&signal, __ATOMIC_ACQUIRE);
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				bool is_done = try_once();
+				bool is_wake = true;
+				if (false == is_done && std::chrono::time_point<Clock, Duration>::max() == deadline)
+					__CasFutexWait(&signal, current_signal, true);  // 不限时，Product/Consume
+				else if (false == is_done)
+					is_wake = __CasFutexWaitUntil(&signal, current_signal, deadline, true);
+				__atomic_fetch_sub(&sleep, 1, __ATOMIC_RELAXED);
+
+				if (true == is_done)
+					break;
+
+				if (false == is_wake)
+					return false;
+			}
+
+			return true;
+		}
+
+		// 有线程睡眠时才唤醒，先用全屏障保证前面发布的entry与对sleep的读取不会乱序
+		inline void __Awake(unsigned int &sleep, int &signal)
+		{
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (0 != __atomic_load_n(&sleep, __ATOMIC_RELAXED))
+			{
+				__atomic_fetch_add(&signal, 1, __ATOMIC_RELEASE);
+				__CasFutexWake(&signal, INT_MAX, true);
+			}
+		}
+};
+
+// 跨进程多生产者多消费者阻塞队列
+template <class T>
+class CasShmQueueMPMC : public __CasShmBlockQueue<CasShmQueueNoBlockMPMC<T> > {};
+
+// 跨进程单生产者单消费者阻塞队列
+template <class T>
+class CasShmQueueOPOC : public __CasShmBlockQueue<CasShmQueueNoBlockOPOC<T> > {};
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef __CAS_SPILL_QUEUE__
+#define __CAS_SPILL_QUEUE__
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string>
+#include <type_traits>
+#include "cas_queue.hxx"
+
+/*
+ * 	【队列满时溢出到磁盘的队列】
+ *
+ * 平时只使用内存中的非阻塞队列，生产者发现队列满时切换到溢出状态，之后所有生产者把数据顺序追加到
+ * mmap的段文件中，而不是阻塞或丢弃；消费者先取内存队列，再按写入顺序读回段文件，读空后切回内存
+ * 长时间的下游停顿只消耗磁盘带宽：段文件创建并映射后立即unlink，脏页由内核成批顺序回写，
+ * 读完一个段即munmap释放，进程退出时不留下文件
+ *
+ * 同一生产者的数据按生产顺序被消费：生产者进入溢出之前领取的内存队列票号，对之后持锁读文件的消费者可见，
+ * 消费者在锁内发现内存队列还有已领取的票号时先取内存队列
+ * 只允许一个线程消费，生产者个数由Queue决定
+ *
+ */
+
+/*
+ * 	【序列化器，作为CasSpillQueue的第三个模板参数】
+ *
+ * Size(t)		: 序列化后的字节数
+ * Write(t, p)		: 把t写入p开始的Size(t)个字节
+ * Read(t, p, length)	: 从p开始的length个字节读回t
+ *
+ * 默认按字节拷贝，只能用于可平凡拷贝的T
+ */
+template <class T>
+struct CasSpillPod
+{
+	static_assert(std::is_trivially_copyable<T>::value, "CasSpillPod requires trivially copyable T, supply a serializer");
+
+	unsigned int Size(const T &t)
+	{
+		return sizeof(T);
+	}
+
+	void Write(const T &t, char *p_buffer)
+	{
+		memcpy(p_buffer, &t, sizeof(T));
+	}
+
+	void Read(T &t, const char *p_buffer, unsigned int length)
+	{
+		memcpy(&t, p_buffer, sizeof(T));
+	}
+};
+
+template <class T, class Queue = CasQueueNoBlockMPOC<T>, class Serializer = CasSpillPod<T> >
+class CasSpillQueue
+{
+	public:
+		/*
+		 * spill_dir为段文件所在的目录，segment_bytes为每个段文件的大小（单条数据更大时该段按数据大小分配）
+		 * max_spill_bytes为溢出数据的上限，超过后生产失败，为0时不限制
+		 */
+		CasSpillQueue(int queue_size = 16384, const char *spill_dir = "/tmp", unsigned long segment_bytes = 64UL << 20, unsigned long max_spill_bytes = 0)
+			: queue(queue_size), spill_dir(spill_dir)
+		{
+			this->segment_bytes = segment_bytes;
+			this->max_spill_bytes = max_spill_bytes;
+			state.store(MEMORY, std::memory_order_relaxed);
+			p_read = p_write = NULL;
+			read_offset = 0;
+			spill_bytes = 0;
+			segment_serial = 0;
+			spill_count.store(0, std::memory_order_relaxed);
+			spill_total.store(0, std::memory_order_relaxed);
+			pthread_mutex_init(&mutex, NULL);
+		}
+
+		virtual ~CasSpillQueue()
+		{
+			while (NULL != p_read)
+			{
+				SEGMENT *p_next = p_read->next;
+				__FreeSegment(p_read);
+				p_read = p_next;
+			}
+
+			pthread_mutex_destroy(&mutex);
+		}
+
+		// 内存队列满时溢出到段文件，只有超过max_spill_bytes或段文件创建失败时返回false
+		bool Product(const T &t_product)
+		{
+			if (MEMORY == state.load(std::memory_order_acquire) && true == queue.Product(t_product))
+				return true;
+
+			return 1 == __Spill(&t_product, 1);
+		}
+
+		// 先批量写入内存队列，剩余的数据在一次加锁中顺序追加到段文件，返回实际生产的个数
+		unsigned long ProductBulk(const T *t_products, unsigned long n)
+		{
+			unsigned long count = 0;
+			if (MEMORY == state.load(std::memory_order_acquire))
+			{
+				count = queue.ProductBulk(t_products, n);
+				if (count == n)
+					return count;
+			}
+
+			return count + __Spill(t_products + count, n - count);
+		}
+
+		// 先取内存队列，内存队列空且处于溢出状态时按写入顺序读段文件，都为空时返回false
+		bool Consume(T &t_consume)
+		{
+			return 1 == ConsumeBulk(&t_consume, 1);
+		}
+
+		// 最多取max个数据，返回实际取到的个数
+		unsigned long ConsumeBulk(T *t_consumes, unsigned long max)
+		{
+			unsigned long count = queue.ConsumeBulk(t_consumes, max);
+			if (count == max || MEMORY == state.load(std::memory_order_acquire))
+				return count;
+
+			pthread_mutex_lock(&mutex);
+			while (count < max)
+			{
+				// 内存队列中还有已领取的票号，是某个生产者进入溢出之前写的，先于该生产者在段文件中的数据
+				if (0 != queue.ApproxSize())
+				{
+					unsigned long ring_count = queue.ConsumeBulk(t_consumes + count, max - count);
+					if (0 == ring_count)
+						break;  // 票号已领取但数据还未发布，稍后再取
+
+					count += ring_count;
+					continue;
+				}
+
+				if (false == __ReadSpill(t_consumes[count]))
+				{
+					// 段文件已读空，释放最后一个段，之后的生产者回到内存队列
+					if (NULL != p_read)
+						__FreeSegment(p_read);
+					p_read = NULL;
+					state.store(MEMORY, std::memory_order_release);
+					break;
+				}
+
+				++count;
+			}
+			pthread_mutex_unlock(&mutex);
+
+			return count;
+		}
+
+		// 内存队列与段文件中的数据个数，并发时只作为监控参考
+		unsigned long ApproxSize()
+		{
+			return queue.ApproxSize() + spill_count.load(std::memory_order_relaxed);
+		}
+
+		// 段文件中尚未读回的数据个数
+		unsigned long SpillCount()
+		{
+			return spill_count.load(std::memory_order_relaxed);
+		}
+
+		// 累计溢出到段文件的数据个数
+		unsigned long SpillTotal()
+		{
+			return spill_total.load(std::memory_order_relaxed);
+		}
+
+		bool IsSpilling()
+		{
+			return SPILL == state.load(std::memory_order_acquire);
+		}
+
+	private:
+		/*
+		 * 	【队列状态】
+		 *
+		 * MEMORY	0: 生产者写内存队列，队列满时加锁切换到SPILL
+		 * SPILL	1: 生产者追加到段文件，消费者读空段文件后在锁内切换回MEMORY
+		 *
+		 */
+		enum spill_state {MEMORY = 0, SPILL};
+
+		// 每条记录为4字节长度加序列化后的数据，长度为SEGMENT_END表示该段已写完
+		static constexpr unsigned int SEGMENT_END = 0xffffffff;
+
+		typedef struct SEGMENT
+		{
+			SEGMENT *next;
+			char *p_base;
+			unsigned long bytes;
+			unsigned long write_offset;
+		} SEGMENT;
+
+		// 持锁追加n个数据，返回追加的个数；读空切回MEMORY后的生产者改写内存队列
+		unsigned long __Spill(const T *t_products, unsigned long n)
+		{
+			unsigned long count = 0;
+			unsigned long spilled = 0;
+			pthread_mutex_lock(&mutex);
+			while (count < n)
+			{
+				if (MEMORY == state.load(std::memory_order_relaxed))
+				{
+					if (true == queue.Product(t_products[count]))
+					{
+						++count;
+						continue;
+					}
+
+					state.store(SPILL, std::memory_order_release);
+				}
+
+				unsigned int length = serializer.Size(t_products[count]);
+				unsigned long record_bytes = sizeof(unsigned int) + length;
+				if (0 != max_spill_bytes && spill_bytes + record_bytes > max_spill_bytes)
+					break;
+
+				if (NULL == p_write || p_write->write_offset + record_bytes > p_write->bytes)
+				{
+					if (false == __NewSegment(record_bytes))
+						break;
+				}
+
+				char *p_record = p_write->p_base + p_write->write_offset;
+				memcpy(p_record, &length, sizeof(unsigned int));
+				serializer.Write(t_products[count], p_record + sizeof(unsigned int));
+				p_write->write_offset += record_bytes;
+				spill_bytes += record_bytes;
+				++spilled;
+				++count;
+			}
+
+			spill_count.fetch_add(spilled, std::memory_order_relaxed);
+			spill_total.fetch_add(spilled, std::memory_order_relaxed);
+			pthread_mutex_unlock(&mutex);
+
+			return count;
+		}
+
+		// 持锁读回一条记录，读完的段立即释放；段文件为空时返回false
+		bool __ReadSpill(T &t_consume)
+		{
+			while (NULL != p_read)
+			{
+				if (read_offset + sizeof(unsigned int) <= p_read->write_offset)
+				{
+					unsigned int length;
+					memcpy(&length, p_read->p_base + read_offset, sizeof(unsigned int));
+					if (SEGMENT_END != length)
+					{
+						serializer.Read(t_consume, p_read->p_base + read_offset + sizeof(unsigned int), length);
+						read_offset += sizeof(unsigned int) + length;
+						spill_bytes -= sizeof(unsigned int) + length;
+						spill_count.fetch_sub(1, std::memory_order_relaxed);
+						return true;
+					}
+				}
+
+				if (p_read == p_write)
+					return false;  // 正在写的段已读完
+
+				SEGMENT *p_next = p_read->next;
+				__FreeSegment(p_read);
+				p_read = p_next;
+				read_offset = 0;
+			}
+
+			return false;
+		}
+
+		// 当前段放不下时在段尾写结束标记，创建新段文件并映射，之后立即unlink
+		bool __NewSegment(unsigned long record_bytes)
+		{
+			unsigned long page_size = sysconf(_SC_PAGESIZE);
+			unsigned long bytes = record_bytes + sizeof(unsigned int) > segment_bytes ? record_bytes + sizeof(unsigned int) : segment_bytes;
+			bytes = (bytes + page_size - 1) & ~(page_size - 1);
+
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/cas_spill.%d.%p.%lu", spill_dir.c_str(), (int)getpid(), (void *)this, segment_serial++);
+			int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+			if (fd < 0)
+				return false;
+
+			void *p = MAP_FAILED;
+			if (0 == ftruncate(fd, bytes))
+				p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			unlink(path);
+			if (MAP_FAILED == p)
+				return false;
+
+			madvise(p, bytes, MADV_SEQUENTIAL);
+
+			SEGMENT *p_segment = new SEGMENT;
+			p_segment->next = NULL;
+			p_segment->p_base = (char *)p;
+			p_segment->bytes = bytes;
+			p_segment->write_offset = 0;
+
+			if (NULL == p_write)
+			{
+				p_read = p_write = p_segment;
+				read_offset = 0;
+			}
+			else
+			{
+				if (p_write->write_offset + sizeof(unsigned int) <= p_write->bytes)
+				{
+					unsigned int end = SEGMENT_END;
+					memcpy(p_write->p_base + p_write->write_offset, &end, sizeof(unsigned int));
+					p_write->write_offset += sizeof(unsigned int);
+				}
+
+				p_write->next = p_segment;
+				p_write = p_segment;
+			}
+
+			return true;
+		}
+
+		void __FreeSegment(SEGMENT *p_segment)
+		{
+			if (p_segment == p_write)
+				p_write = NULL;
+
+			munmap(p_segment->p_base, p_segment->bytes);
+			delete p_segment;
+		}
+
+		Queue queue;
+		Serializer serializer;
+		std::string spill_dir;
+		unsigned long segment_bytes;
+		unsigned long max_spill_bytes;
+
+		std::atomic<spill_state> state __attribute__((aligned(64)));  // 生产者的快速路径只读state
+
+		// 以下由mutex保护
+		pthread_mutex_t mutex __attribute__((aligned(64)));
+		SEGMENT *p_read;
+		SEGMENT *p_write;
+		unsigned long read_offset;
+		unsigned long spill_bytes;
+		unsigned long segment_serial;
+
+		std::atomic<unsigned long> spill_count;
+		std::atomic<unsigned long> spill_total;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "cas_queue.hxx"
+
+// 大队列在不同分配策略下的构造耗时、第一圈(首次写入entry)和第二圈的耗时与缺页次数
+// 用法: ./alloc [entry个数]
+
+struct Quote
+{
+	long seq;
+	long price[7];
+};
+
+// 自定义分配策略：从启动时预留的内存池中顺序分配，不释放
+struct ArenaAlloc
+{
+	static char *p_arena;
+	static size_t arena_size;
+	static size_t arena_used;
+
+	void *Allocate(size_t bytes, size_t align)
+	{
+		size_t offset = (arena_used + align - 1) & ~(align - 1);
+		if (offset + bytes > arena_size)
+			throw std::bad_alloc();
+
+		arena_used = offset + bytes;
+		return p_arena + offset;
+	}
+
+	void Deallocate(void *p, size_t bytes, size_t align)
+	{
+	}
+
+	bool IsZeroed()
+	{
+		return false;
+	}
+};
+
+char *ArenaAlloc::p_arena = NULL;
+size_t ArenaAlloc::arena_size = 0;
+size_t ArenaAlloc::arena_used = 0;
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+inline long minor_faults()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt;
+}
+
+// 单线程写满整个队列再取空，每一圈都经过所有entry
+template <class Q>
+bool lap(Q &queue, long count, long &seq)
+{
+	Quote quote = {};
+	for (long ii = 0; ii < count; ++ii)
+	{
+		quote.seq = seq + ii;
+		if (false == queue.Product(quote))
+			return false;
+	}
+
+	for (long ii = 0; ii < count; ++ii)
+	{
+		if (false == queue.Consume(quote) || quote.seq != seq + ii)
+			return false;
+	}
+
+	seq += count;
+	return true;
+}
+
+template <class Q>
+bool run(const char *name, long count)
+{
+	double start = now();
+	long start_faults = minor_faults();
+	Q *p_queue = new Q(count);
+	double construct_time = now() - start;
+	long construct_faults = minor_faults() - start_faults;
+
+	long seq = 0;
+	start = now();
+	start_faults = minor_faults();
+	bool is_ok = lap(*p_queue, count, seq);
+	double first_time = now() - start;
+	long first_faults = minor_faults() - start_faults;
+
+	start = now();
+	start_faults = minor_faults();
+	is_ok = lap(*p_queue, count, seq) && is_ok;
+	double second_time = now() - start;
+	long second_faults = minor_faults() - start_faults;
+
+	delete p_queue;
+
+	printf("%-28s construct %7.3f ms %7ld faults | first lap %7.3f ms %7ld faults | second lap %7.3f ms %7ld faults | %s\n", name,
+			construct_time * 1000, construct_faults, first_time * 1000, first_faults, second_time * 1000, second_faults, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	long count = argc > 1 ? atol(argv[1]) : 1 << 20;
+
+	ArenaAlloc::arena_size = count * 2 * 128 + 4096;
+	ArenaAlloc::p_arena = (char *)malloc(ArenaAlloc::arena_size);
+
+	printf("entries %ld, entry data %lu bytes\n", count, sizeof(Quote));
+
+	bool is_ok = true;
+	is_ok = run<CasQueueNoBlockOPOC<Quote> >("NoBlockOPOC new", count) && is_ok;
+	is_ok = run<CasQueueNoBlockOPOC<Quote, CasLayoutCompact, CasStatsNone, CasAllocMmap<CAS_PAGE_DEFAULT> > >("NoBlockOPOC mmap prefault", count) && is_ok;
+	is_ok = run<CasQueueNoBlockOPOC<Quote, CasLayoutCompact, CasStatsNone, CasAllocHuge> >("NoBlockOPOC huge prefault", count) && is_ok;
+	is_ok = run<CasQueueOPOC<Quote> >("OPOC new", count) && is_ok;
+	is_ok = run<CasQueueOPOC<Quote, CasLayoutSplit> >("OPOC split new", count) && is_ok;
+	is_ok = run<CasQueueOPOC<Quote, CasLayoutSplit, CasWaitPark, CasStatsNone, CasAllocHugeLocked> >("OPOC split huge locked", count) && is_ok;
+	is_ok = run<CasQueueOPOC<Quote, CasLayoutCompact, CasWaitPark, CasStatsNone, ArenaAlloc> >("OPOC arena", count) && is_ok;
+
+	free(ArenaAlloc::p_arena);
+
+	printf("%s\n", true == is_ok ? "ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_broadcast_queue.hxx"
+
+// 一个行情线程扇出给日志、风控、策略三个消费者，策略只处理风控检查过的数据
+// 对比三个CasQueueOPOC逐个拷贝入队与一个广播队列
+// 用法: ./broadcast [消息个数]
+
+struct Tick
+{
+	long seq;
+	long price;
+	char symbol[48];
+};
+
+enum consumer_role {LOGGER = 0, RISK, STRATEGY, ROLE_NUM};
+const char *role_name[ROLE_NUM] = {"logger", "risk", "strategy"};
+
+long tick_count = 5000000;
+unsigned char *risk_checked;  // 风控检查过的序号，策略读到的数据必须已被风控检查过
+
+typedef struct
+{
+	int role;
+	int id;
+	long count;
+	long sum;
+	bool is_ok;
+} ROLE_ARG;
+
+// 按顺序检查每个角色读到的数据，风控先标记再推进游标
+inline void handle_tick(ROLE_ARG *role_arg, const Tick &tick)
+{
+	if (tick.seq != role_arg->count + 1 || tick.price != tick.seq * 3)
+		role_arg->is_ok = false;
+
+	if (RISK == role_arg->role)
+		risk_checked[tick.seq] = 1;
+	else if (STRATEGY == role_arg->role && 0 == risk_checked[tick.seq])
+		role_arg->is_ok = false;
+
+	role_arg->sum += tick.price;
+	++role_arg->count;
+}
+
+inline void fill_tick(Tick &tick, long seq)
+{
+	tick.seq = seq;
+	tick.price = seq * 3;
+	snprintf(tick.symbol, sizeof(tick.symbol), "IF%04ld", seq % 10000);
+}
+
+CasBroadcastQueueOPMC<Tick> broadcast_queue(4096);
+
+void *func_broadcast_product(void *arg)
+{
+	for (long ii = 1; ii <= tick_count; ++ii)
+	{
+		CasSlot<Tick> slot = broadcast_queue.ClaimProduct();
+		fill_tick(*slot, ii);
+		broadcast_queue.CommitProduct(slot);
+	}
+
+	return NULL;
+}
+
+void *func_broadcast_consume(void *arg)
+{
+	ROLE_ARG *role_arg = (ROLE_ARG *)arg;
+	while (0 != broadcast_queue.ConsumeBatch(role_arg->id, [role_arg](const Tick &tick) { handle_tick(role_arg, tick); }));
+
+	return NULL;
+}
+
+// 三个队列时策略要等风控，风控检查后再转发给策略，相当于策略的数据多一次拷贝
+CasQueueOPOC<Tick> *copy_queues[ROLE_NUM];
+
+void *func_copy_product(void *arg)
+{
+	Tick tick;
+	for (long ii = 1; ii <= tick_count; ++ii)
+	{
+		fill_tick(tick, ii);
+		copy_queues[LOGGER]->Product(tick);
+		copy_queues[RISK]->Product(tick);
+	}
+
+	copy_queues[LOGGER]->Close();
+	copy_queues[RISK]->Close();
+
+	return NULL;
+}
+
+void *func_copy_consume(void *arg)
+{
+	ROLE_ARG *role_arg = (ROLE_ARG *)arg;
+	Tick tick;
+	while (true == copy_queues[role_arg->role]->Consume(tick))
+	{
+		handle_tick(role_arg, tick);
+		if (RISK == role_arg->role)
+			copy_queues[STRATEGY]->Product(tick);
+	}
+
+	if (RISK == role_arg->role)
+		copy_queues[STRATEGY]->Close();
+
+	return NULL;
+}
+
+bool run(const char *name, void *(*product)(void *), void *(*consume)(void *), ROLE_ARG *role_arg)
+{
+	memset(risk_checked, 0, tick_count + 1);
+
+	pthread_t product_thread;
+	pthread_t consume_threads[ROLE_NUM];
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	for (int ii = 0; ii < ROLE_NUM; ++ii)
+	{
+		role_arg[ii].role = ii;
+		role_arg[ii].count = 0;
+		role_arg[ii].sum = 0;
+		role_arg[ii].is_ok = true;
+		pthread_create(&consume_threads[ii], NULL, consume, &role_arg[ii]);
+	}
+	pthread_create(&product_thread, NULL, product, NULL);
+
+	pthread_join(product_thread, NULL);
+	if (func_broadcast_product == product)
+		broadcast_queue.Close();
+
+	bool is_ok = true;
+	for (int ii = 0; ii < ROLE_NUM; ++ii)
+	{
+		pthread_join(consume_threads[ii], NULL);
+		is_ok = is_ok && role_arg[ii].is_ok && tick_count == role_arg[ii].count && role_arg[ii].sum == 3 * tick_count * (tick_count + 1) / 2;
+	}
+
+	gettimeofday(&end, NULL);
+
+	printf("%-36s time_use is %4.3f, %s\n", name, (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0, true == is_ok ? "ok" : "FAILED");
+	for (int ii = 0; ii < ROLE_NUM; ++ii)
+		printf("    %-10s %ld\n", role_name[ii], role_arg[ii].count);
+
+	return is_ok;
+}
+
+// 关闭后生产一律失败；生产者等待最慢的消费者腾出entry时被关闭，也返回false而不写入
+CasBroadcastQueueOPMC<Tick> *p_full_queue = NULL;
+bool is_full_product = true;
+
+void *func_full_product(void *arg)
+{
+	Tick tick = {0, 0};
+	is_full_product = p_full_queue->Product(tick);
+	return NULL;
+}
+
+bool check_close()
+{
+	Tick tick = {1, 0};
+	bool is_closed_product = broadcast_queue.Product(tick) || broadcast_queue.TryProduct(tick) || broadcast_queue.ClaimProduct().IsValid();
+
+	p_full_queue = new CasBroadcastQueueOPMC<Tick>(2, 1);
+	p_full_queue->AddConsumer();  // 从不读取，写满2个entry后生产者等待
+	p_full_queue->Product(tick);
+	p_full_queue->Product(tick);
+
+	pthread_t full_thread;
+	pthread_create(&full_thread, NULL, func_full_product, NULL);
+	usleep(20000);
+	p_full_queue->Close();
+	pthread_join(full_thread, NULL);
+	delete p_full_queue;
+
+	bool is_ok = false == is_closed_product && false == is_full_product;
+	printf("product after close %d, product blocked on full then closed %d, %s\n", is_closed_product, is_full_product, true == is_ok ? "ok" : "FAILED");
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		tick_count = atol(argv[1]);
+
+	risk_checked = new unsigned char [tick_count + 1];
+
+	ROLE_ARG role_arg[ROLE_NUM];
+
+	for (int ii = 0; ii < ROLE_NUM; ++ii)
+		copy_queues[ii] = new CasQueueOPOC<Tick>(4096);
+	bool is_ok = run("three CasQueueOPOC copies", func_copy_product, func_copy_consume, role_arg);
+	for (int ii = 0; ii < ROLE_NUM; ++ii)
+		delete copy_queues[ii];
+
+	// 日志与风控直接读生产者的数据，策略依赖风控
+	int risk_depend[1];
+	role_arg[LOGGER].id = broadcast_queue.AddConsumer();
+	role_arg[RISK].id = risk_depend[0] = broadcast_queue.AddConsumer();
+	role_arg[STRATEGY].id = broadcast_queue.AddConsumer(risk_depend, 1);
+	is_ok = run("CasBroadcastQueueOPMC", func_broadcast_product, func_broadcast_consume, role_arg) && is_ok;
+	is_ok = check_close() && is_ok;
+
+	delete [] risk_checked;
+
+	return true == is_ok ? 0 : 1;
+}
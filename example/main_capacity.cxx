@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_queue.hxx"
+
+// 对比运行期容量与编译期容量(CAPACITY)的单生产者单消费者队列吞吐量，以及与多生产者多消费者版本的差距
+// 用法: ./capacity [消息总数]
+
+template <class Q>
+struct BenchArg
+{
+	Q *queue;
+	long count;
+};
+
+template <class Q>
+void *func_product(void *arg)
+{
+	BenchArg<Q> *bench_arg = (BenchArg<Q> *)arg;
+
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		while (false == bench_arg->queue->Product(ii))
+			sched_yield();  // 单核机器上自旋会占满对方的时间片
+	}
+
+	return NULL;
+}
+
+template <class Q>
+void *func_consume(void *arg)
+{
+	BenchArg<Q> *bench_arg = (BenchArg<Q> *)arg;
+
+	long t_consume;
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		while (false == bench_arg->queue->Consume(t_consume))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+template <class Q>
+double run(long total)
+{
+	Q test_queue(1024);
+	BenchArg<Q> bench_arg;
+	bench_arg.queue = &test_queue;
+	bench_arg.count = total;
+
+	pthread_t product_thread;
+	pthread_t consume_thread;
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	pthread_create(&product_thread, NULL, func_product<Q>, &bench_arg);
+	pthread_create(&consume_thread, NULL, func_consume<Q>, &bench_arg);
+
+	pthread_join(product_thread, NULL);
+	pthread_join(consume_thread, NULL);
+
+	gettimeofday(&end, NULL);
+
+	double time_use = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);  // 微秒
+	return total / time_use;  // 每微秒消息数，即百万次每秒
+}
+
+int main(int argc, char **argv)
+{
+	long total = argc > 1 ? atol(argv[1]) : 20000000;
+
+	printf("messages: %ld, unit: Mops/s\n", total);
+	printf("%-40s %10.2f\n", "CasQueueNoBlockMPMC (runtime 1024)", run<CasQueueNoBlockMPMC<long>>(total));
+	printf("%-40s %10.2f\n", "CasQueueNoBlockOPOC (runtime 1024)", run<CasQueueNoBlockOPOC<long>>(total));
+	printf("%-40s %10.2f\n", "CasQueue<ONE, ONE, noblock, 1024>", run<CasQueue<long, CAS_ONE, CAS_ONE, false, 1024>>(total));
+
+	return 0;
+}
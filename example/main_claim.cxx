@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_queue.hxx"
+
+// 2KB的定长行情帧，生产者直接在entry中填写，消费者直接在entry中校验，与Product/Consume整帧拷贝对比
+// 用法: ./claim [每个生产者的帧数]
+
+struct Frame
+{
+	long producer;
+	long seq;
+	unsigned char payload[2032];
+};
+
+CasQueueMPMC<Frame> block_queue(256);
+CasQueueNoBlockOPOC<Frame> noblock_queue(256);
+
+long frame_count = 500000;
+
+// 模拟解码器把网络包解析到帧中
+inline void decode(Frame &frame, long producer, long seq)
+{
+	frame.producer = producer;
+	frame.seq = seq;
+	memset(frame.payload, (int)(seq & 0xff), sizeof(frame.payload));
+}
+
+inline bool verify(const Frame &frame)
+{
+	return frame.payload[0] == (unsigned char)(frame.seq & 0xff) && frame.payload[sizeof(frame.payload) - 1] == (unsigned char)(frame.seq & 0xff);
+}
+
+void *func_claim_product(void *arg)
+{
+	long producer = (long)arg;
+	for (long ii = 1; ii <= frame_count; ++ii)
+	{
+		CasSlot<Frame> slot = block_queue.ClaimProduct();
+		decode(*slot, producer, ii);
+		block_queue.CommitProduct(slot);
+	}
+
+	return NULL;
+}
+
+void *func_claim_consume(void *arg)
+{
+	for (long ii = 0; ii < frame_count; ++ii)
+	{
+		CasSlot<Frame> slot = block_queue.ClaimConsume();
+		assert(true == verify(*slot));
+		block_queue.ReleaseConsume(slot);
+	}
+
+	return NULL;
+}
+
+void *func_copy_product(void *arg)
+{
+	long producer = (long)arg;
+	Frame frame;
+	for (long ii = 1; ii <= frame_count; ++ii)
+	{
+		decode(frame, producer, ii);
+		block_queue.Product(frame);
+	}
+
+	return NULL;
+}
+
+void *func_copy_consume(void *arg)
+{
+	Frame frame = {};  // Consume只在成功时写入，先清零
+	for (long ii = 0; ii < frame_count; ++ii)
+	{
+		block_queue.Consume(frame);
+		assert(true == verify(frame));
+	}
+
+	return NULL;
+}
+
+// 非阻塞单生产者单消费者队列领取失败时让出CPU重试，消费者检查帧的顺序
+void *func_noblock_product(void *arg)
+{
+	for (long ii = 1; ii <= frame_count; ++ii)
+	{
+		CasSlot<Frame> slot;
+		while (false == (slot = noblock_queue.ClaimProduct()).IsValid())
+			sched_yield();
+
+		decode(*slot, 0, ii);
+		noblock_queue.CommitProduct(slot);
+	}
+
+	return NULL;
+}
+
+void *func_noblock_consume(void *arg)
+{
+	for (long ii = 1; ii <= frame_count; ++ii)
+	{
+		CasSlot<Frame> slot;
+		while (false == (slot = noblock_queue.ClaimConsume()).IsValid())
+			sched_yield();
+
+		assert(ii == slot->seq && true == verify(*slot));
+		noblock_queue.ReleaseConsume(slot);
+	}
+
+	return NULL;
+}
+
+double run(void *(*product)(void *), void *(*consume)(void *), int pair_num)
+{
+	pthread_t *threads = new pthread_t [pair_num * 2];
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	for (long ii = 0; ii < pair_num; ++ii)
+	{
+		pthread_create(&threads[ii * 2], NULL, product, (void *)ii);
+		pthread_create(&threads[ii * 2 + 1], NULL, consume, NULL);
+	}
+
+	for (int ii = 0; ii < pair_num * 2; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	delete [] threads;
+
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		frame_count = atol(argv[1]);
+
+	printf("frame size %lu, frames per producer %ld\n", sizeof(Frame), frame_count);
+	printf("CasQueueMPMC 2P2C product/consume copy  time_use is %4.3f\n", run(func_copy_product, func_copy_consume, 2));
+	printf("CasQueueMPMC 2P2C claim/commit in place time_use is %4.3f\n", run(func_claim_product, func_claim_consume, 2));
+	printf("CasQueueNoBlockOPOC claim/commit        time_use is %4.3f\n", run(func_noblock_product, func_noblock_consume, 1));
+
+	return 0;
+}
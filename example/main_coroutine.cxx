@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_coroutine_queue.hxx"
+
+// 需要-std=c++20
+// 1. 乒乓：两个线程经两个CasQueueOPOC来回传递，对比同一个执行器上的两个协程经两个CasCoQueue来回传递
+// 2. 扇出：1000个消费者线程阻塞在CasQueueMPMC上，对比1000个消费者协程共用两个执行器线程
+// 用法: ./coroutine [乒乓次数] [扇出消息数]
+
+const int FAN_CONSUMER_NUM = 1000;
+const int FAN_PRODUCER_NUM = 2;
+const int EXECUTOR_NUM = 2;
+
+long round_count = 200000;
+long fan_count = 1000000;
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+CasQueueOPOC<long> *ping_queue;
+CasQueueOPOC<long> *pong_queue;
+
+void *func_thread_pong(void *arg)
+{
+	long value;
+	while (true == ping_queue->Consume(value))
+		pong_queue->Product(value + 1);
+
+	return NULL;
+}
+
+bool run_thread_pingpong()
+{
+	ping_queue = new CasQueueOPOC<long>(64);
+	pong_queue = new CasQueueOPOC<long>(64);
+
+	double start = now();
+	pthread_t pong_thread;
+	pthread_create(&pong_thread, NULL, func_thread_pong, NULL);
+
+	long value = 0;
+	for (long ii = 0; ii < round_count; ++ii)
+	{
+		ping_queue->Product(value);
+		pong_queue->Consume(value);
+	}
+	ping_queue->Close();
+	pthread_join(pong_thread, NULL);
+
+	printf("%-36s time_use is %4.3f, %.2f us per round trip\n", "pingpong CasQueueOPOC threads", now() - start, (now() - start) * 1000000 / round_count);
+
+	delete ping_queue;
+	delete pong_queue;
+
+	return round_count == value;
+}
+
+CasCoQueue<long> *co_ping_queue;
+CasCoQueue<long> *co_pong_queue;
+long co_result;
+
+CasCoTask co_ping(CasCoExecutor *p_executor)
+{
+	long value = 0;
+	for (long ii = 0; ii < round_count; ++ii)
+	{
+		co_await co_ping_queue->AsyncProduct(value);
+		co_await co_pong_queue->AsyncConsume(value);
+	}
+
+	co_result = value;
+	co_ping_queue->Close();
+	p_executor->Stop();
+}
+
+CasCoTask co_pong()
+{
+	long value;
+	while (true == co_await co_ping_queue->AsyncConsume(value))
+		co_await co_pong_queue->AsyncProduct(value + 1);
+}
+
+bool run_coroutine_pingpong()
+{
+	co_ping_queue = new CasCoQueue<long>(64);
+	co_pong_queue = new CasCoQueue<long>(64);
+	CasCoExecutor executor;
+
+	double start = now();
+	executor.Spawn(co_pong());
+	executor.Spawn(co_ping(&executor));
+	executor.Run();
+
+	printf("%-36s time_use is %4.3f, %.2f us per round trip\n", "pingpong CasCoQueue coroutines", now() - start, (now() - start) * 1000000 / round_count);
+
+	delete co_ping_queue;
+	delete co_pong_queue;
+
+	return round_count == co_result;
+}
+
+// 扇出：每个消费者累加读到的数据，最后检查总和
+CasQueueMPMC<long> *fan_queue;
+std::atomic<long> fan_sum;
+std::atomic<long> fan_consumed;
+
+void *func_fan_product(void *arg)
+{
+	long id = (long)arg;
+	for (long ii = id + 1; ii <= fan_count; ii += FAN_PRODUCER_NUM)
+		fan_queue->Product(ii);
+
+	return NULL;
+}
+
+void *func_fan_consume(void *arg)
+{
+	long value;
+	long sum = 0;
+	long count = 0;
+	while (true == fan_queue->Consume(value))
+	{
+		sum += value;
+		++count;
+	}
+
+	fan_sum.fetch_add(sum, std::memory_order_relaxed);
+	fan_consumed.fetch_add(count, std::memory_order_relaxed);
+	return NULL;
+}
+
+bool run_thread_fan()
+{
+	fan_queue = new CasQueueMPMC<long>(4096);
+	fan_sum.store(0);
+	fan_consumed.store(0);
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+
+	double start = now();
+	pthread_t *consume_threads = new pthread_t [FAN_CONSUMER_NUM];
+	pthread_t product_threads[FAN_PRODUCER_NUM];
+	for (int ii = 0; ii < FAN_CONSUMER_NUM; ++ii)
+		pthread_create(&consume_threads[ii], &attr, func_fan_consume, NULL);
+	for (long ii = 0; ii < FAN_PRODUCER_NUM; ++ii)
+		pthread_create(&product_threads[ii], NULL, func_fan_product, (void *)ii);
+
+	for (int ii = 0; ii < FAN_PRODUCER_NUM; ++ii)
+		pthread_join(product_threads[ii], NULL);
+	fan_queue->Close();
+	for (int ii = 0; ii < FAN_CONSUMER_NUM; ++ii)
+		pthread_join(consume_threads[ii], NULL);
+
+	printf("%-36s time_use is %4.3f\n", "fan-out 1000 CasQueueMPMC threads", now() - start);
+
+	pthread_attr_destroy(&attr);
+	delete [] consume_threads;
+	delete fan_queue;
+
+	return fan_count == fan_consumed.load() && fan_count * (fan_count + 1) / 2 == fan_sum.load();
+}
+
+CasCoQueue<long> *co_fan_queue;
+CasCoExecutor *executors[EXECUTOR_NUM];
+std::atomic<int> co_producer_live;
+std::atomic<int> co_consumer_live;
+
+CasCoTask co_fan_product(long id)
+{
+	for (long ii = id + 1; ii <= fan_count; ii += FAN_PRODUCER_NUM)
+		co_await co_fan_queue->AsyncProduct(ii);
+
+	// 最后一个结束的生产者关闭队列，等待的消费者以false恢复
+	if (1 == co_producer_live.fetch_sub(1))
+		co_fan_queue->Close();
+}
+
+CasCoTask co_fan_consume()
+{
+	long value;
+	long sum = 0;
+	long count = 0;
+	while (true == co_await co_fan_queue->AsyncConsume(value))
+	{
+		sum += value;
+		++count;
+	}
+
+	fan_sum.fetch_add(sum, std::memory_order_relaxed);
+	fan_consumed.fetch_add(count, std::memory_order_relaxed);
+
+	// 最后一个结束的消费者停止所有执行器
+	if (1 == co_consumer_live.fetch_sub(1))
+	{
+		for (int ii = 0; ii < EXECUTOR_NUM; ++ii)
+			executors[ii]->Stop();
+	}
+}
+
+void *func_executor(void *arg)
+{
+	((CasCoExecutor *)arg)->Run();
+	return NULL;
+}
+
+bool run_coroutine_fan()
+{
+	co_fan_queue = new CasCoQueue<long>(4096);
+	fan_sum.store(0);
+	fan_consumed.store(0);
+	co_producer_live.store(FAN_PRODUCER_NUM);
+	co_consumer_live.store(FAN_CONSUMER_NUM);
+
+	double start = now();
+	for (int ii = 0; ii < EXECUTOR_NUM; ++ii)
+		executors[ii] = new CasCoExecutor();
+	for (int ii = 0; ii < FAN_CONSUMER_NUM; ++ii)
+		executors[ii % EXECUTOR_NUM]->Spawn(co_fan_consume());
+	for (long ii = 0; ii < FAN_PRODUCER_NUM; ++ii)
+		executors[ii % EXECUTOR_NUM]->Spawn(co_fan_product(ii));
+
+	pthread_t executor_threads[EXECUTOR_NUM];
+	for (int ii = 0; ii < EXECUTOR_NUM; ++ii)
+		pthread_create(&executor_threads[ii], NULL, func_executor, executors[ii]);
+	for (int ii = 0; ii < EXECUTOR_NUM; ++ii)
+		pthread_join(executor_threads[ii], NULL);
+
+	printf("%-36s time_use is %4.3f\n", "fan-out 1000 CasCoQueue coroutines", now() - start);
+
+	for (int ii = 0; ii < EXECUTOR_NUM; ++ii)
+		delete executors[ii];
+	delete co_fan_queue;
+
+	return fan_count == fan_consumed.load() && fan_count * (fan_count + 1) / 2 == fan_sum.load();
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		round_count = atol(argv[1]);
+	if (argc > 2)
+		fan_count = atol(argv[2]);
+
+	bool is_ok = run_thread_pingpong();
+	is_ok = run_coroutine_pingpong() && is_ok;
+	is_ok = run_thread_fan() && is_ok;
+	is_ok = run_coroutine_fan() && is_ok;
+
+	printf("%s\n", true == is_ok ? "ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "cas_event_queue.hxx"
+
+// 生产者突发写入，消费者在epoll事件循环中监听队列的eventfd，统计每条消息平均的系统调用次数
+// 用法: ./event [每个生产者的突发次数] [每次突发的消息数] [Drain每次最多处理的个数]
+
+// 在eventfd通知器外计数，Notify为一次write，Clear为一次read
+struct CountingNotifier : public CasEventfdNotifier
+{
+	std::atomic<long> notify_count {0};
+	long clear_count = 0;
+
+	void Notify()
+	{
+		notify_count.fetch_add(1, std::memory_order_relaxed);
+		CasEventfdNotifier::Notify();
+	}
+
+	void Clear()
+	{
+		++clear_count;
+		CasEventfdNotifier::Clear();
+	}
+};
+
+CasEventQueue<long, CasQueueNoBlockMPMC<long>, CountingNotifier> event_queue(4096);
+
+int producer_num = 2;
+long burst_count = 2000;
+long burst_size = 64;
+
+void *func_product(void *arg)
+{
+	for (long ii = 0; ii < burst_count; ++ii)
+	{
+		for (long jj = 1; jj <= burst_size; ++jj)
+		{
+			while (false == event_queue.Product(jj))
+				sched_yield();
+		}
+
+		usleep(50);  // 突发之间的空闲，消费者取空队列后回到epoll_wait
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		burst_count = atol(argv[1]);
+	if (argc > 2)
+		burst_size = atol(argv[2]);
+	unsigned long drain_max = argc > 3 ? atol(argv[3]) : 256;
+
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = event_queue.Fd();
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_queue.Fd(), &event);
+
+	pthread_t *threads = new pthread_t [producer_num];
+	for (int ii = 0; ii < producer_num; ++ii)
+	{
+		pthread_create(&threads[ii], NULL, func_product, NULL);
+	}
+
+	long total = producer_num * burst_count * burst_size;
+	long consumed = 0;
+	long sum = 0;
+	long wakeup_count = 0;
+	struct epoll_event events[8];
+	while (consumed < total)
+	{
+		int n = epoll_wait(epoll_fd, events, 8, 1000);
+		if (n <= 0)
+		{
+			printf("no event in 1s, consumed %ld/%ld, lost wakeup\n", consumed, total);
+			return 1;
+		}
+
+		++wakeup_count;
+		consumed += event_queue.Drain([&sum](long &t_consume) { sum += t_consume; }, drain_max);
+	}
+
+	for (int ii = 0; ii < producer_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+	}
+
+	bool is_ok = sum == producer_num * burst_count * burst_size * (burst_size + 1) / 2;
+
+	CountingNotifier &notifier = event_queue.GetNotifier();
+	long notify_count = notifier.notify_count.load();
+	long syscall_count = notify_count + notifier.clear_count + wakeup_count;
+	printf("messages %ld, bursts %ld x %ld, drain max %lu\n", total, producer_num * burst_count, burst_size, drain_max);
+	printf("eventfd write %ld, eventfd read %ld, epoll_wait %ld\n", notify_count, notifier.clear_count, wakeup_count);
+	printf("syscalls per message %.4f, %s\n", (double)syscall_count / total, true == is_ok ? "ok" : "FAILED");
+
+	delete [] threads;
+	close(epoll_fd);
+
+	return true == is_ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <memory>
+#include "cas_executor.hxx"
+
+// 工作窃取执行器的功能验证：递归fork/join、多个外部线程提交、就地存放与堆上存放的任务、本地队列满、Stop之后的提交
+// 用法: ./executor [工作线程个数] [fib参数]
+
+CasExecutor *p_executor = NULL;
+
+long fib_serial(int n)
+{
+	return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+// 每一层在本线程压入一个子任务，另一半自己算，Wait时帮助执行，其它工作线程从顶部窃取较大的子树
+long fib(int n)
+{
+	if (n < 12)
+		return fib_serial(n);
+
+	long left, right;
+	CasTaskGroup group(*p_executor);
+	group.Spawn([&left, n]() { left = fib(n - 1); });
+	right = fib(n - 2);
+	group.Wait();
+
+	return left + right;
+}
+
+const int SUBMIT_THREAD_NUM = 3;
+const long SUBMIT_COUNT = 100000;
+std::atomic<long> submit_sum {0};
+
+void *func_submit(void *arg)
+{
+	for (long ii = 1; ii <= SUBMIT_COUNT; ++ii)
+		p_executor->Submit([ii]() { submit_sum.fetch_add(ii, std::memory_order_relaxed); });
+
+	return NULL;
+}
+
+// 超过CAS_TASK_INLINE的可调用对象在堆上存放
+struct BigTask
+{
+	long values[16];
+	std::atomic<long> *p_sum;
+
+	void operator()()
+	{
+		long sum = 0;
+		for (int ii = 0; ii < 16; ++ii)
+			sum += values[ii];
+		p_sum->fetch_add(sum, std::memory_order_relaxed);
+	}
+};
+
+// 注入队列满时阻塞的外部提交
+struct BlockedSubmit
+{
+	CasExecutor *p_executor;
+	std::atomic<int> *p_run;
+	bool is_submit;
+};
+
+void *func_blocked_submit(void *arg)
+{
+	BlockedSubmit *p_blocked = (BlockedSubmit *)arg;
+	std::atomic<int> *p_run = p_blocked->p_run;
+	p_blocked->is_submit = p_blocked->p_executor->Submit([p_run]() { p_run->fetch_add(1, std::memory_order_relaxed); });
+
+	return NULL;
+}
+
+// Stop时有外部提交阻塞在已满的注入队列上：该提交返回false，已进入队列的任务照常执行，析构不会挂起
+bool check_stop_blocked_submit()
+{
+	std::atomic<int> run {0};
+	std::atomic<bool> is_started {false};
+	CasExecutor *p_small = new CasExecutor(1, 1024, 2);
+
+	p_small->Submit([&run, &is_started]()
+	{
+		is_started.store(true, std::memory_order_release);
+		usleep(300000);
+		run.fetch_add(1, std::memory_order_relaxed);
+	});
+	while (false == is_started.load(std::memory_order_acquire))
+		usleep(1000);
+
+	// 唯一的工作线程正在执行长任务，两个任务填满注入队列，第三个在另一个线程中阻塞
+	p_small->Submit([&run]() { run.fetch_add(1, std::memory_order_relaxed); });
+	p_small->Submit([&run]() { run.fetch_add(1, std::memory_order_relaxed); });
+
+	BlockedSubmit blocked = {p_small, &run, true};
+	pthread_t thread;
+	pthread_create(&thread, NULL, func_blocked_submit, &blocked);
+	usleep(50000);
+
+	// Stop唤醒阻塞的提交，提交线程离开Submit后再析构，析构时等工作线程执行完队列中的任务后退出
+	p_small->Stop();
+	pthread_join(thread, NULL);
+	delete p_small;
+
+	bool is_ok = 3 == run.load() && false == blocked.is_submit;
+	printf("stop with a blocked submit: run %d, blocked submit %d, %s\n", run.load(), blocked.is_submit, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	int worker_num = argc > 1 ? atoi(argv[1]) : 4;
+	int fib_n = argc > 2 ? atoi(argv[2]) : 27;
+	bool is_ok = true;
+
+	// 本地双端队列只有16个entry，fork/join的子任务和批量扇出都会出现队列满时在本线程直接执行
+	p_executor = new CasExecutor(worker_num, 16, 1024);
+	printf("workers %d, sizeof(CasTask) %zu\n", p_executor->WorkerNum(), sizeof(CasTask));
+
+	// 递归fork/join，在外部线程中Wait时睡眠等待
+	long fib_result = 0;
+	{
+		CasTaskGroup group(*p_executor);
+		group.Spawn([&fib_result, fib_n]() { fib_result = fib(fib_n); });
+		group.Wait();
+	}
+
+	bool is_fib = fib_result == fib_serial(fib_n);
+	printf("fork/join fib(%d) = %ld, %s\n", fib_n, fib_result, true == is_fib ? "ok" : "FAILED");
+	is_ok = is_fib && is_ok;
+
+	// 多个外部线程同时提交，经过注入队列；一个任务中扇出大量子任务，本地队列满时直接执行
+	std::atomic<long> fan_sum {0};
+	{
+		CasTaskGroup group(*p_executor);
+		group.Spawn([&fan_sum]()
+		{
+			CasTaskGroup fan_group(*p_executor);
+			for (long ii = 1; ii <= 10000; ++ii)
+				fan_group.Spawn([&fan_sum, ii]() { fan_sum.fetch_add(ii, std::memory_order_relaxed); });
+		});
+
+		pthread_t threads[SUBMIT_THREAD_NUM];
+		for (int ii = 0; ii < SUBMIT_THREAD_NUM; ++ii)
+			pthread_create(&threads[ii], NULL, func_submit, NULL);
+		for (int ii = 0; ii < SUBMIT_THREAD_NUM; ++ii)
+			pthread_join(threads[ii], NULL);
+	}
+
+	// 移动语义的捕获和堆上存放的任务
+	std::atomic<long> big_sum {0};
+	std::unique_ptr<long> p_value(new long(7));
+	{
+		CasTaskGroup group(*p_executor);
+		group.Spawn([&big_sum, p = std::move(p_value)]() { big_sum.fetch_add(*p, std::memory_order_relaxed); });
+
+		BigTask big_task;
+		for (int ii = 0; ii < 16; ++ii)
+			big_task.values[ii] = ii;
+		big_task.p_sum = &big_sum;
+		for (int ii = 0; ii < 100; ++ii)
+			group.Spawn(big_task);
+	}
+
+	// Stop之后外部提交返回false，析构时执行完已提交的任务
+	p_executor->Stop();
+	bool is_reject = false == p_executor->Submit([]() {});
+	delete p_executor;
+
+	long submit_expect = SUBMIT_THREAD_NUM * SUBMIT_COUNT * (SUBMIT_COUNT + 1) / 2;
+	bool is_sum = 10000L * 10001 / 2 == fan_sum.load() && submit_expect == submit_sum.load() && 7 + 100 * 120 == big_sum.load();
+	printf("fan-out sum %ld, external submit sum %ld, move-only/heap tasks %ld, reject after stop %d, %s\n",
+		fan_sum.load(), submit_sum.load(), big_sum.load(), is_reject, true == is_sum && true == is_reject ? "ok" : "FAILED");
+	is_ok = is_sum && is_reject && is_ok;
+
+	is_ok = check_stop_blocked_submit() && is_ok;
+
+	return true == is_ok ? 0 : 1;
+}
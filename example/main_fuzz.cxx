@@ -0,0 +1,511 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <type_traits>
+#define CAS_QUEUE_FUZZ
+#include "cas_queue.hxx"
+
+/*
+ * 调度扰动压力测试，定义CAS_QUEUE_FUZZ编译（make中的fuzz目标，fuzz_tsan目标同时使用-fsanitize=thread）
+ *
+ * 每一轮随机选择一种队列、生产者消费者个数和容量（1到4096，包括非2的幂），每个线程随机混用
+ * Product、Emplace、Try、TryFor、Bulk和Claim接口；队列在每个cas、票号领取、发布和挂起之前调用__CasFuzzPoint()，
+ * 这里按每个线程自己的随机序列让出CPU、自旋或短暂睡眠，放大p_wait/c_wait握手和门的交错窗口
+ *
+ * 检查：
+ *     每条消息恰好被消费一次（不丢失、不重复），消息体没有被半写
+ *     非阻塞队列的票号按seq顺序发布，同一消费者读到的同一生产者的消息序号递增
+ *     阻塞队列多生产者或多消费者时套圈的线程可能先于同一entry上的慢线程进门，只在单生产者单消费者时检查顺序
+ *     看门狗：所有线程连续若干秒没有生产或消费任何消息时视为死锁，打印现场后abort
+ *
+ * 同一个种子得到相同的测试序列和相同的扰动序列，失败时用打印的种子复现
+ * 用法: ./fuzz [轮数] [种子] [看门狗秒数]
+ */
+
+struct Message
+{
+	long producer;
+	long seq;
+	long check;
+};
+
+inline unsigned int next_rand(unsigned long &state)
+{
+	state = state * 6364136223846793005UL + 1442695040888963407UL;
+	return state >> 33;
+}
+
+// 为0时不扰动，主线程和看门狗不参与
+thread_local unsigned long fuzz_state = 0;
+
+// 约一成让出CPU，少量自旋，极少量睡眠几十到几百微秒
+void __CasFuzzPoint()
+{
+	if (0 == fuzz_state)
+		return;
+
+	unsigned int rand = next_rand(fuzz_state);
+	unsigned int percent = rand % 1024;
+	if (percent < 96)
+		sched_yield();
+	else if (percent < 112)
+	{
+		for (unsigned int ii = rand % 2048; ii > 0; --ii)
+			__CasCpuRelax();
+	}
+	else if (percent < 114)
+		usleep(rand % 256);
+}
+
+// 看门狗观察的现场
+std::atomic<long> progress(0);
+std::atomic<bool> is_running(false);
+char case_desc[256];
+void *p_watch_queue = NULL;
+unsigned long (*watch_size)(void *) = NULL;
+
+template <class Q>
+unsigned long approx_size(void *p_queue)
+{
+	return ((Q *)p_queue)->ApproxSize();
+}
+
+void *func_watchdog(void *arg)
+{
+	long timeout = (long)arg;
+	long last_progress = -1;
+	long stall_ms = 0;
+	while (true)
+	{
+		usleep(100000);
+		if (false == is_running.load(std::memory_order_acquire))
+		{
+			stall_ms = 0;
+			last_progress = -1;
+			continue;
+		}
+
+		long current = progress.load(std::memory_order_relaxed);
+		if (current != last_progress)
+		{
+			last_progress = current;
+			stall_ms = 0;
+			continue;
+		}
+
+		stall_ms += 100;
+		if (stall_ms >= timeout * 1000)
+		{
+			printf("DEADLOCK: %s, no progress for %ld s, progress %ld, approx size %lu\n", case_desc, timeout, current, watch_size(p_watch_queue));
+			fflush(stdout);
+			abort();
+		}
+	}
+
+	return NULL;
+}
+
+// 只有阻塞队列有Close
+template <class Q, class = void>
+struct is_blocking : std::false_type
+{
+};
+
+template <class Q>
+struct is_blocking<Q, std::void_t<decltype(std::declval<Q &>().Close())> > : std::true_type
+{
+};
+
+template <class Q>
+struct FuzzArg
+{
+	Q *queue;
+	int id;
+	int producer_num;
+	long per_producer;
+	unsigned long fuzz_seed;  // 扰动序列的种子
+	unsigned long op_seed;  // 接口选择序列的种子
+	std::atomic<unsigned char> *seen;  // 每条消息被消费的次数
+	std::atomic<long> *consumed_total;  // 非阻塞队列的消费者据此判断是否已取完
+	long *last_seq;  // 消费者读到的每个生产者的最后一个序号
+	bool is_fifo;
+	long consumed;
+	bool is_ok;
+};
+
+inline void fill_message(Message &msg, long producer, long seq)
+{
+	msg.producer = producer;
+	msg.seq = seq;
+	msg.check = seq * 31 ^ producer;
+}
+
+template <class Q>
+inline void handle_message(FuzzArg<Q> *fuzz_arg, const Message &msg)
+{
+	if (msg.producer < 0 || msg.producer >= fuzz_arg->producer_num || msg.seq < 1 || msg.seq > fuzz_arg->per_producer || msg.check != (msg.seq * 31 ^ msg.producer))
+	{
+		fuzz_arg->is_ok = false;
+		return;
+	}
+
+	if (0 != fuzz_arg->seen[msg.producer * fuzz_arg->per_producer + msg.seq - 1].fetch_add(1, std::memory_order_relaxed))
+		fuzz_arg->is_ok = false;  // 同一条消息被消费了两次
+
+	if (true == fuzz_arg->is_fifo && msg.seq <= fuzz_arg->last_seq[msg.producer])
+		fuzz_arg->is_ok = false;
+	fuzz_arg->last_seq[msg.producer] = msg.seq;
+
+	++fuzz_arg->consumed;
+	fuzz_arg->consumed_total->fetch_add(1, std::memory_order_relaxed);
+	progress.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 从seq开始生产一条或一批消息，返回生产的个数
+template <class Q>
+long product_some(FuzzArg<Q> *fuzz_arg, long seq, unsigned long &op_state)
+{
+	Q *queue = fuzz_arg->queue;
+	unsigned int rand = next_rand(op_state);
+	long remain = fuzz_arg->per_producer - seq + 1;
+	Message msgs[4];
+	long n = 1 + rand / 8 % 4;
+	if (n > remain)
+		n = remain;
+
+	Message msg;
+	fill_message(msg, fuzz_arg->id, seq);
+	CasSlot<Message> slot;
+
+	if constexpr (is_blocking<Q>::value)
+	{
+		switch (rand % 6)
+		{
+			case 0:
+				return true == queue->Product(msg) ? 1 : -1;
+			case 1:
+				return true == queue->Emplace(msg) ? 1 : -1;
+			case 2:
+				while (false == queue->TryProduct(msg))
+					sched_yield();
+				return 1;
+			case 3:
+				while (false == queue->TryProductFor(msg, std::chrono::milliseconds(1)));
+				return 1;
+			case 4:
+				for (long ii = 0; ii < n; ++ii)
+					fill_message(msgs[ii], fuzz_arg->id, seq + ii);
+				return (long)queue->ProductBulk(msgs, n) == n ? n : -1;  // 队列未关闭，必须全部生产
+			default:
+				slot = queue->ClaimProduct();
+				if (false == slot.IsValid())
+					return -1;
+				*slot = msg;
+				queue->CommitProduct(slot);
+				return 1;
+		}
+	}
+	else
+	{
+		switch (rand % 4)
+		{
+			case 0:
+				return true == queue->Product(msg) ? 1 : 0;
+			case 1:
+				return true == queue->TryEmplace(msg) ? 1 : 0;
+			case 2:
+				for (long ii = 0; ii < n; ++ii)
+					fill_message(msgs[ii], fuzz_arg->id, seq + ii);
+				return queue->ProductBulk(msgs, n);
+			default:
+				slot = queue->ClaimProduct();
+				if (false == slot.IsValid())
+					return 0;
+				*slot = msg;
+				queue->CommitProduct(slot);
+				return 1;
+		}
+	}
+}
+
+template <class Q>
+void *func_product(void *arg)
+{
+	FuzzArg<Q> *fuzz_arg = (FuzzArg<Q> *)arg;
+	fuzz_state = fuzz_arg->fuzz_seed;
+	unsigned long op_state = fuzz_arg->op_seed;
+
+	long seq = 1;
+	while (seq <= fuzz_arg->per_producer)
+	{
+		long count = product_some(fuzz_arg, seq, op_state);
+		if (count < 0)
+		{
+			fuzz_arg->is_ok = false;  // 阻塞队列在关闭前生产失败
+			break;
+		}
+
+		if (0 == count)
+			sched_yield();  // 非阻塞队列已满
+
+		seq += count;
+		progress.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	fuzz_state = 0;
+	return NULL;
+}
+
+// 消费一条或一批消息，返回false表示阻塞队列已关闭且已取完
+template <class Q>
+bool consume_some(FuzzArg<Q> *fuzz_arg, unsigned long &op_state)
+{
+	Q *queue = fuzz_arg->queue;
+	unsigned int rand = next_rand(op_state);
+	Message msgs[4];
+	long n = 1 + rand / 8 % 4;
+	long count;
+
+	Message msg;
+	CasSlot<Message> slot;
+
+	if constexpr (is_blocking<Q>::value)
+	{
+		switch (rand % 6)
+		{
+			case 0:
+				break;
+			case 1:
+				if (true == queue->TryConsume(msg))
+				{
+					handle_message(fuzz_arg, msg);
+					return true;
+				}
+				break;
+			case 2:
+				if (true == queue->TryConsumeFor(msg, std::chrono::milliseconds(1)))
+				{
+					handle_message(fuzz_arg, msg);
+					return true;
+				}
+				break;
+			case 3:
+				count = queue->ConsumeBulk(msgs, n);
+				for (long ii = 0; ii < count; ++ii)
+					handle_message(fuzz_arg, msgs[ii]);
+				return count == n;  // 只有关闭后才会少于n个
+			case 4:
+				count = queue->TryConsumeBulk(msgs, n);
+				for (long ii = 0; ii < count; ++ii)
+					handle_message(fuzz_arg, msgs[ii]);
+				if (count > 0)
+					return true;
+				break;
+			default:
+				slot = queue->ClaimConsume();
+				if (false == slot.IsValid())
+					return false;
+				handle_message(fuzz_arg, *slot);
+				queue->ReleaseConsume(slot);
+				return true;
+		}
+
+		// 非阻塞的尝试失败或选中了Consume时用阻塞的Consume，关闭后取完剩余数据才返回false
+		if (false == queue->Consume(msg))
+			return false;
+
+		handle_message(fuzz_arg, msg);
+		return true;
+	}
+	else
+	{
+		switch (rand % 3)
+		{
+			case 0:
+				if (true == queue->Consume(msg))
+					handle_message(fuzz_arg, msg);
+				else
+					sched_yield();
+				break;
+			case 1:
+				count = queue->ConsumeBulk(msgs, n);
+				for (long ii = 0; ii < count; ++ii)
+					handle_message(fuzz_arg, msgs[ii]);
+				if (0 == count)
+					sched_yield();
+				break;
+			default:
+				slot = queue->ClaimConsume();
+				if (true == slot.IsValid())
+				{
+					handle_message(fuzz_arg, *slot);
+					queue->ReleaseConsume(slot);
+				}
+				else
+					sched_yield();
+				break;
+		}
+
+		return true;
+	}
+}
+
+// 阻塞队列消费到关闭且取完，非阻塞队列消费到所有消息都被取走
+template <class Q>
+void *func_consume(void *arg)
+{
+	FuzzArg<Q> *fuzz_arg = (FuzzArg<Q> *)arg;
+	fuzz_state = fuzz_arg->fuzz_seed;
+	unsigned long op_state = fuzz_arg->op_seed;
+	long total = fuzz_arg->per_producer * fuzz_arg->producer_num;
+
+	while (true == is_blocking<Q>::value || fuzz_arg->consumed_total->load(std::memory_order_relaxed) < total)
+	{
+		if (false == consume_some(fuzz_arg, op_state))
+			break;
+	}
+
+	fuzz_state = 0;
+	return NULL;
+}
+
+template <class Q>
+auto close_queue(Q &queue, int) -> decltype(queue.Close())
+{
+	queue.Close();
+}
+
+template <class Q>
+void close_queue(Q &queue, long)
+{
+}
+
+template <class Q>
+bool run(const char *name, int round, unsigned long &case_state, int max_producer, int max_consumer, long scale)
+{
+	int queue_size = 1 + next_rand(case_state) % (1 << next_rand(case_state) % 13);
+	int producer_num = 1 + next_rand(case_state) % max_producer;
+	int consumer_num = 1 + next_rand(case_state) % max_consumer;
+	long per_producer = 1 + next_rand(case_state) % scale;
+	unsigned long thread_seed = case_state;
+
+	Q test_queue(queue_size);
+	int thread_num = producer_num + consumer_num;
+	FuzzArg<Q> *fuzz_arg = new FuzzArg<Q> [thread_num];
+	pthread_t *threads = new pthread_t [thread_num];
+	std::atomic<unsigned char> *seen = new std::atomic<unsigned char> [producer_num * per_producer];
+	long *last_seq = new long [consumer_num * producer_num]();
+	std::atomic<long> consumed_total(0);
+
+	for (long ii = 0; ii < producer_num * per_producer; ++ii)
+		seen[ii].store(0, std::memory_order_relaxed);
+
+	snprintf(case_desc, sizeof(case_desc), "round %d %s size %d %dP%dC %ld/producer", round, name, queue_size, producer_num, consumer_num, per_producer);
+	p_watch_queue = &test_queue;
+	watch_size = approx_size<Q>;
+	is_running.store(true, std::memory_order_release);
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		fuzz_arg[ii].queue = &test_queue;
+		fuzz_arg[ii].producer_num = producer_num;
+		fuzz_arg[ii].per_producer = per_producer;
+		fuzz_arg[ii].fuzz_seed = (thread_seed ^ (ii * 0x9e3779b97f4a7c15UL)) | 1;
+		fuzz_arg[ii].op_seed = thread_seed + ii;
+		fuzz_arg[ii].seen = seen;
+		fuzz_arg[ii].consumed_total = &consumed_total;
+		fuzz_arg[ii].is_fifo = false == is_blocking<Q>::value || (1 == producer_num && 1 == consumer_num);
+		fuzz_arg[ii].consumed = 0;
+		fuzz_arg[ii].is_ok = true;
+
+		if (ii < producer_num)
+		{
+			fuzz_arg[ii].id = ii;
+			fuzz_arg[ii].last_seq = NULL;
+			pthread_create(&threads[ii], NULL, func_product<Q>, &fuzz_arg[ii]);
+		}
+		else
+		{
+			fuzz_arg[ii].id = ii - producer_num;
+			fuzz_arg[ii].last_seq = last_seq + (ii - producer_num) * producer_num;
+			pthread_create(&threads[ii], NULL, func_consume<Q>, &fuzz_arg[ii]);
+		}
+	}
+
+	bool is_ok = true;
+	for (int ii = 0; ii < producer_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+		is_ok = is_ok && fuzz_arg[ii].is_ok;
+	}
+
+	close_queue(test_queue, 0);
+
+	long consumed = 0;
+	for (int ii = producer_num; ii < thread_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+		is_ok = is_ok && fuzz_arg[ii].is_ok;
+		consumed += fuzz_arg[ii].consumed;
+	}
+
+	is_running.store(false, std::memory_order_release);
+
+	long lost = 0;
+	for (long ii = 0; ii < producer_num * per_producer; ++ii)
+	{
+		if (1 != seen[ii].load(std::memory_order_relaxed))
+			++lost;
+	}
+
+	is_ok = is_ok && 0 == lost && consumed == producer_num * per_producer && 0 == test_queue.ApproxSize();
+	printf("%s: %s\n", case_desc, true == is_ok ? "ok" : "FAILED");
+	if (false == is_ok)
+		printf("    consumed %ld, lost or duplicated %ld\n", consumed, lost);
+
+	delete [] last_seq;
+	delete [] seen;
+	delete [] threads;
+	delete [] fuzz_arg;
+
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 40;
+	unsigned long seed = argc > 2 ? strtoul(argv[2], NULL, 10) : (unsigned long)time(NULL);
+	long timeout = argc > 3 ? atol(argv[3]) : 10;
+
+	printf("seed %lu, reproduce with: %s %d %lu\n", seed, argv[0], rounds, seed);
+
+	pthread_t watchdog;
+	pthread_create(&watchdog, NULL, func_watchdog, (void *)timeout);
+	pthread_detach(watchdog);
+
+	unsigned long case_state = seed;
+	bool is_ok = true;
+	const long scale = 3000;
+	for (int round = 0; round < rounds; ++round)
+	{
+		// 依次覆盖每种队列，OP/OC一侧固定为一个线程
+		switch (round % 10)
+		{
+			case 0: is_ok = run<CasQueueMPMC<Message> >("CasQueueMPMC", round, case_state, 4, 4, scale) && is_ok; break;
+			case 1: is_ok = run<CasQueueMPOC<Message> >("CasQueueMPOC", round, case_state, 4, 1, scale) && is_ok; break;
+			case 2: is_ok = run<CasQueueOPMC<Message> >("CasQueueOPMC", round, case_state, 1, 4, scale) && is_ok; break;
+			case 3: is_ok = run<CasQueueOPOC<Message> >("CasQueueOPOC", round, case_state, 1, 1, scale) && is_ok; break;
+			case 4: is_ok = run<CasQueueNoBlockMPMC<Message> >("CasQueueNoBlockMPMC", round, case_state, 4, 4, scale) && is_ok; break;
+			case 5: is_ok = run<CasQueueNoBlockMPOC<Message> >("CasQueueNoBlockMPOC", round, case_state, 4, 1, scale) && is_ok; break;
+			case 6: is_ok = run<CasQueueNoBlockOPMC<Message> >("CasQueueNoBlockOPMC", round, case_state, 1, 4, scale) && is_ok; break;
+			case 7: is_ok = run<CasQueueNoBlockOPOC<Message> >("CasQueueNoBlockOPOC", round, case_state, 1, 1, scale) && is_ok; break;
+			case 8: is_ok = run<CasQueueMPMC<Message, CasLayoutSplit, CasWaitAdaptive> >("CasQueueMPMC split adaptive", round, case_state, 4, 4, scale) && is_ok; break;
+			default: is_ok = run<CasQueueNoBlockMPMC<Message, CasLayoutScatter> >("CasQueueNoBlockMPMC scatter", round, case_state, 4, 4, scale) && is_ok; break;
+		}
+	}
+
+	printf("seed %lu: %s\n", seed, true == is_ok ? "all ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_queue.hxx"
+
+// 对比不同entry布局策略在不同数据大小、不同线程数下的吞吐量
+// 用法: ./layout [每轮消息总数] [最大线程数]
+
+struct Payload64
+{
+	char buf[64];
+};
+
+struct Payload1K
+{
+	char buf[1024];
+};
+
+template <class T, class Layout>
+struct BenchArg
+{
+	CasQueueMPMC<T, Layout> *queue;
+	long count;
+};
+
+template <class T, class Layout>
+void *func_product(void *arg)
+{
+	BenchArg<T, Layout> *bench_arg = (BenchArg<T, Layout> *)arg;
+	T t_product = T();
+
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		bench_arg->queue->Product(t_product);
+	}
+
+	return NULL;
+}
+
+template <class T, class Layout>
+void *func_consume(void *arg)
+{
+	BenchArg<T, Layout> *bench_arg = (BenchArg<T, Layout> *)arg;
+	T t_consume;
+
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		bench_arg->queue->Consume(t_consume);
+	}
+
+	return NULL;
+}
+
+template <class T, class Layout>
+double run(int thread_num, long total)
+{
+	CasQueueMPMC<T, Layout> test_queue(1024);
+	BenchArg<T, Layout> bench_arg;
+	bench_arg.queue = &test_queue;
+	bench_arg.count = total / (thread_num / 2);
+
+	pthread_t *threads = new pthread_t [thread_num];
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		if (ii % 2 == 0)
+			pthread_create(&threads[ii], NULL, func_product<T, Layout>, &bench_arg);
+		else
+			pthread_create(&threads[ii], NULL, func_consume<T, Layout>, &bench_arg);
+	}
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+	delete [] threads;
+
+	double time_use = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);  // 微秒
+
+	return bench_arg.count * (thread_num / 2) / time_use;  // 每微秒消息数，即百万次每秒
+}
+
+template <class T>
+void run_payload(const char *name, int max_thread, long total)
+{
+	for (int thread_num = 2; thread_num <= max_thread; thread_num *= 2)
+	{
+		printf("%-8s %7d %10.2f %10.2f %10.2f %10.2f\n", name, thread_num,
+				run<T, CasLayoutCompact>(thread_num, total),
+				run<T, CasLayoutPadded>(thread_num, total),
+				run<T, CasLayoutScatter>(thread_num, total),
+				run<T, CasLayoutSplit>(thread_num, total));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	long total = argc > 1 ? atol(argv[1]) : 1000000;
+	int max_thread = argc > 2 ? atoi(argv[2]) : 32;
+
+	printf("online cpus: %ld, messages per run: %ld, unit: Mops/s\n", sysconf(_SC_NPROCESSORS_ONLN), total);
+	printf("%-8s %7s %10s %10s %10s %10s\n", "payload", "threads", "compact", "padded", "scatter", "split");
+
+	run_payload<int>("int", max_thread, total);
+	run_payload<void *>("pointer", max_thread, total);
+	run_payload<Payload64>("64B", max_thread, total);
+	run_payload<Payload1K>("1KB", max_thread, total);
+
+	return 0;
+}
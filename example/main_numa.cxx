@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_numa_queue.hxx"
+
+// 对比单个CasQueueMPMC与按NUMA节点分片的CasNumaQueueMPMC在不同线程数下的吞吐量，线程依次绑定到各CPU上
+// 用法: ./numa [每轮消息总数] [最大线程数] [分组个数，0表示按NUMA节点]
+
+template <class Q>
+struct BenchArg
+{
+	Q *queue;
+	long count;
+	int cpu;
+};
+
+void bind_cpu(int cpu)
+{
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+template <class Q>
+void *func_product(void *arg)
+{
+	BenchArg<Q> *bench_arg = (BenchArg<Q> *)arg;
+	bind_cpu(bench_arg->cpu);
+
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		bench_arg->queue->Product(ii);
+	}
+
+	return NULL;
+}
+
+template <class Q>
+void *func_consume(void *arg)
+{
+	BenchArg<Q> *bench_arg = (BenchArg<Q> *)arg;
+	bind_cpu(bench_arg->cpu);
+
+	long t_consume;
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		bench_arg->queue->Consume(t_consume);
+	}
+
+	return NULL;
+}
+
+template <class Q>
+double run(Q &test_queue, int thread_num, long total)
+{
+	BenchArg<Q> *bench_arg = new BenchArg<Q> [thread_num];
+	pthread_t *threads = new pthread_t [thread_num];
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		bench_arg[ii].queue = &test_queue;
+		bench_arg[ii].count = total / (thread_num / 2);
+		bench_arg[ii].cpu = ii;
+
+		if (ii % 2 == 0)
+			pthread_create(&threads[ii], NULL, func_product<Q>, &bench_arg[ii]);
+		else
+			pthread_create(&threads[ii], NULL, func_consume<Q>, &bench_arg[ii]);
+	}
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+
+	double time_use = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);  // 微秒
+	double mops = bench_arg[0].count * (thread_num / 2) / time_use;  // 每微秒消息数，即百万次每秒
+
+	delete [] threads;
+	delete [] bench_arg;
+
+	return mops;
+}
+
+int main(int argc, char **argv)
+{
+	long total = argc > 1 ? atol(argv[1]) : 2000000;
+	int max_thread = argc > 2 ? atoi(argv[2]) : 2 * sysconf(_SC_NPROCESSORS_ONLN);
+	int shard_count = argc > 3 ? atoi(argv[3]) : 0;
+
+	if (max_thread < 2)
+		max_thread = 2;
+
+	CasNumaQueueMPMC<long> numa_queue(1024, shard_count);
+
+	printf("online cpus: %ld, shards: %u, messages per run: %ld, unit: Mops/s\n", sysconf(_SC_NPROCESSORS_ONLN), numa_queue.ShardCount(), total);
+	printf("%7s %10s %10s\n", "threads", "single", "sharded");
+
+	for (int thread_num = 2; thread_num <= max_thread; thread_num *= 2)
+	{
+		CasQueueMPMC<long> single_queue(1024 * numa_queue.ShardCount());
+
+		double single = run(single_queue, thread_num, total);
+		double sharded = run(numa_queue, thread_num, total);
+		printf("%7d %10.2f %10.2f\n", thread_num, single, sharded);
+	}
+
+	return 0;
+}
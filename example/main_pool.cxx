@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_pool.hxx"
+
+// 32字节到64KB的变长消息：CasQueueMPMC<std::string>每次生产都malloc，与消息池+CasQueueMPMC<CasMessage *>对比
+// 用法: ./pool [每个生产者的消息数]
+
+const int PRODUCER_NUM = 2;
+const int CONSUMER_NUM = 2;
+
+long message_count = 500000;
+
+CasMessagePool<> message_pool;
+CasQueueMPMC<CasMessage *> *p_handle_queue;
+CasQueueMPMC<std::string> *p_string_queue;
+
+// 八成为小消息，少量为几KB到64KB的大消息
+inline unsigned int message_length(unsigned long &seed)
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	unsigned int rand = seed >> 33;
+	unsigned int percent = rand % 100;
+	if (percent < 80)
+		return 32 + rand % 224;
+	if (percent < 95)
+		return 256 + rand % 3840;
+
+	return 4096 + rand % 61440;
+}
+
+// 消息首尾字节为序号的低8位，中间为长度
+inline void fill_message(char *p_data, unsigned int length, long seq)
+{
+	memset(p_data, (int)(seq & 0xff), length);
+	if (length >= sizeof(unsigned int) + 1)
+		memcpy(p_data + 1, &length, sizeof(unsigned int));
+}
+
+inline bool verify_message(const char *p_data, unsigned int length)
+{
+	unsigned int stored;
+	memcpy(&stored, p_data + 1, sizeof(unsigned int));
+	return stored == length && p_data[0] == p_data[length - 1];
+}
+
+void *func_handle_product(void *arg)
+{
+	unsigned long seed = (unsigned long)arg + 1;
+	for (long ii = 0; ii < message_count; ++ii)
+	{
+		unsigned int length = message_length(seed);
+		CasMessage *p_message = message_pool.Allocate(length);
+		fill_message(p_message->Data(), length, ii);
+		p_handle_queue->Product(p_message);
+	}
+
+	return NULL;
+}
+
+void *func_handle_consume(void *arg)
+{
+	long *p_errors = (long *)arg;
+	CasMessage *p_message;
+	while (true == p_handle_queue->Consume(p_message))
+	{
+		if (false == verify_message(p_message->Data(), p_message->Length()))
+			++*p_errors;
+
+		message_pool.Free(p_message);
+	}
+
+	return NULL;
+}
+
+void *func_string_product(void *arg)
+{
+	unsigned long seed = (unsigned long)arg + 1;
+	for (long ii = 0; ii < message_count; ++ii)
+	{
+		unsigned int length = message_length(seed);
+		std::string message(length, '\0');
+		fill_message(&message[0], length, ii);
+		p_string_queue->Product(std::move(message));
+	}
+
+	return NULL;
+}
+
+void *func_string_consume(void *arg)
+{
+	long *p_errors = (long *)arg;
+	std::string message;
+	while (true == p_string_queue->Consume(message))
+	{
+		if (false == verify_message(message.data(), message.size()))
+			++*p_errors;
+	}
+
+	return NULL;
+}
+
+// 生产者全部结束后关闭队列，消费者取完剩余消息后退出
+template <class Q>
+bool run(const char *name, Q *p_queue, void *(*product)(void *), void *(*consume)(void *))
+{
+	pthread_t product_threads[PRODUCER_NUM];
+	pthread_t consume_threads[CONSUMER_NUM];
+	long errors[CONSUMER_NUM] = {0};
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	for (long ii = 0; ii < CONSUMER_NUM; ++ii)
+		pthread_create(&consume_threads[ii], NULL, consume, &errors[ii]);
+	for (long ii = 0; ii < PRODUCER_NUM; ++ii)
+		pthread_create(&product_threads[ii], NULL, product, (void *)ii);
+
+	for (int ii = 0; ii < PRODUCER_NUM; ++ii)
+		pthread_join(product_threads[ii], NULL);
+	p_queue->Close();
+
+	long error_count = 0;
+	for (int ii = 0; ii < CONSUMER_NUM; ++ii)
+	{
+		pthread_join(consume_threads[ii], NULL);
+		error_count += errors[ii];
+	}
+
+	gettimeofday(&end, NULL);
+
+	printf("%-32s time_use is %4.3f, errors %ld\n", name, (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0, error_count);
+
+	return 0 == error_count;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		message_count = atol(argv[1]);
+
+	p_string_queue = new CasQueueMPMC<std::string>(4096);
+	bool is_ok = run("CasQueueMPMC<std::string>", p_string_queue, func_string_product, func_string_consume);
+	delete p_string_queue;
+
+	p_handle_queue = new CasQueueMPMC<CasMessage *>(4096);
+	is_ok = run("CasMessagePool + CasQueueMPMC", p_handle_queue, func_handle_product, func_handle_consume) && is_ok;
+	delete p_handle_queue;
+
+	printf("pool reserved %lu KB\n", message_pool.ReservedBytes() / 1024);
+	printf("%s\n", true == is_ok ? "ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "cas_priority_queue.hxx"
+
+// 批量数据塞满队列时控制消息的延迟：单个CasQueueMPMC中控制消息排在批量数据之后，优先级队列中走通道0
+// 之后单线程验证防饿死权重下各通道的份额，以及位已过期时让出不会落空
+// 用法: ./priority [控制消息个数]
+
+enum message_kind {DATA = 0, CONTROL, STOP};
+
+struct Message
+{
+	int kind;
+	long timestamp;  // 控制消息生产时的纳秒时间戳
+};
+
+const int BULK_PRODUCER_NUM = 2;
+const int CONSUMER_NUM = 2;
+const unsigned int CONTROL_LANE = 0;
+const unsigned int DATA_LANE = 3;
+
+long control_count = 200;
+std::atomic<bool> is_stop {false};
+
+inline long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 单个队列忽略通道
+inline void product_message(CasQueueMPMC<Message> &queue, unsigned int lane, const Message &msg)
+{
+	queue.Product(msg);
+}
+
+inline void product_message(CasPriorityQueueMPMC<Message> &queue, unsigned int lane, const Message &msg)
+{
+	queue.Product(lane, msg);
+}
+
+template <class Q>
+struct LatencyArg
+{
+	Q *queue;
+	long max_latency;
+	long sum_latency;
+	long control_num;
+};
+
+template <class Q>
+void *func_bulk_product(void *arg)
+{
+	LatencyArg<Q> *latency_arg = (LatencyArg<Q> *)arg;
+
+	Message msg = {DATA, 0};
+	while (false == is_stop.load(std::memory_order_relaxed))
+		product_message(*latency_arg->queue, DATA_LANE, msg);
+
+	return NULL;
+}
+
+template <class Q>
+void *func_control_product(void *arg)
+{
+	LatencyArg<Q> *latency_arg = (LatencyArg<Q> *)arg;
+
+	for (long ii = 0; ii < control_count; ++ii)
+	{
+		usleep(1000);
+		Message msg = {CONTROL, now_ns()};
+		product_message(*latency_arg->queue, CONTROL_LANE, msg);
+	}
+
+	return NULL;
+}
+
+template <class Q>
+void *func_consume(void *arg)
+{
+	LatencyArg<Q> *latency_arg = (LatencyArg<Q> *)arg;
+
+	Message msg = {DATA, 0};
+	for (;;)
+	{
+		latency_arg->queue->Consume(msg);
+		if (STOP == msg.kind)
+			break;
+
+		if (CONTROL == msg.kind)
+		{
+			long latency = now_ns() - msg.timestamp;
+			latency_arg->sum_latency += latency;
+			if (latency > latency_arg->max_latency)
+				latency_arg->max_latency = latency;
+			++latency_arg->control_num;
+		}
+		else
+		{
+			// 模拟处理批量数据的开销，使队列积压
+			for (volatile int jj = 0; jj < 200; ++jj);
+		}
+	}
+
+	return NULL;
+}
+
+template <class Q>
+void run(const char *name)
+{
+	Q test_queue(16384);
+	is_stop.store(false);
+
+	LatencyArg<Q> latency_arg[CONSUMER_NUM + 1];
+	for (int ii = 0; ii <= CONSUMER_NUM; ++ii)
+	{
+		latency_arg[ii].queue = &test_queue;
+		latency_arg[ii].max_latency = 0;
+		latency_arg[ii].sum_latency = 0;
+		latency_arg[ii].control_num = 0;
+	}
+
+	pthread_t bulk_threads[BULK_PRODUCER_NUM];
+	pthread_t consume_threads[CONSUMER_NUM];
+	pthread_t control_thread;
+	for (int ii = 0; ii < BULK_PRODUCER_NUM; ++ii)
+		pthread_create(&bulk_threads[ii], NULL, func_bulk_product<Q>, &latency_arg[CONSUMER_NUM]);
+	for (int ii = 0; ii < CONSUMER_NUM; ++ii)
+		pthread_create(&consume_threads[ii], NULL, func_consume<Q>, &latency_arg[ii]);
+	pthread_create(&control_thread, NULL, func_control_product<Q>, &latency_arg[CONSUMER_NUM]);
+
+	pthread_join(control_thread, NULL);
+	is_stop.store(true);
+	for (int ii = 0; ii < BULK_PRODUCER_NUM; ++ii)
+		pthread_join(bulk_threads[ii], NULL);
+
+	// 停止消息排在剩余的批量数据之后，消费者取完后退出
+	Message stop = {STOP, 0};
+	for (int ii = 0; ii < CONSUMER_NUM; ++ii)
+		product_message(test_queue, DATA_LANE, stop);
+
+	long max_latency = 0;
+	long sum_latency = 0;
+	long control_num = 0;
+	for (int ii = 0; ii < CONSUMER_NUM; ++ii)
+	{
+		pthread_join(consume_threads[ii], NULL);
+		if (latency_arg[ii].max_latency > max_latency)
+			max_latency = latency_arg[ii].max_latency;
+		sum_latency += latency_arg[ii].sum_latency;
+		control_num += latency_arg[ii].control_num;
+	}
+
+	printf("%-24s control %ld/%ld, avg latency %8.1f us, max latency %8.1f us\n", name, control_num, control_count, 0 == control_num ? 0.0 : sum_latency / 1000.0 / control_num, max_latency / 1000.0);
+}
+
+// 通道0与通道1都积压时，权重为3的通道0每连续取3个让出1个给通道1，前1000个中期望通道0为750个、通道1为250个
+bool check_weight()
+{
+	CasPriorityQueueMPMC<int, 2> test_queue(1024, 3);
+	for (int ii = 0; ii < 1000; ++ii)
+	{
+		test_queue.Product(0, 0);
+		test_queue.Product(1, 1);
+	}
+
+	long share[2] = {0, 0};
+	int t_consume;
+	unsigned int lane;
+	for (int ii = 0; ii < 1000; ++ii)
+	{
+		test_queue.Consume(t_consume, &lane);
+		++share[lane];
+	}
+	printf("weight 3, share of first 1000: lane0 %ld, lane1 %ld\n", share[0], share[1]);
+
+	// 取完剩余数据，检查没有丢失
+	long rest = 0;
+	while (true == test_queue.TryConsume(t_consume))
+		++rest;
+
+	return 750 == share[0] && 250 == share[1] && 1000 == rest;
+}
+
+// 通道1的位已过期(数据已被取走)时让出落空，清除该位且额度保持用完，通道1再有数据时下一次消费就让给它
+bool check_stale_yield()
+{
+	CasPriorityQueueMPMC<int, 2> test_queue(1024, 3);
+	int t_consume;
+	unsigned int lane;
+	test_queue.Product(1, 1);
+	test_queue.Consume(t_consume, &lane);  // 取走后通道1的位仍置位
+
+	for (int ii = 0; ii < 100; ++ii)
+		test_queue.Product(0, 0);
+
+	bool is_ok = true;
+	for (int ii = 0; ii < 4; ++ii)
+	{
+		test_queue.Consume(t_consume, &lane);
+		is_ok = is_ok && 0 == lane;
+	}
+
+	test_queue.Product(1, 1);
+	test_queue.Consume(t_consume, &lane);
+	printf("stale lane1 bit, lane of next consume after lane1 refills: %u\n", lane);
+
+	return is_ok && 1 == lane;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		control_count = atol(argv[1]);
+
+	run<CasQueueMPMC<Message> >("CasQueueMPMC");
+	run<CasPriorityQueueMPMC<Message> >("CasPriorityQueueMPMC");
+
+	bool is_ok = check_weight();
+	is_ok = check_stale_yield() && is_ok;
+	printf("%s\n", true == is_ok ? "ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "cas_select_queue.hxx"
+
+// 一个消费阶段同时服务控制队列(单生产者)与数据队列(两个生产者)，生产者突发写入，突发之间空闲
+// 对比三种做法的消费线程个数与消费者CPU时间：轮询两个非阻塞队列、每个队列一个阻塞消费线程、一个线程CasSelect
+// 之后单线程验证轮转顺序、限时等待、关闭与注册个数上限
+// 用法: ./select [每个数据生产者的突发次数] [每次突发的消息数]
+
+const int DATA_PRODUCER_NUM = 2;
+const long STOP = -1;
+
+long burst_count = 500;
+long burst_size = 64;
+
+inline long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 调用线程已使用的CPU时间(纳秒)
+inline long thread_cpu_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 控制消息为突发序号，每次数据突发前发一条；数据消息为1..burst_size
+template <class C, class D>
+struct StageArg
+{
+	C *control_queue;
+	D *data_queue;
+	long control_sum;
+	long data_sum;
+	long cpu_ns;
+};
+
+// 非阻塞队列满时让出CPU再试，阻塞队列的Product只在关闭时返回false
+template <class Q>
+inline void product_wait(Q &queue, long value)
+{
+	while (false == queue.Product(value))
+		sched_yield();
+}
+
+template <class C, class D>
+void *func_control_product(void *arg)
+{
+	StageArg<C, D> *stage_arg = (StageArg<C, D> *)arg;
+
+	for (long ii = 1; ii <= burst_count; ++ii)
+	{
+		product_wait(*stage_arg->control_queue, ii);
+		usleep(100);
+	}
+
+	product_wait(*stage_arg->control_queue, STOP);
+	return NULL;
+}
+
+template <class C, class D>
+void *func_data_product(void *arg)
+{
+	StageArg<C, D> *stage_arg = (StageArg<C, D> *)arg;
+
+	for (long ii = 0; ii < burst_count; ++ii)
+	{
+		for (long jj = 1; jj <= burst_size; ++jj)
+			product_wait(*stage_arg->data_queue, jj);
+
+		usleep(100);  // 突发之间的空闲
+	}
+
+	product_wait(*stage_arg->data_queue, STOP);
+	return NULL;
+}
+
+// 轮询：两个非阻塞队列都空时让出CPU再试
+typedef StageArg<CasQueueNoBlockOPOC<long>, CasQueueNoBlockMPOC<long>> PollArg;
+
+void *func_poll_consume(void *arg)
+{
+	PollArg *stage_arg = (PollArg *)arg;
+
+	long cpu_start = thread_cpu_ns();
+	int stop_num = 0;
+	long value;
+	while (stop_num < 1 + DATA_PRODUCER_NUM)
+	{
+		bool is_consume = false;
+		if (true == stage_arg->control_queue->Consume(value))
+		{
+			is_consume = true;
+			STOP == value ? ++stop_num : stage_arg->control_sum += value;
+		}
+
+		if (true == stage_arg->data_queue->Consume(value))
+		{
+			is_consume = true;
+			STOP == value ? ++stop_num : stage_arg->data_sum += value;
+		}
+
+		if (false == is_consume)
+			sched_yield();
+	}
+
+	stage_arg->cpu_ns = thread_cpu_ns() - cpu_start;
+	return NULL;
+}
+
+// 每个队列一个阻塞消费线程
+typedef StageArg<CasQueueOPOC<long>, CasQueueMPOC<long>> ThreadArg;
+
+void *func_control_consume(void *arg)
+{
+	ThreadArg *stage_arg = (ThreadArg *)arg;
+
+	long cpu_start = thread_cpu_ns();
+	long value;
+	while (true == stage_arg->control_queue->Consume(value) && STOP != value)
+		stage_arg->control_sum += value;
+
+	__atomic_fetch_add(&stage_arg->cpu_ns, thread_cpu_ns() - cpu_start, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+void *func_data_consume(void *arg)
+{
+	ThreadArg *stage_arg = (ThreadArg *)arg;
+
+	long cpu_start = thread_cpu_ns();
+	int stop_num = 0;
+	long value;
+	while (stop_num < DATA_PRODUCER_NUM && true == stage_arg->data_queue->Consume(value))
+		STOP == value ? ++stop_num : stage_arg->data_sum += value;
+
+	__atomic_fetch_add(&stage_arg->cpu_ns, thread_cpu_ns() - cpu_start, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+// 一个线程同时等待两个队列
+typedef StageArg<CasSelectQueue<long, CasQueueOPOC<long>>, CasSelectQueue<long, CasQueueMPOC<long>>> SelectArg;
+
+CasSelector selector;
+
+void *func_select_consume(void *arg)
+{
+	SelectArg *stage_arg = (SelectArg *)arg;
+
+	long cpu_start = thread_cpu_ns();
+	int stop_num = 0;
+	long control, data;
+	while (stop_num < 1 + DATA_PRODUCER_NUM)
+	{
+		switch (CasSelect(selector, CasOn(*stage_arg->control_queue, control), CasOn(*stage_arg->data_queue, data)))
+		{
+			case 0:
+				STOP == control ? ++stop_num : stage_arg->control_sum += control;
+				break;
+			case 1:
+				STOP == data ? ++stop_num : stage_arg->data_sum += data;
+				break;
+			default:
+				printf("select returned -1 before stop\n");
+				return NULL;
+		}
+	}
+
+	stage_arg->cpu_ns = thread_cpu_ns() - cpu_start;
+	return NULL;
+}
+
+template <class C, class D>
+bool run_stage(const char *name, StageArg<C, D> &stage_arg, void *(*consumers[])(void *), int consumer_num)
+{
+	stage_arg.control_sum = 0;
+	stage_arg.data_sum = 0;
+	stage_arg.cpu_ns = 0;
+
+	long start = now_ns();
+	pthread_t threads[DATA_PRODUCER_NUM + 3];
+	int thread_num = 0;
+	for (int ii = 0; ii < consumer_num; ++ii)
+		pthread_create(&threads[thread_num++], NULL, consumers[ii], &stage_arg);
+	pthread_create(&threads[thread_num++], NULL, func_control_product<C, D>, &stage_arg);
+	for (int ii = 0; ii < DATA_PRODUCER_NUM; ++ii)
+		pthread_create(&threads[thread_num++], NULL, func_data_product<C, D>, &stage_arg);
+
+	for (int ii = 0; ii < thread_num; ++ii)
+		pthread_join(threads[ii], NULL);
+	long elapsed = now_ns() - start;
+
+	bool is_ok = stage_arg.control_sum == burst_count * (burst_count + 1) / 2
+		&& stage_arg.data_sum == DATA_PRODUCER_NUM * burst_count * burst_size * (burst_size + 1) / 2;
+	printf("%-16s consumer threads %d, wall %7.1fms, consumer cpu %7.1fms, %s\n", name, consumer_num,
+		elapsed / 1e6, stage_arg.cpu_ns / 1e6, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+// 单线程验证：两个队列都有数据时轮转取，不饿死；超时返回-1；关闭后取完剩余数据返回-1
+bool check_select()
+{
+	CasSelector check_selector;
+	CasSelectQueue<int, CasQueueOPOC<int>> control_queue(check_selector, 64);
+	CasSelectQueue<long, CasQueueNoBlockMPOC<long>> data_queue(check_selector, 64);
+
+	for (int ii = 0; ii < 8; ++ii)
+	{
+		control_queue.Product(ii);
+		data_queue.Product((long)ii);
+	}
+
+	int control;
+	long data;
+	int count[2] = {0, 0};
+	int previous = -1;
+	bool is_alternate = true;
+	for (int ii = 0; ii < 16; ++ii)
+	{
+		int selected = CasTrySelect(check_selector, CasOn(control_queue, control), CasOn(data_queue, data));
+		if (selected < 0)
+			return false;
+
+		is_alternate = is_alternate && selected != previous;
+		previous = selected;
+		++count[selected];
+	}
+
+	long start = now_ns();
+	int timeout_result = CasSelectFor(check_selector, std::chrono::milliseconds(20), CasOn(control_queue, control), CasOn(data_queue, data));
+	long waited = now_ns() - start;
+
+	data_queue.Product(100L);
+	check_selector.Close();
+	int last_result = CasSelect(check_selector, CasOn(control_queue, control), CasOn(data_queue, data));
+	int closed_result = CasSelect(check_selector, CasOn(control_queue, control), CasOn(data_queue, data));
+
+	bool is_ok = 8 == count[0] && 8 == count[1] && true == is_alternate
+		&& -1 == timeout_result && waited >= 20000000 && 1 == last_result && 100 == data && -1 == closed_result;
+	printf("round robin %d/%d alternate %d, timeout %d after %.1fms, after close %d then %d, %s\n",
+		count[0], count[1], is_alternate, timeout_result, waited / 1e6, last_result, closed_result, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+// 一个选择器注册满CAS_SELECT_BITS个队列后，再构造的队列注册失败且不接受数据；最后一个注册成功的队列照常被选中
+bool check_attach_limit()
+{
+	typedef CasSelectQueue<int, CasQueueNoBlockOPOC<int>> SmallQueue;
+	CasSelector limit_selector;
+	SmallQueue *queues[CAS_SELECT_BITS + 1];
+	for (int ii = 0; ii <= CAS_SELECT_BITS; ++ii)
+		queues[ii] = new SmallQueue(limit_selector, 2);
+
+	bool is_last_attached = true == queues[CAS_SELECT_BITS - 1]->IsAttached() && CAS_SELECT_BITS - 1 == queues[CAS_SELECT_BITS - 1]->Index();
+	bool is_over_rejected = false == queues[CAS_SELECT_BITS]->IsAttached() && false == queues[CAS_SELECT_BITS]->Product(1);
+
+	int first, last;
+	queues[CAS_SELECT_BITS - 1]->Product(7);
+	int selected = CasTrySelect(limit_selector, CasOn(*queues[0], first), CasOn(*queues[CAS_SELECT_BITS - 1], last));
+
+	for (int ii = 0; ii <= CAS_SELECT_BITS; ++ii)
+		delete queues[ii];
+
+	bool is_ok = is_last_attached && is_over_rejected && 1 == selected && 7 == last;
+	printf("attach limit %d: last attached %d, over limit rejected %d, selected %d, %s\n",
+		CAS_SELECT_BITS, is_last_attached, is_over_rejected, selected, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		burst_count = atol(argv[1]);
+	if (argc > 2)
+		burst_size = atol(argv[2]);
+
+	printf("control 1 producer, data %d producers, %ld bursts x %ld\n", DATA_PRODUCER_NUM, burst_count, burst_size);
+
+	bool is_ok = true;
+
+	CasQueueNoBlockOPOC<long> poll_control(1024);
+	CasQueueNoBlockMPOC<long> poll_data(1024);
+	PollArg poll_arg = {&poll_control, &poll_data};
+	void *(*poll_consumers[])(void *) = {func_poll_consume};
+	is_ok = run_stage("poll noblock", poll_arg, poll_consumers, 1) && is_ok;
+
+	CasQueueOPOC<long> thread_control(1024);
+	CasQueueMPOC<long> thread_data(1024);
+	ThreadArg thread_arg = {&thread_control, &thread_data};
+	void *(*thread_consumers[])(void *) = {func_control_consume, func_data_consume};
+	is_ok = run_stage("thread per queue", thread_arg, thread_consumers, 2) && is_ok;
+
+	CasSelectQueue<long, CasQueueOPOC<long>> select_control(selector, 1024);
+	CasSelectQueue<long, CasQueueMPOC<long>> select_data(selector, 1024);
+	SelectArg select_arg = {&select_control, &select_data};
+	void *(*select_consumers[])(void *) = {func_select_consume};
+	is_ok = run_stage("CasSelect", select_arg, select_consumers, 1) && is_ok;
+
+	is_ok = check_select() && is_ok;
+	is_ok = check_attach_limit() && is_ok;
+
+	return true == is_ok ? 0 : 1;
+}
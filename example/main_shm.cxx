@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "cas_shm_queue.hxx"
+
+// 父进程创建共享内存队列，fork出的子进程按名字attach后生产，父进程消费
+
+struct Message
+{
+	long id;
+	char payload[56];
+};
+
+int main(int argc, char **argv)
+{
+	const char *name = "/cas_queue_example";
+	const long count = 5000000;
+
+	CasShmQueueOPOC<Message>::Unlink(name);  // 清理上次异常退出遗留的队列
+
+	CasShmQueueOPOC<Message> test_queue;
+	if (false == test_queue.Create(name, 4096))
+	{
+		perror("create shared memory queue");
+		return 1;
+	}
+
+	double time_use;
+	struct timeval start;
+	struct timeval end;
+
+	gettimeofday(&start, NULL);
+
+	pid_t pid = fork();
+	if (0 == pid)
+	{
+		CasShmQueueOPOC<Message> product_queue;
+		if (false == product_queue.Attach(name))
+		{
+			perror("attach shared memory queue");
+			_exit(1);
+		}
+
+		Message msg_product = Message();
+		for (long ii = 0; ii < count; ++ii)
+		{
+			msg_product.id = ii;
+			product_queue.Product(msg_product);
+		}
+		printf("product ii = %ld\n", count);
+		fflush(stdout);
+
+		_exit(0);
+	}
+
+	Message msg_consume;
+	long ii = 0;
+	for (; ii < count; ++ii)
+	{
+		test_queue.Consume(msg_consume);
+		assert(ii == msg_consume.id);
+	}
+	printf("consume ii = %ld\n", ii);
+
+	waitpid(pid, NULL, 0);
+
+	gettimeofday(&end, NULL);
+
+	time_use = (end.tv_sec - start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);//微秒
+	time_use /= 1000000;
+
+	printf("time_use is %4.3f\n", time_use);
+
+	// 队列头被改坏后Attach必须失败：entry个数不是2的N次幂、entry数组超出映射范围
+	typedef __CasShmRing<Message>::HEADER HEADER;
+	int fd = shm_open(name, O_RDWR, 0600);
+	HEADER *p_header = (HEADER *)mmap(NULL, sizeof(HEADER), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	CasShmQueueOPOC<Message> check_queue;
+	unsigned int size = p_header->size;
+	p_header->size = size - 1;
+	bool is_bad_size = false == check_queue.Attach(name);
+	p_header->size = size;
+
+	unsigned long data_offset = p_header->data_offset;
+	p_header->data_offset = p_header->map_size - sizeof(__CasShmRing<Message>::ENTRY);
+	bool is_bad_offset = false == check_queue.Attach(name);
+	p_header->data_offset = data_offset;
+
+	bool is_good = true == check_queue.Attach(name);
+	munmap(p_header, sizeof(HEADER));
+
+	printf("attach corrupted size %d, corrupted offset %d, restored %d\n", !is_bad_size, !is_bad_offset, is_good);
+
+	CasShmQueueOPOC<Message>::Unlink(name);
+
+	return true == is_bad_size && true == is_bad_offset && true == is_good ? 0 : 1;
+}
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_spill_queue.hxx"
+
+// 下游消费者停顿，两个采集线程持续生产：
+// 阻塞队列使采集线程卡住，非阻塞队列丢数据，溢出队列把停顿期间的数据写入段文件，之后按顺序读回
+// 阻塞队列的消费者停顿后与生产者并发消费，溢出队列另外测试消费者不停顿时与生产者并发
+// 用法: ./spill [每个生产者的消息数] [消费者停顿毫秒数] [段文件目录]
+
+const int PRODUCER_NUM = 2;
+const int QUEUE_SIZE = 4096;
+
+long message_count = 1000000;
+long stall_ms = 300;
+const char *spill_dir = "/tmp";
+
+struct Record
+{
+	long producer;
+	long seq;
+	long value[6];
+};
+
+// 变长的std::string通过序列化器溢出
+struct StringSerializer
+{
+	unsigned int Size(const std::string &t)
+	{
+		return t.size();
+	}
+
+	void Write(const std::string &t, char *p_buffer)
+	{
+		memcpy(p_buffer, t.data(), t.size());
+	}
+
+	void Read(std::string &t, const char *p_buffer, unsigned int length)
+	{
+		t.assign(p_buffer, length);
+	}
+};
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+inline void fill_record(Record &record, long producer, long seq)
+{
+	record.producer = producer;
+	record.seq = seq;
+	for (int ii = 0; ii < 6; ++ii)
+		record.value[ii] = seq * (ii + 1);
+}
+
+inline void fill_record(std::string &record, long producer, long seq)
+{
+	char buffer[64];
+	int length = snprintf(buffer, sizeof(buffer), "%ld:%ld:", producer, seq);
+	record.assign(buffer, length);
+	record.append(seq % 64, 'x');
+}
+
+inline bool parse_record(const Record &record, long &producer, long &seq)
+{
+	producer = record.producer;
+	seq = record.seq;
+	return record.value[5] == seq * 6;
+}
+
+inline bool parse_record(const std::string &record, long &producer, long &seq)
+{
+	if (2 != sscanf(record.c_str(), "%ld:%ld:", &producer, &seq))
+		return false;
+
+	return record.size() == (size_t)snprintf(NULL, 0, "%ld:%ld:", producer, seq) + seq % 64;
+}
+
+// 阻塞队列的Product一直等待，其余队列返回false时计为丢失
+template <class Q, class U>
+inline bool product_record(Q *p_queue, const U &record)
+{
+	return p_queue->Product(record);
+}
+
+template <class Q>
+struct RunArg
+{
+	Q *queue;
+	long id;
+	long lost;
+	double max_latency;  // 单次生产的最长耗时
+	double time_use;
+};
+
+template <class Q, class U>
+void *func_product(void *arg)
+{
+	RunArg<Q> *run_arg = (RunArg<Q> *)arg;
+	double start = now();
+	U record;
+	for (long ii = 1; ii <= message_count; ++ii)
+	{
+		fill_record(record, run_arg->id, ii);
+		double begin = now();
+		if (false == product_record(run_arg->queue, record))
+			++run_arg->lost;
+
+		double latency = now() - begin;
+		if (latency > run_arg->max_latency)
+			run_arg->max_latency = latency;
+	}
+	run_arg->time_use = now() - start;
+
+	return NULL;
+}
+
+// 取到所有未丢失的数据为止，is_fifo为true时检查每个生产者的序号递增
+template <class Q, class U>
+bool consume_all(Q *p_queue, long expect, bool is_fifo = true)
+{
+	long last_seq[PRODUCER_NUM] = {0};
+	long consumed = 0;
+	bool is_ok = true;
+	U record;
+	while (consumed < expect)
+	{
+		if (false == p_queue->Consume(record))
+		{
+			sched_yield();
+			continue;
+		}
+
+		long producer;
+		long seq;
+		if (false == parse_record(record, producer, seq) || producer < 0 || producer >= PRODUCER_NUM || (true == is_fifo && seq <= last_seq[producer]))
+			is_ok = false;
+		else
+			last_seq[producer] = seq;
+
+		++consumed;
+	}
+
+	return is_ok;
+}
+
+template <class Q, class U>
+bool run(const char *name, Q *p_queue)
+{
+	RunArg<Q> run_arg[PRODUCER_NUM];
+	pthread_t threads[PRODUCER_NUM];
+	double start = now();
+	for (int ii = 0; ii < PRODUCER_NUM; ++ii)
+	{
+		run_arg[ii].queue = p_queue;
+		run_arg[ii].id = ii;
+		run_arg[ii].lost = 0;
+		run_arg[ii].max_latency = 0;
+		pthread_create(&threads[ii], NULL, func_product<Q, U>, &run_arg[ii]);
+	}
+
+	// 丢失的个数在生产者结束后才知道
+	for (int ii = 0; ii < PRODUCER_NUM; ++ii)
+		pthread_join(threads[ii], NULL);
+
+	long lost = 0;
+	double max_latency = 0;
+	double produce_time = 0;
+	for (int ii = 0; ii < PRODUCER_NUM; ++ii)
+	{
+		lost += run_arg[ii].lost;
+		max_latency = run_arg[ii].max_latency > max_latency ? run_arg[ii].max_latency : max_latency;
+		produce_time = run_arg[ii].time_use > produce_time ? run_arg[ii].time_use : produce_time;
+	}
+
+	bool is_ok = consume_all<Q, U>(p_queue, message_count * PRODUCER_NUM - lost);
+
+	printf("%-36s produce %6.3f s, max product latency %8.3f ms, lost %8ld, total %6.3f s, %s\n", name, produce_time, max_latency * 1000, lost, now() - start, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+/*
+ * 消费者停顿后与生产者并发消费，阻塞队列的生产者要等消费者，溢出队列在内存队列与段文件之间反复切换
+ * 多生产者的阻塞队列中套圈的生产者可能先进门，不保证同一生产者的顺序
+ */
+template <class Q, class U>
+bool run_concurrent(const char *name, Q *p_queue, bool is_fifo, long stall)
+{
+	RunArg<Q> run_arg[PRODUCER_NUM];
+	pthread_t threads[PRODUCER_NUM];
+	double start = now();
+	for (int ii = 0; ii < PRODUCER_NUM; ++ii)
+	{
+		run_arg[ii].queue = p_queue;
+		run_arg[ii].id = ii;
+		run_arg[ii].lost = 0;
+		run_arg[ii].max_latency = 0;
+		pthread_create(&threads[ii], NULL, func_product<Q, U>, &run_arg[ii]);
+	}
+
+	usleep(stall * 1000);
+	bool is_ok = consume_all<Q, U>(p_queue, message_count * PRODUCER_NUM, is_fifo);
+	double max_latency = 0;
+	double produce_time = 0;
+	for (int ii = 0; ii < PRODUCER_NUM; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+		max_latency = run_arg[ii].max_latency > max_latency ? run_arg[ii].max_latency : max_latency;
+		produce_time = run_arg[ii].time_use > produce_time ? run_arg[ii].time_use : produce_time;
+	}
+
+	printf("%-36s produce %6.3f s, max product latency %8.3f ms, lost %8d, total %6.3f s, %s\n", name, produce_time, max_latency * 1000, 0, now() - start, true == is_ok ? "ok" : "FAILED");
+
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		message_count = atol(argv[1]);
+	if (argc > 2)
+		stall_ms = atol(argv[2]);
+	if (argc > 3)
+		spill_dir = argv[3];
+
+	bool is_ok = true;
+	Record record;
+
+	CasQueueMPOC<Record> *p_block = new CasQueueMPOC<Record>(QUEUE_SIZE);
+	is_ok = run_concurrent<CasQueueMPOC<Record>, Record>("CasQueueMPOC blocks", p_block, false, stall_ms) && is_ok;
+	delete p_block;
+
+	CasQueueNoBlockMPOC<Record> *p_drop = new CasQueueNoBlockMPOC<Record>(QUEUE_SIZE);
+	is_ok = run<CasQueueNoBlockMPOC<Record>, Record>("CasQueueNoBlockMPOC drops", p_drop) && is_ok;
+	delete p_drop;
+
+	CasSpillQueue<Record> *p_spill = new CasSpillQueue<Record>(QUEUE_SIZE, spill_dir, 16UL << 20);
+	is_ok = run<CasSpillQueue<Record>, Record>("CasSpillQueue", p_spill) && is_ok;
+	printf("    spilled %lu records\n", p_spill->SpillTotal());
+	is_ok = false == p_spill->Consume(record) && 0 == p_spill->ApproxSize() && false == p_spill->IsSpilling() && is_ok;  // 读空段文件时切回内存队列
+	delete p_spill;
+
+	p_spill = new CasSpillQueue<Record>(QUEUE_SIZE, spill_dir, 1UL << 20);
+	is_ok = run_concurrent<CasSpillQueue<Record>, Record>("CasSpillQueue concurrent", p_spill, true, 0) && is_ok;
+	printf("    spilled %lu records\n", p_spill->SpillTotal());
+	is_ok = false == p_spill->Consume(record) && 0 == p_spill->ApproxSize() && false == p_spill->IsSpilling() && is_ok;  // 读空段文件时切回内存队列
+	delete p_spill;
+
+	typedef CasSpillQueue<std::string, CasQueueNoBlockMPOC<std::string>, StringSerializer> StringSpillQueue;
+	StringSpillQueue *p_string = new StringSpillQueue(QUEUE_SIZE, spill_dir, 16UL << 20);
+	is_ok = run<StringSpillQueue, std::string>("CasSpillQueue<std::string>", p_string) && is_ok;
+	printf("    spilled %lu records\n", p_string->SpillTotal());
+	delete p_string;
+
+	printf("%s\n", true == is_ok ? "ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
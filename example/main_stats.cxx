@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <math.h>
+#include "cas_queue.hxx"
+
+// 开启按线程分片统计的多生产多消费阻塞队列，监控线程每100毫秒抓取一次快照
+CasQueueMPMC<string, CasLayoutCompact, CasWaitPark, CasStatsSharded<> > test_queue(1024);
+
+volatile bool is_stop = false;
+
+void *func_product(void *arg)
+{
+	string str_product = "hello world";
+
+	int ii = 0;
+	for (; ii < 2500000; ++ii)
+	{
+		test_queue.Product(str_product);
+	}
+	printf("product ii = %d\n", ii);
+
+	return NULL;
+}
+
+void *func_consume(void *arg)
+{
+	string str_consume;
+	int ii = 0;
+	for (; ii < 2500000; ++ii)
+	{
+		test_queue.Consume(str_consume);
+	}
+	printf("consume ii = %d\n", ii);
+
+	return NULL;
+}
+
+void print_stats(const CasQueueStats &queue_stats)
+{
+	printf("size %lu/%lu", queue_stats.size, queue_stats.capacity);
+	for (unsigned int ii = 0; ii < CAS_STAT_COUNT; ++ii)
+	{
+		if (0 != queue_stats.counter[ii])
+			printf(" %s=%lu", CasStatName(ii), queue_stats.counter[ii]);
+	}
+	printf("\n");
+}
+
+void *func_monitor(void *arg)
+{
+	CasQueueStats queue_stats;
+	while (false == is_stop)
+	{
+		usleep(100000);
+
+		test_queue.Snapshot(queue_stats);
+		print_stats(queue_stats);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	double time_use;
+	struct timeval start;
+	struct timeval end;
+
+	gettimeofday(&start, NULL);
+
+	pthread_t t_product_1, t_product_2;
+	pthread_t t_consume_1, t_consume_2;
+	pthread_t t_monitor;
+
+	pthread_create(&t_monitor, NULL, func_monitor, NULL);
+	pthread_create(&t_product_1, NULL, func_product, NULL);
+	pthread_create(&t_product_2, NULL, func_product, NULL);
+	pthread_create(&t_consume_1, NULL, func_consume, NULL);
+	pthread_create(&t_consume_2, NULL, func_consume, NULL);
+
+	pthread_join(t_product_1, NULL);
+	pthread_join(t_product_2, NULL);
+	pthread_join(t_consume_1, NULL);
+	pthread_join(t_consume_2, NULL);
+
+	is_stop = true;
+	pthread_join(t_monitor, NULL);
+
+	gettimeofday(&end, NULL);
+
+	time_use = (end.tv_sec - start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);//微秒
+	time_use /= 1000000;
+
+	printf("time_use is %4.3f\n", time_use);
+
+	CasQueueStats queue_stats;
+	test_queue.Snapshot(queue_stats);
+	print_stats(queue_stats);
+
+	return 0;
+}
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "cas_queue.hxx"
+#include "cas_segment_queue.hxx"
+#include "cas_numa_queue.hxx"
+#include "cas_shm_queue.hxx"
+
+/*
+ * 内存序压力测试，使用-fsanitize=thread编译（make中的tsan目标）
+ *
+ * 每种队列在很小的容量下反复套圈，消息体为普通的非原子字段，entry状态、seq、门、等待字上的acquire/release
+ * 如果不足以发布数据，ThreadSanitizer会报告数据竞争，校验字段也可能读到半写的数据；
+ * 同时检查每条消息恰好被消费一次；单生产者单消费者时还检查消费顺序与生产顺序一致
+ * 多生产者或多消费者时套圈的线程可能先于同一entry上的慢线程进门，不保证同一生产者的消息按顺序被消费
+ * 分段队列用很小的段反复链接、退役、回收段；NUMA队列分成两个子队列使生产者溢出、消费者窃取；
+ * 共享内存队列在进程内由多个线程使用
+ * 用法: ./tsan [每个生产者的消息数]
+ */
+
+struct Message
+{
+	long producer;
+	long seq;
+	long check[6];
+};
+
+template <class Q>
+struct StressArg
+{
+	Q *queue;
+	int id;
+	int producer_num;
+	long count;  // 生产者为生产个数，消费者为消费个数（为0时一直消费到队列关闭）
+	long per_producer;  // 每个生产者的消息数
+	unsigned char *seen;  // 每条消息被消费的次数，按生产者编号和序号定位
+	bool is_fifo;  // 是否检查消费顺序
+	long consumed;
+	long sum;
+	bool is_ok;
+};
+
+// 分段、NUMA、共享内存阻塞队列的Product/Consume没有返回值，返回时即已成功
+template <class Q>
+auto product_once(Q *queue, const Message &msg, int) -> decltype(bool(queue->Product(msg)))
+{
+	return queue->Product(msg);
+}
+
+template <class Q>
+bool product_once(Q *queue, const Message &msg, long)
+{
+	queue->Product(msg);
+	return true;
+}
+
+template <class Q>
+auto consume_once(Q *queue, Message &msg, int) -> decltype(bool(queue->Consume(msg)))
+{
+	return queue->Consume(msg);
+}
+
+template <class Q>
+bool consume_once(Q *queue, Message &msg, long)
+{
+	queue->Consume(msg);
+	return true;
+}
+
+// 阻塞队列的Product/Consume一直等待，非阻塞队列失败时让出CPU重试
+template <class Q>
+inline void product_message(Q *queue, const Message &msg)
+{
+	while (false == product_once(queue, msg, 0))
+		sched_yield();
+}
+
+template <class Q>
+inline bool consume_message(Q *queue, Message &msg, bool is_close)
+{
+	if (true == is_close)
+		return consume_once(queue, msg, 0);
+
+	while (false == consume_once(queue, msg, 0))
+		sched_yield();
+
+	return true;
+}
+
+// 用固定的第二个构造参数构造：分段队列的段数上限、NUMA队列的子队列个数
+template <class Q, int N>
+struct WithArg : Q
+{
+	WithArg(int queue_size) : Q(queue_size, N)
+	{
+	}
+};
+
+// 每次测试新建一个共享内存队列，结束时删除
+template <class Q>
+struct ShmTest : Q
+{
+	ShmTest(int queue_size)
+	{
+		Q::Unlink("/cas_queue_tsan");
+		if (false == Q::Create("/cas_queue_tsan", queue_size))
+		{
+			perror("create shared memory queue");
+			exit(1);
+		}
+	}
+
+	~ShmTest()
+	{
+		Q::Unlink("/cas_queue_tsan");
+	}
+};
+
+template <class Q>
+void *func_product(void *arg)
+{
+	StressArg<Q> *stress_arg = (StressArg<Q> *)arg;
+
+	Message msg;
+	for (long ii = 1; ii <= stress_arg->count; ++ii)
+	{
+		msg.producer = stress_arg->id;
+		msg.seq = ii;
+		for (int jj = 0; jj < 6; ++jj)
+			msg.check[jj] = ii * (jj + 1) ^ stress_arg->id;
+
+		product_message(stress_arg->queue, msg);
+	}
+
+	return NULL;
+}
+
+template <class Q>
+void *func_consume(void *arg)
+{
+	StressArg<Q> *stress_arg = (StressArg<Q> *)arg;
+
+	long last_seq = 0;
+	bool is_close = 0 == stress_arg->count;
+
+	Message msg;
+	while (true == is_close || stress_arg->consumed < stress_arg->count)
+	{
+		if (false == consume_message(stress_arg->queue, msg, is_close))
+			break;  // 队列已关闭且已取完
+
+		for (int jj = 0; jj < 6; ++jj)
+		{
+			if (msg.check[jj] != (msg.seq * (jj + 1) ^ msg.producer))
+				stress_arg->is_ok = false;
+		}
+
+		if (msg.producer < 0 || msg.producer >= stress_arg->producer_num || msg.seq < 1 || msg.seq > stress_arg->per_producer)
+			stress_arg->is_ok = false;
+		else if (0 != stress_arg->seen[msg.producer * stress_arg->per_producer + msg.seq - 1]++)
+			stress_arg->is_ok = false;  // 同一条消息被消费了两次
+
+		if (true == stress_arg->is_fifo && msg.seq != last_seq + 1)
+			stress_arg->is_ok = false;
+		last_seq = msg.seq;
+
+		stress_arg->sum += msg.seq;
+		++stress_arg->consumed;
+	}
+
+	return NULL;
+}
+
+// 只有阻塞队列有Close
+template <class Q>
+auto close_queue(Q &queue, int) -> decltype(queue.Close())
+{
+	queue.Close();
+}
+
+template <class Q>
+void close_queue(Q &queue, long)
+{
+}
+
+// is_close为true时消费者不限个数，生产者全部结束后关闭队列，消费者取完剩余数据后退出
+template <class Q>
+bool run(const char *name, int queue_size, int producer_num, int consumer_num, long count, bool is_close = false)
+{
+	Q test_queue(queue_size);
+	int thread_num = producer_num + consumer_num;
+	StressArg<Q> *stress_arg = new StressArg<Q> [thread_num];
+	pthread_t *threads = new pthread_t [thread_num];
+	unsigned char *seen = new unsigned char [producer_num * count]();
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		stress_arg[ii].queue = &test_queue;
+		stress_arg[ii].producer_num = producer_num;
+		stress_arg[ii].per_producer = count;
+		stress_arg[ii].seen = seen;
+		stress_arg[ii].is_fifo = 1 == producer_num && 1 == consumer_num;
+		stress_arg[ii].consumed = 0;
+		stress_arg[ii].sum = 0;
+		stress_arg[ii].is_ok = true;
+
+		if (ii < producer_num)
+		{
+			stress_arg[ii].id = ii;
+			stress_arg[ii].count = count;
+			pthread_create(&threads[ii], NULL, func_product<Q>, &stress_arg[ii]);
+		}
+		else
+		{
+			stress_arg[ii].id = ii - producer_num;
+			stress_arg[ii].count = true == is_close ? 0 : count * producer_num / consumer_num + (ii == thread_num - 1 ? count * producer_num % consumer_num : 0);
+			pthread_create(&threads[ii], NULL, func_consume<Q>, &stress_arg[ii]);
+		}
+	}
+
+	for (int ii = 0; ii < producer_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+	}
+
+	if (true == is_close)
+		close_queue(test_queue, 0);
+
+	bool is_ok = true;
+	long consumed = 0;
+	long sum = 0;
+	for (int ii = producer_num; ii < thread_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+		is_ok = is_ok && stress_arg[ii].is_ok;
+		consumed += stress_arg[ii].consumed;
+		sum += stress_arg[ii].sum;
+	}
+
+	is_ok = is_ok && consumed == count * producer_num && sum == producer_num * count * (count + 1) / 2;
+	printf("%-40s size %-4d %dP%dC %s\n", name, queue_size, producer_num, consumer_num, true == is_ok ? "ok" : "FAILED");
+
+	delete [] seen;
+	delete [] threads;
+	delete [] stress_arg;
+
+	return is_ok;
+}
+
+// 生产过程中关闭：生产者在Product返回false后停止，消费者一直取到Consume返回false
+std::atomic<long> product_total {0};
+
+template <class Q>
+void *func_product_until_close(void *arg)
+{
+	StressArg<Q> *stress_arg = (StressArg<Q> *)arg;
+
+	Message msg;
+	for (long ii = 1; ii <= stress_arg->count; ++ii)
+	{
+		msg.producer = stress_arg->id;
+		msg.seq = ii;
+		for (int jj = 0; jj < 6; ++jj)
+			msg.check[jj] = ii * (jj + 1) ^ stress_arg->id;
+
+		if (false == stress_arg->queue->Product(msg))
+			break;
+
+		stress_arg->consumed = ii;  // 生产者借用consumed记录成功生产的个数
+		product_total.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	return NULL;
+}
+
+// 生产到一半时关闭，检查每一条Product返回true的消息都恰好被消费一次，返回false的消息没有被消费
+template <class Q>
+bool run_close_midway(const char *name, int queue_size, int producer_num, int consumer_num, long count, int round)
+{
+	bool is_ok = true;
+	for (int rr = 0; rr < round; ++rr)
+	{
+		Q test_queue(queue_size);
+		int thread_num = producer_num + consumer_num;
+		StressArg<Q> *stress_arg = new StressArg<Q> [thread_num];
+		pthread_t *threads = new pthread_t [thread_num];
+		unsigned char *seen = new unsigned char [producer_num * count]();
+
+		product_total.store(0, std::memory_order_relaxed);
+		for (int ii = 0; ii < thread_num; ++ii)
+		{
+			stress_arg[ii].queue = &test_queue;
+			stress_arg[ii].id = ii < producer_num ? ii : ii - producer_num;
+			stress_arg[ii].producer_num = producer_num;
+			stress_arg[ii].count = ii < producer_num ? count : 0;
+			stress_arg[ii].per_producer = count;
+			stress_arg[ii].seen = seen;
+			stress_arg[ii].is_fifo = false;
+			stress_arg[ii].consumed = 0;
+			stress_arg[ii].sum = 0;
+			stress_arg[ii].is_ok = true;
+			pthread_create(&threads[ii], NULL, ii < producer_num ? func_product_until_close<Q> : func_consume<Q>, &stress_arg[ii]);
+		}
+
+		while (product_total.load(std::memory_order_relaxed) < producer_num * count / 2)
+			sched_yield();
+		test_queue.Close();
+
+		for (int ii = 0; ii < thread_num; ++ii)
+			pthread_join(threads[ii], NULL);
+
+		long produced = 0;
+		long consumed = 0;
+		for (int ii = 0; ii < thread_num; ++ii)
+		{
+			is_ok = is_ok && stress_arg[ii].is_ok;
+			(ii < producer_num ? produced : consumed) += stress_arg[ii].consumed;
+		}
+
+		for (int ii = 0; ii < producer_num; ++ii)
+		{
+			for (long jj = 0; jj < count; ++jj)
+				is_ok = is_ok && (jj < stress_arg[ii].consumed ? 1 : 0) == seen[ii * count + jj];
+		}
+
+		is_ok = is_ok && produced == consumed;
+
+		delete [] seen;
+		delete [] threads;
+		delete [] stress_arg;
+	}
+
+	printf("%-40s size %-4d %dP%dC %s\n", name, queue_size, producer_num, consumer_num, true == is_ok ? "ok" : "FAILED");
+	return is_ok;
+}
+
+// 容量越小套圈越频繁
+template <class Q>
+bool run_all(const char *name, int producer_num, int consumer_num, long count)
+{
+	bool is_ok = true;
+	int sizes[] = {2, 4, 64};
+	for (int ii = 0; ii < 3; ++ii)
+	{
+		is_ok = run<Q>(name, sizes[ii], producer_num, consumer_num, count) && is_ok;
+	}
+
+	return is_ok;
+}
+
+int main(int argc, char **argv)
+{
+	long count = argc > 1 ? atol(argv[1]) : 20000;
+
+	bool is_ok = true;
+	is_ok = run_all<CasQueueMPMC<Message> >("CasQueueMPMC", 3, 3, count) && is_ok;
+	is_ok = run_all<CasQueueMPOC<Message> >("CasQueueMPOC", 3, 1, count) && is_ok;
+	is_ok = run_all<CasQueueOPMC<Message> >("CasQueueOPMC", 1, 3, count) && is_ok;
+	is_ok = run_all<CasQueueOPOC<Message> >("CasQueueOPOC", 1, 1, count) && is_ok;
+	is_ok = run_all<CasQueueMPMC<Message, CasLayoutSplit, CasWaitAdaptive> >("CasQueueMPMC split adaptive", 3, 3, count) && is_ok;
+	is_ok = run_all<CasQueueNoBlockMPMC<Message> >("CasQueueNoBlockMPMC", 3, 3, count) && is_ok;
+	is_ok = run_all<CasQueueNoBlockMPOC<Message> >("CasQueueNoBlockMPOC", 3, 1, count) && is_ok;
+	is_ok = run_all<CasQueueNoBlockOPMC<Message> >("CasQueueNoBlockOPMC", 1, 3, count) && is_ok;
+	is_ok = run_all<CasQueueNoBlockOPOC<Message> >("CasQueueNoBlockOPOC", 1, 1, count) && is_ok;
+	is_ok = run<CasQueue<Message, CAS_MANY, CAS_MANY, false, 8> >("CasQueue<MANY, MANY, noblock, 8>", 8, 2, 2, count) && is_ok;
+
+	// 段大小即容量参数，段数上限为2时生产者在链接新段前等待段被回收
+	is_ok = run_all<CasSegmentQueueNoBlockMPMC<Message> >("CasSegmentQueueNoBlockMPMC", 3, 3, count) && is_ok;
+	is_ok = run_all<WithArg<CasSegmentQueueNoBlockMPMC<Message>, 2> >("CasSegmentQueueNoBlockMPMC max 2", 3, 3, count) && is_ok;
+	is_ok = run_all<WithArg<CasSegmentQueueMPMC<Message>, 2> >("CasSegmentQueueMPMC max 2", 3, 3, count) && is_ok;
+	is_ok = run_all<WithArg<CasNumaQueueMPMC<Message>, 2> >("CasNumaQueueMPMC 2 shards", 3, 3, count) && is_ok;
+	is_ok = run_all<ShmTest<CasShmQueueNoBlockMPMC<Message> > >("CasShmQueueNoBlockMPMC", 3, 3, count) && is_ok;
+	is_ok = run_all<ShmTest<CasShmQueueNoBlockOPOC<Message> > >("CasShmQueueNoBlockOPOC", 1, 1, count) && is_ok;
+	is_ok = run_all<ShmTest<CasShmQueueMPMC<Message> > >("CasShmQueueMPMC", 3, 3, count) && is_ok;
+	is_ok = run_all<ShmTest<CasShmQueueOPOC<Message> > >("CasShmQueueOPOC", 1, 1, count) && is_ok;
+
+	// 关闭时正在等待的消费者被唤醒后取完剩余数据
+	is_ok = run<CasQueueMPMC<Message> >("CasQueueMPMC close", 4, 3, 3, count, true) && is_ok;
+	is_ok = run<CasQueueOPMC<Message> >("CasQueueOPMC close", 4, 1, 3, count, true) && is_ok;
+
+	// 生产过程中关闭，生产成功的消息不会因为关闭而留在队列中
+	is_ok = run_close_midway<CasQueueMPMC<Message> >("CasQueueMPMC close midway", 4, 3, 3, count / 10, 50) && is_ok;
+	is_ok = run_close_midway<CasQueueMPOC<Message> >("CasQueueMPOC close midway", 4, 3, 1, count / 10, 50) && is_ok;
+	is_ok = run_close_midway<CasQueueOPMC<Message> >("CasQueueOPMC close midway", 2, 1, 3, count / 10, 50) && is_ok;
+	is_ok = run_close_midway<CasQueueOPOC<Message> >("CasQueueOPOC close midway", 2, 1, 1, count / 10, 50) && is_ok;
+
+	printf("%s\n", true == is_ok ? "all ok" : "FAILED");
+
+	return true == is_ok ? 0 : 1;
+}
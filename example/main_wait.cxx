@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "cas_queue.hxx"
+
+// 对比不同等待策略在不同线程数、不同队列长度下的吞吐量
+// 用法: ./wait [每轮消息总数] [最大线程数]
+// CasWaitSpin从不挂起，线程数超过CPU核数时吞吐量会急剧下降
+
+template <class Wait>
+struct BenchArg
+{
+	CasQueueMPMC<int, CasLayoutCompact, Wait> *queue;
+	long count;
+};
+
+template <class Wait>
+void *func_product(void *arg)
+{
+	BenchArg<Wait> *bench_arg = (BenchArg<Wait> *)arg;
+	int t_product = 0;
+
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		bench_arg->queue->Product(t_product);
+	}
+
+	return NULL;
+}
+
+template <class Wait>
+void *func_consume(void *arg)
+{
+	BenchArg<Wait> *bench_arg = (BenchArg<Wait> *)arg;
+	int t_consume;
+
+	for (long ii = 0; ii < bench_arg->count; ++ii)
+	{
+		bench_arg->queue->Consume(t_consume);
+	}
+
+	return NULL;
+}
+
+template <class Wait>
+double run(int thread_num, int queue_size, long total)
+{
+	CasQueueMPMC<int, CasLayoutCompact, Wait> test_queue(queue_size);
+	BenchArg<Wait> bench_arg;
+	bench_arg.queue = &test_queue;
+	bench_arg.count = total / (thread_num / 2);
+
+	pthread_t *threads = new pthread_t [thread_num];
+
+	struct timeval start;
+	struct timeval end;
+	gettimeofday(&start, NULL);
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		if (ii % 2 == 0)
+			pthread_create(&threads[ii], NULL, func_product<Wait>, &bench_arg);
+		else
+			pthread_create(&threads[ii], NULL, func_consume<Wait>, &bench_arg);
+	}
+
+	for (int ii = 0; ii < thread_num; ++ii)
+	{
+		pthread_join(threads[ii], NULL);
+	}
+
+	gettimeofday(&end, NULL);
+	delete [] threads;
+
+	double time_use = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);  // 微秒
+
+	return bench_arg.count * (thread_num / 2) / time_use;  // 每微秒消息数，即百万次每秒
+}
+
+void run_size(int queue_size, int max_thread, long total)
+{
+	for (int thread_num = 2; thread_num <= max_thread; thread_num *= 2)
+	{
+		printf("%-8d %7d %10.2f %10.2f %10.2f\n", queue_size, thread_num,
+				run<CasWaitPark>(thread_num, queue_size, total),
+				run<CasWaitAdaptive>(thread_num, queue_size, total),
+				run<CasWaitSpin>(thread_num, queue_size, total));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	long total = argc > 1 ? atol(argv[1]) : 1000000;
+	int max_thread = argc > 2 ? atoi(argv[2]) : 8;
+
+	printf("online cpus: %ld, messages per run: %ld, unit: Mops/s\n", sysconf(_SC_NPROCESSORS_ONLN), total);
+	printf("%-8s %7s %10s %10s %10s\n", "size", "threads", "park", "adaptive", "spin");
+
+	run_size(16, max_thread, total);
+	run_size(1024, max_thread, total);
+
+	return 0;
+}